@@ -0,0 +1,138 @@
+/*
+   Benchmark helpers
+
+   Small helpers shared by the benchmark programs in this directory: a wall
+   clock stopwatch, a barrier against the optimizer, key generators, the
+   report line and the mutex protected tree that the concurrent maps are
+   measured against. Every benchmark takes its sizes from the command line,
+   so the same program runs quickly on a laptop and at 10^8 keys on a big
+   box.
+*/
+
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <numeric>
+#include <random>
+#include <vector>
+
+#include "red black tree.h"
+
+// Measures wall clock time since construction or the last restart()
+class Stopwatch{
+public:
+	Stopwatch(): start(std::chrono::steady_clock::now()){}
+
+	void restart(){start = std::chrono::steady_clock::now();}
+
+	double seconds() const{
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+
+private:
+	std::chrono::steady_clock::time_point start;
+};
+
+// Keeps the optimizer from throwing away a computed value
+template<typename T>
+inline void donotoptimize(const T &value){
+	asm volatile("" : : "r,m"(value) : "memory");
+}
+
+// Reads the index:th command line argument as a count, def if missing
+inline std::size_t argcount(int argc, char **argv, int index, std::size_t def){
+	if(index < argc){
+		return std::strtoull(argv[index], nullptr, 0);
+	}
+	return def;
+}
+
+// n distinct keys in random order
+inline std::vector<std::uint64_t> randomkeys(std::size_t n, std::uint64_t seed = 1){
+	std::vector<std::uint64_t> keys(n);
+	std::iota(keys.begin(), keys.end(), std::uint64_t(0));
+	std::shuffle(keys.begin(), keys.end(), std::mt19937_64(seed));
+	return keys;
+}
+
+// Zipf distributed ranks in [0, n), rank 0 the most frequent, drawn in
+// O(1) with the method of Gray et al. ("Quickly generating billion-record
+// synthetic databases") that YCSB uses. theta below 1, 0.99 is the usual
+// skew
+class Zipf{
+public:
+	Zipf(std::uint64_t n, double theta = 0.99): n(n), theta(theta){
+		double zeta2 = 0;
+		for(std::uint64_t i = 1; i <= n; ++i){
+			double term = 1 / std::pow(double(i), theta);
+			zetan += term;
+			if(i <= 2){zeta2 += term;}
+		}
+		alpha = 1 / (1 - theta);
+		eta = (1 - std::pow(2.0 / n, 1 - theta)) / (1 - zeta2 / zetan);
+		half = 1 + std::pow(0.5, theta);
+	}
+
+	template<typename Rng>
+	std::uint64_t operator()(Rng &rng){
+		double u = std::uniform_real_distribution<double>()(rng);
+		double uz = u * zetan;
+		if(uz < 1){return 0;}
+		if(uz < half){return 1;}
+		std::uint64_t rank = std::uint64_t(n * std::pow(eta * u - eta + 1, alpha));
+		return rank < n ? rank : n - 1;
+	}
+
+private:
+	std::uint64_t n;
+	double theta, zetan = 0, alpha, eta, half;
+};
+
+// Spreads ranks over [0, n) so that the hot keys are not neighbours
+inline std::uint64_t scramble(std::uint64_t rank, std::uint64_t n){
+	return (rank * 0x9e3779b97f4a7c15ull ^ rank >> 7) % n;
+}
+
+// Prints one result line: label, total time and time per operation
+inline void report(const char *label, std::size_t ops, double seconds){
+	std::printf("%-40s %10.3f s %10.1f ns/op\n", label, seconds,
+		ops ? seconds * 1e9 / ops : 0.0);
+}
+
+// The baseline of the concurrent map benchmarks: an RbTree with every
+// operation under one mutex
+class MutexTree{
+public:
+	bool insert(std::uint64_t key, std::uint64_t value){
+		std::lock_guard<std::mutex> lock(guard);
+		return tree.try_emplace(key, value).second;
+	}
+
+	bool erase(std::uint64_t key){
+		std::lock_guard<std::mutex> lock(guard);
+		return tree.erase(key);
+	}
+
+	bool find(std::uint64_t key, std::uint64_t &value){
+		std::lock_guard<std::mutex> lock(guard);
+		auto it = tree.find(key);
+		if(it == tree.end()){
+			return false;
+		}
+		value = it->value;
+		return true;
+	}
+
+private:
+	std::mutex guard;
+	RbTree<std::uint64_t, std::uint64_t> tree;
+};
+
+#endif
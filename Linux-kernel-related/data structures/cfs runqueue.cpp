@@ -0,0 +1,258 @@
+/*
+   CFS runqueue simulator
+
+   The cfs scheduler keeps the runnable sched_entities of a cpu in a red
+   black tree ordered by virtual runtime. The entity that has run the least
+   (weighted by its priority) is the left most node, and that is the one
+   picked next. The kernel caches the left most node in an rb_root_cached,
+   so picking the next entity never walks the left spine of the tree.
+
+   This program models that workload on the intrusive tree: every simulated
+   cpu has its own cfs_rq, every task a sched_entity with a weight taken
+   from its nice level. A scheduling decision picks the left most entity,
+   takes it off the tree, charges it a time slice scaled by its weight and
+   puts it back, and now and then the task blocks and is woken up later.
+   Every cpu runs in its own thread. The program reports the scheduling
+   throughput, the per-operation latencies of enqueue, dequeue and pick-next,
+   and compares the cached pick-next with a walk down the left spine.
+
+   arguments: tasks, cpus, scheduling decisions per cpu
+
+   g++ -O2 -std=c++17 -pthread "cfs runqueue.cpp" && ./a.out 100000 4 2000000
+*/
+
+#include <iostream>
+#include <queue>
+#include <thread>
+
+#include "benchmark.h"
+#include "rb intrusive.h"
+
+using namespace std;
+
+// nice -20..19 to load weight (kernel/sched/core.c)
+const unsigned sched_prio_to_weight[40] = {
+	88761, 71755, 56483, 46273, 36291,
+	29154, 23254, 18705, 14949, 11916,
+	9548, 7620, 6100, 4904, 3906,
+	3121, 2501, 1991, 1586, 1277,
+	1024, 820, 655, 526, 423,
+	335, 272, 215, 172, 137,
+	110, 87, 70, 56, 45,
+	36, 29, 23, 18, 15,
+};
+
+const uint64_t NICE_0_LOAD = 1024;
+const uint64_t sysctl_sched_latency = 6000000;         // ns
+const uint64_t sysctl_sched_min_granularity = 750000;  // ns
+const unsigned sched_nr_latency = 8;
+
+struct sched_entity{
+	uint64_t vruntime = 0;
+	uint64_t sum_exec_runtime = 0;
+	uint64_t wakeup = 0;
+	unsigned weight = NICE_0_LOAD;
+	rb_node run_node;
+};
+
+struct cfs_rq{
+	rb_root_cached tasks_timeline;
+	uint64_t min_vruntime = 0;
+	uint64_t load = 0;
+	unsigned nr_running = 0;
+};
+
+// Orders entities by vruntime, the difference keeps it wraparound safe
+inline bool entity_before(const rb_node *a, const rb_node *b){
+	return int64_t(rb_entry(a, sched_entity, run_node)->vruntime -
+		rb_entry(b, sched_entity, run_node)->vruntime) < 0;
+}
+
+void enqueue_entity(cfs_rq *rq, sched_entity *se){
+	rb_add_cached(&se->run_node, &rq->tasks_timeline, entity_before);
+	rq->load += se->weight;
+	++rq->nr_running;
+}
+
+void dequeue_entity(cfs_rq *rq, sched_entity *se){
+	rb_erase_cached(&se->run_node, &rq->tasks_timeline);
+	RB_CLEAR_NODE(&se->run_node);
+	rq->load -= se->weight;
+	--rq->nr_running;
+}
+
+// The left most entity, O(1) through the cached node
+sched_entity *pick_next_entity(cfs_rq *rq){
+	return rb_entry_safe(rb_first_cached(&rq->tasks_timeline), sched_entity, run_node);
+}
+
+// The same without the cache, walking down the left spine
+sched_entity *pick_next_entity_uncached(cfs_rq *rq){
+	return rb_entry_safe(rb_first(&rq->tasks_timeline.rb_root), sched_entity, run_node);
+}
+
+// min_vruntime only moves forward
+void update_min_vruntime(cfs_rq *rq, const sched_entity *curr){
+	uint64_t vruntime = curr->vruntime;
+	if(sched_entity *left = pick_next_entity(rq)){
+		if(int64_t(left->vruntime - vruntime) < 0){vruntime = left->vruntime;}
+	}
+	if(int64_t(vruntime - rq->min_vruntime) > 0){rq->min_vruntime = vruntime;}
+}
+
+// The wall clock time slice of se: its weighted share of the period
+uint64_t sched_slice(const cfs_rq *rq, const sched_entity *se){
+	uint64_t period = sysctl_sched_latency;
+	if(rq->nr_running > sched_nr_latency){
+		period = rq->nr_running * sysctl_sched_min_granularity;
+	}
+	return period * se->weight / rq->load;
+}
+
+// Converts wall clock runtime to virtual runtime
+uint64_t calc_delta_fair(uint64_t delta, const sched_entity *se){
+	return delta * NICE_0_LOAD / se->weight;
+}
+
+// Latency samples of one operation, every samplerate:th call is timed
+struct Latencies{
+	vector<uint32_t> enqueue, dequeue, pick;
+};
+
+const unsigned samplerate = 64;
+
+inline uint32_t elapsed(chrono::steady_clock::time_point start){
+	return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+}
+
+// Runs the scheduling loop of one cpu until decisions have been made or
+// it has no tasks left, and counts the decisions in *made
+void runcpu(cfs_rq *rq, size_t decisions, uint64_t seed, Latencies *latencies, size_t *made){
+	using clock = chrono::steady_clock;
+	mt19937_64 rng(seed);
+	auto later = [](const sched_entity *a, const sched_entity *b){return a->wakeup > b->wakeup;};
+	priority_queue<sched_entity *, vector<sched_entity *>, decltype(later)> sleepers(later);
+	uint64_t now = 0;
+
+	// a decision is a pick, waiting for a sleeper on an idle cpu is none
+	size_t i = 0;
+	while(i < decisions){
+		bool sample = i % samplerate == 0;
+
+		// wakes up the tasks whose sleep is over, placing them slightly
+		// behind min_vruntime so that sleeping does not earn unlimited credit
+		while(!sleepers.empty() && sleepers.top()->wakeup <= now){
+			sched_entity *se = sleepers.top();
+			sleepers.pop();
+			uint64_t vruntime = rq->min_vruntime - sysctl_sched_latency / 2;
+			if(int64_t(se->vruntime - vruntime) < 0){se->vruntime = vruntime;}
+			enqueue_entity(rq, se);
+		}
+		if(!rq->nr_running){
+			if(sleepers.empty()){break;}
+			now = sleepers.top()->wakeup;
+			continue;
+		}
+
+		clock::time_point start;
+		if(sample){start = clock::now();}
+		sched_entity *se = pick_next_entity(rq);
+		if(sample){latencies->pick.push_back(elapsed(start));}
+		++i;
+
+		uint64_t slice = sched_slice(rq, se);
+		if(sample){start = clock::now();}
+		dequeue_entity(rq, se);
+		if(sample){latencies->dequeue.push_back(elapsed(start));}
+
+		// runs the task for its slice, or less if it blocks
+		bool blocks = rng() % 16 == 0;
+		uint64_t runtime = blocks ? slice / 2 + 1 : slice;
+		se->sum_exec_runtime += runtime;
+		se->vruntime += calc_delta_fair(runtime, se);
+		now += runtime;
+		update_min_vruntime(rq, se);
+
+		if(blocks){
+			se->wakeup = now + rng() % (4 * sysctl_sched_latency);
+			sleepers.push(se);
+			continue;
+		}
+		if(sample){start = clock::now();}
+		enqueue_entity(rq, se);
+		if(sample){latencies->enqueue.push_back(elapsed(start));}
+	}
+	*made = i;
+}
+
+void printlatency(const char *label, vector<uint32_t> &samples){
+	if(samples.empty()){return;}
+	sort(samples.begin(), samples.end());
+	auto percentile = [&](double p){return samples[size_t(p * (samples.size() - 1))];};
+	printf("%-12s p50 %6u ns  p99 %6u ns  p99.9 %6u ns  max %8u ns\n", label,
+		percentile(0.5), percentile(0.99), percentile(0.999), samples.back());
+}
+
+int main(int argc, char **argv){
+	size_t ntasks = argcount(argc, argv, 1, 100000);
+	size_t ncpus = argcount(argc, argv, 2, thread::hardware_concurrency());
+	size_t decisions = argcount(argc, argv, 3, 1000000);
+	// a cpu without tasks would have nothing to decide
+	ncpus = min(max<size_t>(ncpus, 1), max<size_t>(ntasks, 1));
+
+	mt19937_64 rng(1);
+	vector<sched_entity> entities(ntasks);
+	vector<cfs_rq> rqs(ncpus);
+	for(size_t i = 0; i < ntasks; ++i){
+		entities[i].weight = sched_prio_to_weight[rng() % 40];
+		enqueue_entity(&rqs[i % ncpus], &entities[i]);
+	}
+
+	cout << ntasks << " tasks on " << ncpus << " cpus, "
+		<< decisions << " scheduling decisions per cpu" << endl;
+
+	vector<Latencies> latencies(ncpus);
+	vector<size_t> made(ncpus);
+	vector<thread> cpus;
+	Stopwatch watch;
+	for(size_t cpu = 0; cpu < ncpus; ++cpu){
+		cpus.emplace_back(runcpu, &rqs[cpu], decisions, cpu + 1, &latencies[cpu], &made[cpu]);
+	}
+	for(thread &cpu : cpus){cpu.join();}
+	double seconds = watch.seconds();
+	size_t total = accumulate(made.begin(), made.end(), size_t(0));
+	report("scheduling decisions", total, seconds);
+	printf("%-40s %10.0f decisions/s\n", "throughput", total / seconds);
+
+	Latencies all;
+	for(Latencies &cpu : latencies){
+		all.enqueue.insert(all.enqueue.end(), cpu.enqueue.begin(), cpu.enqueue.end());
+		all.dequeue.insert(all.dequeue.end(), cpu.dequeue.begin(), cpu.dequeue.end());
+		all.pick.insert(all.pick.end(), cpu.pick.begin(), cpu.pick.end());
+	}
+	printlatency("enqueue", all.enqueue);
+	printlatency("dequeue", all.dequeue);
+	printlatency("pick next", all.pick);
+
+	// fairness: cpu time per unit of weight should be about the same for
+	// every task on a cpu
+	double lo = 1e300, hi = 0;
+	for(const sched_entity &se : entities){
+		double share = double(se.sum_exec_runtime) / se.weight;
+		lo = min(lo, share);
+		hi = max(hi, share);
+	}
+	printf("%-40s %10.2f\n", "max/min runtime per weight", lo > 0 ? hi / lo : 0.0);
+
+	// pick-next with and without the cached left most node
+	cfs_rq *rq = &rqs[0];
+	size_t picks = 10000000;
+	watch.restart();
+	for(size_t i = 0; i < picks; ++i){donotoptimize(pick_next_entity(rq));}
+	report("pick next, cached leftmost", picks, watch.seconds());
+	watch.restart();
+	for(size_t i = 0; i < picks; ++i){donotoptimize(pick_next_entity_uncached(rq));}
+	report("pick next, left spine walk", picks, watch.seconds());
+
+	return 0;
+}
@@ -0,0 +1,172 @@
+/*
+   Epoch based memory reclamation
+
+   Lock free readers follow pointers to nodes that a writer may unlink at
+   any moment, so an unlinked node cannot be freed right away. This plays
+   the role RCU plays in the kernel. A reader stays inside an Epoch::Guard
+   while it touches shared nodes, a writer hands unlinked nodes to
+   Epoch::retire() and they are freed once every reader has left the epoch
+   in which they were retired.
+
+   There is one global epoch counter. Every thread has a record with the
+   epoch it observed when it entered its guard. The epoch advances only
+   when every active thread has observed the current one, and an object
+   retired in epoch e is freed once the counter reaches e + 2: by then every
+   reader that could still hold a pointer to it has left its guard.
+
+   Entering and leaving a guard touches only the thread's own record, so
+   readers never write to a shared cache line.
+*/
+
+#ifndef EPOCH_H
+#define EPOCH_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class Epoch{
+public:
+	// Keeps every object reachable when the guard was entered alive until
+	// it is destroyed. Guards nest
+	class Guard{
+	public:
+		Guard(){enter();}
+		~Guard(){exit();}
+		Guard(const Guard &) = delete;
+		Guard &operator=(const Guard &) = delete;
+	};
+
+	// Frees object with deleter once no reader can reach it any more
+	static void retire(void *object, void (*deleter)(void *)){
+		Record &self = record();
+		self.retired.push_back(Retired{object, deleter, global.load(std::memory_order_seq_cst)});
+		if(self.retired.size() >= self.collectat){
+			collect();
+			// a reader that holds its guard for long keeps objects alive,
+			// so collect again only once the list has doubled, which keeps
+			// retiring O(1) amortized instead of a scan per call
+			self.collectat = std::max(collectthreshold, 2 * self.retired.size());
+		}
+	}
+
+	template<typename T>
+	static void retire(T *object){
+		retire(object, [](void *pointer){delete static_cast<T *>(pointer);});
+	}
+
+	// Advances the epoch if every reader allows it and frees what the
+	// calling thread retired and is no longer reachable. Never blocks on
+	// readers
+	static void collect(){
+		tryadvance();
+		freeexpired(record().retired);
+		std::lock_guard<std::mutex> lock(registry);
+		freeexpired(orphans);
+	}
+
+	// Waits until every reader inside a guard has left it, then frees
+	// everything the calling thread retired
+	static void synchronize(){
+		std::uint64_t target = global.load(std::memory_order_seq_cst) + 2;
+		while(global.load(std::memory_order_seq_cst) < target){
+			if(!tryadvance()){std::this_thread::yield();}
+		}
+		collect();
+	}
+
+private:
+	struct Retired{
+		void *object;
+		void (*deleter)(void *);
+		std::uint64_t epoch;
+	};
+
+	// Per thread state, linked into the registry for its lifetime
+	struct alignas(64) Record{
+		Record(){
+			std::lock_guard<std::mutex> lock(registry);
+			next = records;
+			records = this;
+		}
+
+		// leftover objects of an exiting thread are freed by the others
+		~Record(){
+			std::lock_guard<std::mutex> lock(registry);
+			for(Record **link = &records; *link; link = &(*link)->next){
+				if(*link == this){
+					*link = next;
+					break;
+				}
+			}
+			orphans.insert(orphans.end(), retired.begin(), retired.end());
+		}
+
+		// the observed epoch shifted left by one, the low bit tells
+		// whether the thread is inside a guard
+		std::atomic<std::uint64_t> state{0};
+		unsigned nesting = 0;
+		std::vector<Retired> retired;
+		std::size_t collectat = collectthreshold;
+		Record *next = nullptr;
+	};
+
+	static constexpr std::size_t collectthreshold = 256;
+
+	static Record &record(){
+		thread_local Record self;
+		return self;
+	}
+
+	static void enter(){
+		Record &self = record();
+		if(self.nesting++ == 0){
+			// seq_cst so that the announcement is visible before any
+			// shared pointer is loaded
+			self.state.store(global.load(std::memory_order_relaxed) << 1 | 1,
+				std::memory_order_seq_cst);
+		}
+	}
+
+	static void exit(){
+		Record &self = record();
+		if(--self.nesting == 0){
+			self.state.store(0, std::memory_order_release);
+		}
+	}
+
+	// Moves the epoch forward if every active thread has seen it
+	static bool tryadvance(){
+		std::uint64_t epoch = global.load(std::memory_order_seq_cst);
+		{
+			std::lock_guard<std::mutex> lock(registry);
+			for(Record *other = records; other; other = other->next){
+				std::uint64_t state = other->state.load(std::memory_order_seq_cst);
+				if((state & 1) && (state >> 1) != epoch){
+					return false;
+				}
+			}
+		}
+		return global.compare_exchange_strong(epoch, epoch + 1, std::memory_order_seq_cst);
+	}
+
+	static void freeexpired(std::vector<Retired> &retired){
+		std::uint64_t epoch = global.load(std::memory_order_seq_cst);
+		std::size_t kept = 0;
+		for(Retired &object : retired){
+			if(object.epoch + 2 <= epoch){object.deleter(object.object);}
+			else{retired[kept++] = object;}
+		}
+		retired.resize(kept);
+	}
+
+	static inline std::atomic<std::uint64_t> global{1};
+	static inline std::mutex registry;
+	static inline Record *records = nullptr;
+	static inline std::vector<Retired> orphans;
+};
+
+#endif
@@ -0,0 +1,105 @@
+/*
+   Concurrent ordered map benchmark
+
+   Runs the concurrent ordered maps of this directory on exactly the same
+   streams of operations, so the backend for a workload can be picked from
+   measurements:
+
+       mutex      RbTree behind one mutex
+       sharded    ShardedRbTree, range shards with a lock each
+       latched    LatchedRbTree, lock free readers, one writer at a time
+       skiplist   LockFreeSkipList, lock free readers and writers
+
+   Every thread draws its keys from a uniform or a Zipf (theta 0.99)
+   distribution with a fixed seed, and the given percentage of the
+   operations are writes, half inserts and half erases, the rest lookups.
+   The map starts with every second key of the range. Reported are the
+   throughput and the latency percentiles of every 64th operation.
+
+   arguments: key range, maximum threads, operations per thread, write percentage
+
+   g++ -O2 -std=c++17 -pthread "ordered map bench.cpp" && ./a.out 1000000 64 1000000 50
+*/
+
+#include <iostream>
+#include <thread>
+
+#include "benchmark.h"
+#include "rb latched.h"
+#include "rb sharded.h"
+#include "red black tree.h"
+#include "skip list.h"
+
+using namespace std;
+
+struct Workload{
+	const char *distribution;
+	size_t range, ops;
+	unsigned writes; // percent
+	Zipf *zipf;       // null for uniform keys
+};
+
+const unsigned samplerate = 64;
+
+template<typename Map>
+void run(const char *name, const Workload &load, unsigned threads){
+	Map map;
+	for(uint64_t key = 0; key < load.range; key += 2){map.insert(key, key);}
+
+	vector<vector<uint32_t>> latencies(threads);
+	vector<thread> workers;
+	Stopwatch watch;
+	for(unsigned i = 0; i < threads; ++i){
+		workers.emplace_back([&, i]{
+			using clock = chrono::steady_clock;
+			mt19937_64 rng(i + 1);
+			vector<uint32_t> &samples = latencies[i];
+			uint64_t value, found = 0;
+			for(size_t j = 0; j < load.ops; ++j){
+				uint64_t key = load.zipf ? scramble((*load.zipf)(rng), load.range) : rng() % load.range;
+				unsigned op = rng() % 200;
+				bool sample = j % samplerate == 0;
+				clock::time_point start;
+				if(sample){start = clock::now();}
+				if(op < load.writes){map.insert(key, key);}
+				else if(op < 2 * load.writes){map.erase(key);}
+				else{found += map.find(key, value);}
+				if(sample){
+					samples.push_back(chrono::duration_cast<chrono::nanoseconds>(clock::now() - start).count());
+				}
+			}
+			donotoptimize(found);
+		});
+	}
+	for(thread &worker : workers){worker.join();}
+	double seconds = watch.seconds();
+
+	vector<uint32_t> all;
+	for(vector<uint32_t> &samples : latencies){all.insert(all.end(), samples.begin(), samples.end());}
+	sort(all.begin(), all.end());
+	auto percentile = [&](double p){return all[size_t(p * (all.size() - 1))];};
+	printf("%-8s %-9s %3u threads %11.0f ops/s  p50 %6u ns  p99 %7u ns  p99.9 %8u ns\n",
+		load.distribution, name, threads, threads * load.ops / seconds,
+		percentile(0.5), percentile(0.99), percentile(0.999));
+}
+
+int main(int argc, char **argv){
+	size_t range = argcount(argc, argv, 1, 1000000);
+	unsigned maxthreads = argcount(argc, argv, 2, 64);
+	size_t ops = argcount(argc, argv, 3, 1000000);
+	unsigned writes = argcount(argc, argv, 4, 50);
+	if(writes > 100){writes = 100;}
+
+	Zipf zipf(range);
+	for(Workload load : {Workload{"uniform", range, ops, writes, nullptr},
+		Workload{"zipf", range, ops, writes, &zipf}}){
+		for(unsigned threads = 1; threads <= maxthreads; threads *= 2){
+			run<MutexTree>("mutex", load, threads);
+			run<ShardedRbTree<uint64_t, uint64_t>>("sharded", load, threads);
+			run<LatchedRbTree<uint64_t, uint64_t>>("latched", load, threads);
+			run<LockFreeSkipList<uint64_t, uint64_t>>("skiplist", load, threads);
+		}
+	}
+
+	return 0;
+}
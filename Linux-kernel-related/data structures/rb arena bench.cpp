@@ -0,0 +1,72 @@
+/*
+   Slab allocator benchmark
+
+   Compares RbTree on std::allocator (one new per insert, one delete per
+   remove, like insertrbnode() and removerbnode()) with RbTree on RbArena.
+   Each run builds a tree of n random keys, then churns it with n remove +
+   insert pairs and finally tears the whole tree down.
+
+   g++ -O2 -std=c++17 "rb arena bench.cpp" && ./a.out 1000000 10000000 100000000
+*/
+
+#include <iostream>
+
+#include "benchmark.h"
+#include "rb arena.h"
+#include "red black tree.h"
+
+using namespace std;
+
+template<typename Tree>
+void run(const char *name, const vector<uint64_t> &keys){
+	char label[64];
+	size_t n = keys.size();
+	Stopwatch watch;
+	{
+		Tree tree;
+		for(uint64_t key : keys){tree.emplace(key, key);}
+		snprintf(label, sizeof(label), "%s insert", name);
+		report(label, n, watch.seconds());
+
+		// replaces every key by a new one, so each freed node is recycled
+		// in a different place of the tree
+		watch.restart();
+		for(uint64_t key : keys){
+			tree.erase(key);
+			tree.emplace(key + n, key);
+		}
+		snprintf(label, sizeof(label), "%s remove + insert churn", name);
+		report(label, 2 * n, watch.seconds());
+
+		watch.restart();
+		uint64_t sum = 0;
+		for(uint64_t key : keys){
+			auto it = tree.find(key + n);
+			if(it != tree.end()){sum += it->value;}
+		}
+		donotoptimize(sum);
+		snprintf(label, sizeof(label), "%s find after churn", name);
+		report(label, n, watch.seconds());
+
+		watch.restart();
+		tree.clear();
+		snprintf(label, sizeof(label), "%s teardown", name);
+		report(label, n, watch.seconds());
+	}
+}
+
+int main(int argc, char **argv){
+	using NewDelete = RbTree<uint64_t, uint64_t>;
+	using Arena = RbTree<uint64_t, uint64_t, less<uint64_t>, RbArena<uint64_t>>;
+
+	int runs = argc > 1 ? argc - 1 : 1;
+	for(int i = 0; i < runs; ++i){
+		size_t n = argcount(argc, argv, i + 1, 1000000);
+		vector<uint64_t> keys = randomkeys(n);
+		cout << "n = " << n << endl;
+		run<NewDelete>("new/delete", keys);
+		run<Arena>("arena", keys);
+	}
+
+	return 0;
+}
@@ -0,0 +1,185 @@
+/*
+   Slab allocator for red black tree nodes
+
+   Every insert of the plain red black tree does a new and every remove
+   a delete, so under insert/remove churn the general purpose allocator
+   dominates the profile and the nodes end up scattered all over the heap.
+   RbSlab hands out fixed size objects from large contiguous chunks: new
+   nodes are bump allocated from the current chunk, so nodes inserted close
+   in time sit close in memory, and removed nodes go onto a free list from
+   which the next insert takes them back. release() returns every chunk in
+   one go, which is how the whole tree is torn down without visiting its
+   nodes.
+
+   RbArena<T> is the standard allocator interface on top of a slab, so it
+   plugs straight into RbTree:
+
+       RbTree<uint64_t, int, std::less<uint64_t>, RbArena<uint64_t>> tree;
+
+   An RbArena creates its slab on the first allocation and copies made after
+   that share it (the tree rebinds the allocator to its node type), so a
+   tree owns its arena. Moving a tree moves the arena along and leaves the
+   source with none. Do not hand copies of one tree's allocator to another
+   tree, since clearing one tree then releases the nodes of the other.
+*/
+
+#ifndef RB_ARENA_H
+#define RB_ARENA_H
+
+#include <cassert>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+
+// Fixed size object pool made of contiguous chunks and a free list
+class RbSlab{
+public:
+	explicit RbSlab(std::size_t firstchunk = 64, std::size_t maxchunk = 65536):
+	chunknodes(firstchunk), maxchunknodes(maxchunk){}
+
+	RbSlab(const RbSlab &) = delete;
+	RbSlab &operator=(const RbSlab &) = delete;
+
+	~RbSlab(){release();}
+
+	// Checks whether the slab serves objects of this size. The first
+	// request fixes the object size of the slab
+	bool serves(std::size_t size, std::size_t align){
+		assert(align <= alignof(std::max_align_t));
+		std::size_t rounded = roundup(size < sizeof(FreeNode) ? sizeof(FreeNode) : size, align);
+		if(!objsize){objsize = rounded;}
+		return rounded == objsize;
+	}
+
+	void *allocate(){
+		if(freelist){
+			FreeNode *object = freelist;
+			freelist = object->next;
+			return object;
+		}
+		if(current == end){grow();}
+		void *object = current;
+		current += objsize;
+		return object;
+	}
+
+	// Makes sure the next n allocations come from one contiguous block,
+	// unless recycled objects are waiting in the free list
+	void reserve(std::size_t n){
+		if(freelist || std::size_t(end - current) >= n * objsize){
+			return;
+		}
+		std::size_t nodes = chunknodes;
+		chunknodes = n > chunknodes ? n : chunknodes;
+		grow();
+		chunknodes = nodes;
+	}
+
+	void deallocate(void *object){
+		FreeNode *node = static_cast<FreeNode *>(object);
+		node->next = freelist;
+		freelist = node;
+	}
+
+	// Returns every chunk to the system at once. All objects handed out
+	// by the slab become invalid
+	void release(){
+		while(chunks){
+			Chunk *next = chunks->next;
+			::operator delete(chunks);
+			chunks = next;
+		}
+		freelist = nullptr;
+		current = end = nullptr;
+		chunkcount = 0;
+	}
+
+	std::size_t objectsize() const{return objsize;}
+	std::size_t chunksallocated() const{return chunkcount;}
+
+private:
+	struct FreeNode{FreeNode *next;};
+	struct alignas(std::max_align_t) Chunk{Chunk *next;};
+
+	static std::size_t roundup(std::size_t size, std::size_t align){
+		return (size + align - 1) / align * align;
+	}
+
+	// Allocates the next chunk, doubling the chunk size up to the limit
+	void grow(){
+		std::size_t bytes = sizeof(Chunk) + chunknodes * objsize;
+		Chunk *chunk = static_cast<Chunk *>(::operator new(bytes));
+		chunk->next = chunks;
+		chunks = chunk;
+		++chunkcount;
+		current = reinterpret_cast<char *>(chunk + 1);
+		end = current + chunknodes * objsize;
+		if(chunknodes < maxchunknodes){chunknodes *= 2;}
+	}
+
+	std::size_t objsize = 0;
+	std::size_t chunknodes, maxchunknodes;
+	std::size_t chunkcount = 0;
+	Chunk *chunks = nullptr;
+	FreeNode *freelist = nullptr;
+	char *current = nullptr, *end = nullptr;
+};
+
+// Standard allocator interface for the slab. Single objects of the slab's
+// object size come from the slab, anything else from std::allocator
+template<typename T>
+class RbArena{
+public:
+	using value_type = T;
+	using propagate_on_container_move_assignment = std::true_type;
+	using propagate_on_container_swap = std::true_type;
+
+	RbArena() = default;
+
+	template<typename U>
+	RbArena(const RbArena<U> &other) noexcept: slab(other.slab){}
+
+	T *allocate(std::size_t n){
+		if(!slab){slab = std::make_shared<RbSlab>();}
+		if(n == 1 && slab->serves(sizeof(T), alignof(T))){
+			return static_cast<T *>(slab->allocate());
+		}
+		return std::allocator<T>().allocate(n);
+	}
+
+	void deallocate(T *object, std::size_t n){
+		if(n == 1 && slab->serves(sizeof(T), alignof(T))){
+			slab->deallocate(object);
+		}
+		else{
+			std::allocator<T>().deallocate(object, n);
+		}
+	}
+
+	// Sets aside one contiguous block for the next n objects
+	void reserve(std::size_t n){
+		if(!slab){slab = std::make_shared<RbSlab>();}
+		if(slab->serves(sizeof(T), alignof(T))){slab->reserve(n);}
+	}
+
+	// Releases every object of the arena in one step
+	void release(){
+		if(slab){slab->release();}
+	}
+
+	// The slab behind the allocator, nullptr before the first allocation
+	const RbSlab *arena() const{return slab.get();}
+
+	template<typename U>
+	bool operator==(const RbArena<U> &other) const{return slab == other.slab;}
+	template<typename U>
+	bool operator!=(const RbArena<U> &other) const{return slab != other.slab;}
+
+private:
+	template<typename U> friend class RbArena;
+
+	std::shared_ptr<RbSlab> slab;
+};
+
+#endif
@@ -0,0 +1,145 @@
+/*
+   Augmented tree benchmark
+
+   What the subtree summaries cost and what they buy. Inserting and
+   erasing n keys in the plain intrusive tree and in the order statistics
+   tree, then select(k) and rank(key) against an in-order walk to the
+   position. Then n time windows in the interval tree, with overlap
+   queries for short windows against a scan over all the windows.
+
+   arguments: keys (intervals), queries
+
+   g++ -O2 -std=c++17 "rb augmented bench.cpp" && ./a.out 1000000 100000
+*/
+
+#include <iostream>
+
+#include "benchmark.h"
+#include "rb interval tree.h"
+#include "rb order statistics.h"
+
+using namespace std;
+
+struct Sample{
+	uint64_t key;
+	rb_node rb;
+	rb_os_node os;
+};
+
+struct Window{
+	interval_tree_node<uint64_t> it;
+	uint64_t id;
+};
+
+void orderstatistics(size_t n, size_t queries){
+	vector<uint64_t> keys = randomkeys(n);
+	vector<Sample> samples(n);
+	for(size_t i = 0; i < n; ++i){samples[i].key = keys[i];}
+	auto plainless = [](const rb_node *a, const rb_node *b){
+		return rb_entry(a, Sample, rb)->key < rb_entry(b, Sample, rb)->key;
+	};
+	auto osless = [](const rb_node *a, const rb_node *b){
+		return rb_entry(a, Sample, os.rb)->key < rb_entry(b, Sample, os.rb)->key;
+	};
+	auto oscmp = [](uint64_t key, const rb_node *rb){
+		uint64_t other = rb_entry(rb, Sample, os.rb)->key;
+		return key < other ? -1 : key > other ? 1 : 0;
+	};
+
+	rb_root plain, os;
+	Stopwatch watch;
+	for(Sample &sample : samples){rb_add(&sample.rb, &plain, plainless);}
+	report("insert, plain", n, watch.seconds());
+	watch.restart();
+	for(Sample &sample : samples){rb_os_add(&sample.os, &os, osless);}
+	report("insert, order statistics", n, watch.seconds());
+
+	mt19937_64 rng(1);
+	uint64_t sum = 0;
+	watch.restart();
+	for(size_t i = 0; i < queries; ++i){
+		sum += rb_entry(rb_os_select(&os, rng() % n), Sample, os)->key;
+	}
+	donotoptimize(sum);
+	report("select(k)", queries, watch.seconds());
+
+	watch.restart();
+	for(size_t i = 0; i < queries; ++i){sum += rb_os_rank(rng() % n, &os, oscmp);}
+	donotoptimize(sum);
+	report("rank(key)", queries, watch.seconds());
+
+	// the walk is O(n) per query, so only a few of them
+	size_t walks = queries / 1000 + 1;
+	watch.restart();
+	for(size_t i = 0; i < walks; ++i){
+		size_t k = rng() % n;
+		rb_node *rb = rb_first(&plain);
+		while(k--){rb = rb_next(rb);}
+		sum += rb_entry(rb, Sample, rb)->key;
+	}
+	donotoptimize(sum);
+	report("select(k) by in-order walk", walks, watch.seconds());
+
+	watch.restart();
+	for(Sample &sample : samples){rb_erase(&sample.rb, &plain);}
+	report("erase, plain", n, watch.seconds());
+	watch.restart();
+	for(Sample &sample : samples){rb_os_erase(&sample.os, &os);}
+	report("erase, order statistics", n, watch.seconds());
+}
+
+void intervals(size_t n, size_t queries){
+	// windows over a timeline of 1000 units per window, mostly short with
+	// a few long ones
+	uint64_t timeline = n * 1000;
+	mt19937_64 rng(2);
+	vector<Window> windows(n);
+	for(size_t i = 0; i < n; ++i){
+		windows[i].it.start = rng() % timeline;
+		windows[i].it.last = windows[i].it.start + (rng() % 100 ? rng() % 2000 : rng() % 200000);
+		windows[i].id = i;
+	}
+
+	rb_root_cached tree;
+	Stopwatch watch;
+	for(Window &window : windows){interval_tree_insert(&window.it, &tree);}
+	report("interval tree insert", n, watch.seconds());
+
+	uint64_t found = 0;
+	watch.restart();
+	for(size_t i = 0; i < queries; ++i){
+		uint64_t start = rng() % timeline, last = start + 5000;
+		for(auto *it = interval_tree_iter_first(&tree, start, last); it;
+			it = interval_tree_iter_next(it, start, last)){
+			found += rb_entry(it, Window, it)->id;
+		}
+	}
+	donotoptimize(found);
+	report("overlap query", queries, watch.seconds());
+
+	size_t scans = queries / 1000 + 1;
+	watch.restart();
+	for(size_t i = 0; i < scans; ++i){
+		uint64_t start = rng() % timeline, last = start + 5000;
+		for(const Window &window : windows){
+			if(window.it.start <= last && start <= window.it.last){found += window.id;}
+		}
+	}
+	donotoptimize(found);
+	report("overlap query by scan", scans, watch.seconds());
+
+	watch.restart();
+	for(Window &window : windows){interval_tree_remove(&window.it, &tree);}
+	report("interval tree remove", n, watch.seconds());
+}
+
+int main(int argc, char **argv){
+	size_t n = argcount(argc, argv, 1, 1000000);
+	size_t queries = argcount(argc, argv, 2, 100000);
+	if(!n){n = 1;}
+
+	orderstatistics(n, queries);
+	intervals(n, queries);
+
+	return 0;
+}
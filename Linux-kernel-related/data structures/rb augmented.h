@@ -0,0 +1,112 @@
+/*
+   Augmented red black tree
+
+   An augmented tree keeps a value in every node that summarizes its whole
+   subtree: the number of nodes below it, or the largest interval end
+   below it. With that, questions about ranks or overlapping intervals are
+   answered on one path from the root instead of with a walk over every
+   node. This is include/linux/rbtree_augmented.h on top of the intrusive
+   tree of rb intrusive.h.
+
+   The summary of a node only depends on the node and its two children,
+   so it goes stale exactly where the shape of the tree changes, and the
+   tree tells the user about those places through three callbacks, given
+   as the static functions of a struct:
+
+       propagate(node, stop)   recompute from node up to (not including)
+                               stop, stopping early where nothing changed
+       copy(old, new_node)     new_node takes old's place in the tree
+       rotate(old, new_node)   a rotation made new_node the parent of old
+
+   rb_insert_color() and rb_erase_color() call rotate() after each of
+   their rotations and the unlink of rb_erase_augmented() calls copy() and
+   propagate(). RB_DECLARE_CALLBACKS() writes the struct from a function
+   that recomputes one node, RB_DECLARE_CALLBACKS_MAX() for the common
+   case where the summary is the maximum of a per-node value.
+
+   Inserting is left to the caller, as in the kernel: the descent updates
+   the summaries of the nodes it passes for the new node, the new node
+   gets its own, and rb_insert_augmented() rebalances.
+
+   rb order statistics.h and rb interval tree.h build on this.
+*/
+
+#ifndef RB_AUGMENTED_H
+#define RB_AUGMENTED_H
+
+#include "rb intrusive.h"
+
+// Declares the callback struct name for rbstruct, whose rb_node member
+// is rbfield and whose summary member is rbaugmented. rbcompute(node,
+// exit) recomputes the summary of node and returns true if exit is set
+// and it did not change
+#define RB_DECLARE_CALLBACKS(name, rbstruct, rbfield, rbaugmented, rbcompute) \
+struct name{ \
+	static void propagate(rb_node *rb, rb_node *stop){ \
+		while(rb != stop){ \
+			rbstruct *node = rb_entry(rb, rbstruct, rbfield); \
+			if(rbcompute(node, true)){break;} \
+			rb = rb_parent(&node->rbfield); \
+		} \
+	} \
+	static void copy(rb_node *rb_old, rb_node *rb_new){ \
+		rb_entry(rb_new, rbstruct, rbfield)->rbaugmented = \
+			rb_entry(rb_old, rbstruct, rbfield)->rbaugmented; \
+	} \
+	static void rotate(rb_node *rb_old, rb_node *rb_new){ \
+		rbstruct *old = rb_entry(rb_old, rbstruct, rbfield); \
+		rb_entry(rb_new, rbstruct, rbfield)->rbaugmented = old->rbaugmented; \
+		rbcompute(old, false); \
+	} \
+};
+
+// Declares the callbacks for a summary of type rbtype that is the
+// maximum of rbcompute(node) over the subtree. The struct also gets
+// compute_max(node, exit), the recompute function of one node
+#define RB_DECLARE_CALLBACKS_MAX(name, rbstruct, rbfield, rbtype, rbaugmented, rbcompute) \
+struct name##_compute{ \
+	static bool compute_max(rbstruct *node, bool exit){ \
+		rbtype max = rbcompute(node); \
+		if(node->rbfield.rb_left){ \
+			rbstruct *child = rb_entry(node->rbfield.rb_left, rbstruct, rbfield); \
+			if(child->rbaugmented > max){max = child->rbaugmented;} \
+		} \
+		if(node->rbfield.rb_right){ \
+			rbstruct *child = rb_entry(node->rbfield.rb_right, rbstruct, rbfield); \
+			if(child->rbaugmented > max){max = child->rbaugmented;} \
+		} \
+		if(exit && node->rbaugmented == max){return true;} \
+		node->rbaugmented = max; \
+		return false; \
+	} \
+}; \
+RB_DECLARE_CALLBACKS(name, rbstruct, rbfield, rbaugmented, name##_compute::compute_max)
+
+// Rebalances after the caller linked node and updated the summaries on
+// its path
+template<typename Augment>
+inline void rb_insert_augmented(rb_node *node, rb_root *root){
+	rb_insert_color<Augment>(node, root);
+}
+
+template<typename Augment>
+inline void rb_insert_augmented_cached(rb_node *node, rb_root_cached *root, bool leftmost){
+	if(leftmost){root->rb_leftmost = node;}
+	rb_insert_augmented<Augment>(node, &root->rb_root);
+}
+
+// Removes node and brings the summaries up to date
+template<typename Augment>
+inline void rb_erase_augmented(rb_node *node, rb_root *root){
+	if(rb_node *rebalance = rb_erase_unlink<Augment>(node, root)){
+		rb_erase_color<Augment>(rebalance, root);
+	}
+}
+
+template<typename Augment>
+inline void rb_erase_augmented_cached(rb_node *node, rb_root_cached *root){
+	if(root->rb_leftmost == node){root->rb_leftmost = rb_next(node);}
+	rb_erase_augmented<Augment>(node, &root->rb_root);
+}
+
+#endif
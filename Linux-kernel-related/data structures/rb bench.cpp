@@ -0,0 +1,169 @@
+/*
+   Red black tree benchmark suite
+
+   Insert, find, scan and erase on an RbTree against std::map, and on an
+   RbTree without values against std::set, for the key streams that make
+   ordered containers behave differently:
+
+       uniform     n distinct keys in random order
+       sorted      0, 1, 2, ..., the worst case for rebalancing on one side
+       reverse     the same descending
+       zipf        n draws from a Zipf distribution over n keys, so a few
+                   keys repeat very often and the tree stays smaller
+       sawtooth    ascending runs of 1024 keys, each run a little above
+                   the last one's start, as with several interleaved
+                   sequential writers
+
+   Every phase uses the stream in its own order: finds and erases look up
+   the keys in the order they were inserted, and scans visit a window of
+   100 keys from every 100th key of the stream. Inserts keep the keys
+   unique in both containers (try_emplace() against insert()).
+
+   Compiled with -DRB_TREE_STATS it ends with the statistics of rb stats.h
+   for all the RbTree runs together.
+
+   arguments: keys
+
+   g++ -O2 -std=c++17 "rb bench.cpp" && ./a.out 1000000
+*/
+
+#include <iostream>
+#include <map>
+#include <set>
+#include <string>
+
+#include "benchmark.h"
+#include "red black tree.h"
+
+using namespace std;
+
+struct Empty{};
+
+// The four containers behind one interface
+struct RbMap{
+	static constexpr const char *name = "RbTree";
+	bool insert(uint64_t key){return tree.try_emplace(key, key).second;}
+	bool find(uint64_t key) const{return tree.find(key) != tree.end();}
+	uint64_t scan(uint64_t lo, uint64_t hi) const{
+		uint64_t sum = 0;
+		tree.scan(lo, hi, [&sum](const RbTree<uint64_t, uint64_t>::Node &rbnode){sum += rbnode.value;});
+		return sum;
+	}
+	bool erase(uint64_t key){return tree.erase(key);}
+
+	RbTree<uint64_t, uint64_t> tree;
+};
+
+struct StdMap{
+	static constexpr const char *name = "std::map";
+	bool insert(uint64_t key){return tree.emplace(key, key).second;}
+	bool find(uint64_t key) const{return tree.find(key) != tree.end();}
+	uint64_t scan(uint64_t lo, uint64_t hi) const{
+		uint64_t sum = 0;
+		for(auto it = tree.lower_bound(lo); it != tree.end() && it->first < hi; ++it){sum += it->second;}
+		return sum;
+	}
+	bool erase(uint64_t key){return tree.erase(key);}
+
+	map<uint64_t, uint64_t> tree;
+};
+
+struct RbSet{
+	static constexpr const char *name = "RbTree, keys only";
+	bool insert(uint64_t key){return tree.try_emplace(key).second;}
+	bool find(uint64_t key) const{return tree.find(key) != tree.end();}
+	uint64_t scan(uint64_t lo, uint64_t hi) const{
+		uint64_t sum = 0;
+		tree.scan(lo, hi, [&sum](const RbTree<uint64_t, Empty>::Node &rbnode){sum += rbnode.key;});
+		return sum;
+	}
+	bool erase(uint64_t key){return tree.erase(key);}
+
+	RbTree<uint64_t, Empty> tree;
+};
+
+struct StdSet{
+	static constexpr const char *name = "std::set";
+	bool insert(uint64_t key){return tree.insert(key).second;}
+	bool find(uint64_t key) const{return tree.find(key) != tree.end();}
+	uint64_t scan(uint64_t lo, uint64_t hi) const{
+		uint64_t sum = 0;
+		for(auto it = tree.lower_bound(lo); it != tree.end() && *it < hi; ++it){sum += *it;}
+		return sum;
+	}
+	bool erase(uint64_t key){return tree.erase(key);}
+
+	set<uint64_t> tree;
+};
+
+struct Stream{
+	const char *name;
+	vector<uint64_t> keys;
+};
+
+vector<Stream> makestreams(size_t n){
+	vector<Stream> streams;
+	streams.push_back({"uniform", randomkeys(n)});
+
+	vector<uint64_t> keys(n);
+	iota(keys.begin(), keys.end(), uint64_t(0));
+	streams.push_back({"sorted", keys});
+	reverse(keys.begin(), keys.end());
+	streams.push_back({"reverse", keys});
+
+	Zipf zipf(n);
+	mt19937_64 rng(1);
+	for(uint64_t &key : keys){key = scramble(zipf(rng), n);}
+	streams.push_back({"zipf", keys});
+
+	const size_t run = 1024;
+	size_t runs = (n + run - 1) / run;
+	for(size_t i = 0; i < n; ++i){keys[i] = (i % run) * runs + i / run;}
+	streams.push_back({"sawtooth", keys});
+	return streams;
+}
+
+template<typename Container>
+void run(const Stream &stream){
+	const vector<uint64_t> &keys = stream.keys;
+	string prefix = string(stream.name) + ", " + Container::name + ", ";
+	Container container;
+	size_t hits = 0;
+
+	Stopwatch watch;
+	for(uint64_t key : keys){hits += container.insert(key);}
+	report((prefix + "insert").c_str(), keys.size(), watch.seconds());
+
+	watch.restart();
+	for(uint64_t key : keys){hits += container.find(key);}
+	report((prefix + "find").c_str(), keys.size(), watch.seconds());
+
+	uint64_t sum = 0;
+	size_t windows = 0;
+	watch.restart();
+	for(size_t i = 0; i < keys.size(); i += 100, ++windows){sum += container.scan(keys[i], keys[i] + 100);}
+	report((prefix + "scan 100 keys").c_str(), windows, watch.seconds());
+
+	watch.restart();
+	for(uint64_t key : keys){hits += container.erase(key);}
+	report((prefix + "erase").c_str(), keys.size(), watch.seconds());
+	donotoptimize(hits);
+	donotoptimize(sum);
+}
+
+int main(int argc, char **argv){
+	size_t n = argcount(argc, argv, 1, 1000000);
+	if(!n){n = 1;}
+
+	for(const Stream &stream : makestreams(n)){
+		run<RbMap>(stream);
+		run<StdMap>(stream);
+		run<RbSet>(stream);
+		run<StdSet>(stream);
+		cout << endl;
+	}
+#ifdef RB_TREE_STATS
+	RbStats::write(cout, RbStats::snapshot());
+#endif
+	return 0;
+}
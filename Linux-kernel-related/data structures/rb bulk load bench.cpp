@@ -0,0 +1,72 @@
+/*
+   Bulk load benchmark
+
+   Startup time of building a tree from a sorted snapshot: n emplace()
+   calls (what repeated insertrbnode() calls do) against assign_sorted(),
+   with new/delete nodes and with all nodes in one arena block.
+
+   g++ -O2 -std=c++17 "rb bulk load bench.cpp" && ./a.out 10000000
+*/
+
+#include <iostream>
+
+#include "benchmark.h"
+#include "rb arena.h"
+#include "red black tree.h"
+
+using namespace std;
+
+using Tree = RbTree<uint64_t, uint64_t>;
+using ArenaTree = RbTree<uint64_t, uint64_t, less<uint64_t>, RbArena<uint64_t>>;
+
+template<typename T>
+uint64_t scan(const T &tree){
+	uint64_t sum = 0;
+	for(const auto &rbnode : tree){sum += rbnode.value;}
+	return sum;
+}
+
+void run(size_t n){
+	vector<pair<uint64_t, uint64_t>> snapshot(n);
+	for(size_t i = 0; i < n; ++i){snapshot[i] = {2 * i, i};}
+	cout << "n = " << n << endl;
+
+	Stopwatch watch;
+	{
+		Tree tree;
+		for(const auto &entry : snapshot){tree.emplace(entry.first, entry.second);}
+		report("repeated insert", n, watch.seconds());
+		watch.restart();
+		donotoptimize(scan(tree));
+		report("  scan", n, watch.seconds());
+	}
+
+	watch.restart();
+	{
+		Tree tree;
+		tree.assign_sorted(snapshot.begin(), snapshot.end());
+		report("assign_sorted, new/delete", n, watch.seconds());
+		watch.restart();
+		donotoptimize(scan(tree));
+		report("  scan", n, watch.seconds());
+	}
+
+	watch.restart();
+	{
+		ArenaTree tree;
+		tree.assign_sorted(snapshot.begin(), snapshot.end());
+		report("assign_sorted, one arena block", n, watch.seconds());
+		watch.restart();
+		donotoptimize(scan(tree));
+		report("  scan", n, watch.seconds());
+	}
+}
+
+int main(int argc, char **argv){
+	int runs = argc > 1 ? argc - 1 : 1;
+	for(int i = 0; i < runs; ++i){
+		run(argcount(argc, argv, i + 1, 10000000));
+	}
+
+	return 0;
+}
@@ -0,0 +1,86 @@
+/*
+   Compaction benchmark
+
+   Ages a tree on RbArena the way a long running index ages: n random
+   inserts, then n rounds of erasing a key and inserting a new one, so
+   every insert recycles a node that an erase freed somewhere else and
+   neighbours in the tree end up far apart in memory. Then it measures n
+   random finds, in-order scans over the whole tree and scans of 100 keys
+   from random places, compacts the tree into preorder and measures
+   again, and does the same once more for van Emde Boas order.
+
+   Preorder helps the scans most, since a subtree's nodes lie together;
+   van Emde Boas order helps the finds most, since every descent stays
+   within a few blocks. Both help once the tree is larger than the caches.
+
+   arguments: keys
+
+   g++ -O2 -std=c++17 "rb compact bench.cpp" && ./a.out 1000000
+*/
+
+#include <algorithm>
+#include <iostream>
+#include <string>
+
+#include "benchmark.h"
+#include "rb arena.h"
+#include "red black tree.h"
+
+using namespace std;
+
+typedef RbTree<uint64_t, uint64_t, less<uint64_t>, RbArena<uint64_t>> Tree;
+
+void measure(const Tree &tree, const vector<uint64_t> &probes, const string &name){
+	uint64_t sum = 0;
+	Stopwatch watch;
+	for(uint64_t key : probes){
+		auto it = tree.find(key);
+		if(it != tree.end()){sum += it->value;}
+	}
+	report((name + ", find").c_str(), probes.size(), watch.seconds());
+
+	const int passes = 5;
+	watch.restart();
+	for(int pass = 0; pass < passes; ++pass){
+		for(const auto &rbnode : tree){sum += rbnode.value;}
+	}
+	report((name + ", full scan per node").c_str(), passes * tree.size(), watch.seconds());
+
+	size_t windows = probes.size() / 100;
+	watch.restart();
+	for(size_t i = 0; i < windows; ++i){
+		tree.scan(probes[i], probes[i] + 100, [&sum](const Tree::Node &rbnode){sum += rbnode.value;});
+	}
+	report((name + ", scan 100 keys").c_str(), windows, watch.seconds());
+	donotoptimize(sum);
+}
+
+int main(int argc, char **argv){
+	size_t n = argcount(argc, argv, 1, 1000000);
+	if(!n){n = 1;}
+	vector<uint64_t> keys = randomkeys(2 * n);
+
+	Tree tree;
+	for(size_t i = 0; i < n; ++i){tree.emplace(keys[i], keys[i]);}
+	// every erase frees a node that the next insert takes back from the
+	// free list for a key somewhere else in the tree
+	for(size_t i = 0; i < n; ++i){
+		tree.erase(keys[i]);
+		tree.emplace(keys[n + i], keys[n + i]);
+	}
+	vector<uint64_t> probes(keys.begin() + n, keys.end());
+	shuffle(probes.begin(), probes.end(), mt19937_64(2));
+
+	measure(tree, probes, "aged");
+
+	Stopwatch watch;
+	tree.compact(Tree::preorder);
+	report("compact to preorder", n, watch.seconds());
+	measure(tree, probes, "preorder");
+
+	watch.restart();
+	tree.compact(Tree::vanemdeboas);
+	report("compact to van Emde Boas order", n, watch.seconds());
+	measure(tree, probes, "van Emde Boas");
+	return 0;
+}
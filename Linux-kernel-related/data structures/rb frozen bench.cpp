@@ -0,0 +1,68 @@
+/*
+   Frozen tree lookup benchmark
+
+   Random successful lookups in an RbTree against the same keys frozen
+   into the flat 16-key B+ tree layout of FrozenRbTree, one lookup at a
+   time and in prefetching batches. Build with -march=native (or -mavx2)
+   for the vector node search. Every argument is a tree size, 10^4 to 10^8
+   covers everything from L2 resident to far beyond the last level cache.
+
+   g++ -O2 -march=native -std=c++17 "rb frozen bench.cpp" && ./a.out 10000 100000 1000000 10000000 100000000
+*/
+
+#include <iostream>
+
+#include "benchmark.h"
+#include "rb frozen.h"
+
+using namespace std;
+
+using Tree = RbTree<uint64_t, uint64_t>;
+
+void run(size_t n, size_t lookups){
+	Tree tree;
+	vector<uint64_t> keys = randomkeys(n);
+	for(uint64_t &key : keys){key = key * 0x9e3779b97f4a7c15ull;}
+	for(uint64_t key : keys){tree.emplace(key, key);}
+
+	// random keys that are all in the tree
+	mt19937_64 rng(n);
+	vector<uint64_t> probes(lookups);
+	for(uint64_t &probe : probes){probe = keys[rng() % n];}
+	cout << "n = " << n << endl;
+
+	Stopwatch watch;
+	FrozenRbTree<uint64_t, uint64_t> frozen = freeze(tree);
+	report("freeze", n, watch.seconds());
+
+	watch.restart();
+	uint64_t sum = 0;
+	for(uint64_t probe : probes){sum += tree.find(probe)->value;}
+	donotoptimize(sum);
+	report("pointer tree find", lookups, watch.seconds());
+
+	watch.restart();
+	sum = 0;
+	for(uint64_t probe : probes){sum += *frozen.find(probe);}
+	donotoptimize(sum);
+	report("frozen find", lookups, watch.seconds());
+
+	vector<const uint64_t *> results(lookups);
+	watch.restart();
+	frozen.findbatch(probes.data(), lookups, results.data());
+	sum = 0;
+	for(const uint64_t *result : results){sum += *result;}
+	donotoptimize(sum);
+	report("frozen findbatch", lookups, watch.seconds());
+
+	printf("%-40s %10.1f bytes/key\n", "frozen search footprint", double(frozen.footprint()) / n);
+}
+
+int main(int argc, char **argv){
+	int runs = argc > 1 ? argc - 1 : 1;
+	for(int i = 0; i < runs; ++i){
+		run(argcount(argc, argv, i + 1, 1000000), 10000000);
+	}
+
+	return 0;
+}
@@ -0,0 +1,235 @@
+/*
+   Frozen red black tree
+
+   Once a tree is only read any more, its pointers are pure overhead: every
+   level of a lookup is a dependent load of a node that is somewhere else
+   in memory, about one cache miss per level. freeze() copies an RbTree
+   into FrozenRbTree, a static B+ tree of 16 keys per node (Khuong and
+   Morin; the S+ tree of Algorithmica), stored in flat cache line aligned
+   arrays with no pointers at all:
+
+       leaves    the keys in sorted order, 16 to a node
+       internal  16 separator keys per node, node k of a layer has the
+                 children 17k ... 17k + 16 in the layer below, separator i
+                 is the smallest key below child i + 1
+
+   A lookup descends log17(n / 16) internal nodes and one leaf. In every
+   node it counts the keys less than the one searched for, which is the
+   index of the child to go on with, without a single branch. For 64-bit
+   and 32-bit integer keys with std::less, and AVX2 available at compile
+   time (-mavx2 or -march=native), the 16 compares are done with vector
+   instructions, otherwise in a loop the compiler can vectorize itself.
+   The rank found in the leaves indexes the values, which are kept apart
+   from the keys so that the search touches only keys.
+
+   findbatch() runs a group of lookups level by level and prefetches the
+   next node of each, so the cache misses of the group overlap.
+
+       FrozenRbTree<uint64_t, Payload> frozen = freeze(tree);
+       const Payload *payload = frozen.find(key);
+*/
+
+#ifndef RB_FROZEN_H
+#define RB_FROZEN_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#include "red black tree.h"
+
+// Allocates cache line aligned arrays, so that a node is never split
+// across more lines than it needs
+template<typename T>
+struct CacheLineAllocator{
+	using value_type = T;
+
+	CacheLineAllocator() = default;
+	template<typename U>
+	CacheLineAllocator(const CacheLineAllocator<U> &){}
+
+	T *allocate(std::size_t n){
+		return static_cast<T *>(::operator new(n * sizeof(T), std::align_val_t(64)));
+	}
+
+	void deallocate(T *pointer, std::size_t){
+		::operator delete(pointer, std::align_val_t(64));
+	}
+
+	bool operator==(const CacheLineAllocator &) const{return true;}
+	bool operator!=(const CacheLineAllocator &) const{return false;}
+};
+
+template<typename Key, typename Value, typename Compare = std::less<Key>>
+class FrozenRbTree{
+public:
+	static constexpr std::size_t nodekeys = 16;
+	static constexpr std::size_t fanout = nodekeys + 1;
+
+	// Copies the keys and values of tree in order
+	template<typename Alloc>
+	explicit FrozenRbTree(const RbTree<Key, Value, Compare, Alloc> &tree): comp(tree.key_comp()){
+		keys.reserve(tree.size() + nodekeys);
+		values.reserve(tree.size());
+		for(const auto &rbnode : tree){
+			keys.push_back(rbnode.key);
+			values.push_back(rbnode.value);
+		}
+		count = keys.size();
+		build();
+	}
+
+	// Index of the first key not less than key, size() if there is none
+	std::size_t lowerbound(const Key &key) const{
+		if(!count || comp(keys[count - 1], key)){
+			return count;
+		}
+		std::size_t node = 0;
+		for(std::size_t layer = layers.size(); layer-- > 0;){
+			node = node * fanout + countless(&layers[layer][node * nodekeys], key);
+		}
+		return node * nodekeys + countless(&keys[node * nodekeys], key);
+	}
+
+	// The value of a node with the key, nullptr if there is none
+	const Value *find(const Key &key) const{
+		std::size_t rank = lowerbound(key);
+		if(rank == count || comp(key, keys[rank])){
+			return nullptr;
+		}
+		return &values[rank];
+	}
+
+	bool contains(const Key &key) const{return find(key) != nullptr;}
+
+	// Looks up n keys, out[i] is the value of keys[i] or nullptr. The
+	// lookups run in groups, one level at a time, with the node of the next
+	// level prefetched while the other lookups of the group go on
+	void findbatch(const Key *keys, std::size_t n, const Value **out) const{
+		constexpr std::size_t group = 16;
+		std::size_t nodes[group];
+		for(std::size_t first = 0; first < n; first += group){
+			std::size_t m = n - first < group ? n - first : group;
+			for(std::size_t i = 0; i < m; ++i){nodes[i] = 0;}
+			for(std::size_t layer = layers.size(); layer-- > 0;){
+				const Key *below = layer ? layers[layer - 1].data() : this->keys.data();
+				for(std::size_t i = 0; i < m; ++i){
+					const Key &key = keys[first + i];
+					if(!count || comp(this->keys[count - 1], key)){continue;}
+					nodes[i] = nodes[i] * fanout + countless(&layers[layer][nodes[i] * nodekeys], key);
+					prefetch(&below[nodes[i] * nodekeys]);
+				}
+			}
+			for(std::size_t i = 0; i < m; ++i){
+				const Key &key = keys[first + i];
+				out[first + i] = nullptr;
+				if(!count || comp(this->keys[count - 1], key)){continue;}
+				std::size_t rank = nodes[i] * nodekeys + countless(&this->keys[nodes[i] * nodekeys], key);
+				if(!comp(key, this->keys[rank])){out[first + i] = &values[rank];}
+			}
+		}
+	}
+
+	// The key and the value of rank i
+	const Key &key(std::size_t i) const{return keys[i];}
+	const Value &value(std::size_t i) const{return values[i];}
+
+	std::size_t size() const{return count;}
+	bool empty() const{return count == 0;}
+
+	// Bytes of the search structure, keys and separators
+	std::size_t footprint() const{
+		std::size_t total = keys.capacity() * sizeof(Key);
+		for(const auto &layer : layers){total += layer.capacity() * sizeof(Key);}
+		return total;
+	}
+
+private:
+	using Keys = std::vector<Key, CacheLineAllocator<Key>>;
+
+	// Pads the leaves to whole nodes with the largest key and builds the
+	// internal layers bottom up
+	void build(){
+		if(!count){
+			return;
+		}
+		std::size_t leaves = (count + nodekeys - 1) / nodekeys;
+		Key largest = keys[count - 1];
+		keys.resize(leaves * nodekeys, largest);
+
+		// nodes of the layer below and leaves per node of the layer below
+		std::size_t below = leaves, span = 1;
+		while(below > 1){
+			std::size_t nodes = (below + fanout - 1) / fanout;
+			Keys layer;
+			layer.reserve(nodes * nodekeys);
+			for(std::size_t node = 0; node < nodes; ++node){
+				for(std::size_t i = 0; i < nodekeys; ++i){
+					std::size_t child = node * fanout + i + 1;
+					layer.push_back(child < below ? keys[child * span * nodekeys] : largest);
+				}
+			}
+			layers.push_back(std::move(layer));
+			below = nodes;
+			span *= fanout;
+		}
+	}
+
+	// The number of the 16 keys at node that are less than key
+	std::size_t countless(const Key *node, const Key &key) const{
+#ifdef __AVX2__
+		if constexpr(std::is_same<Compare, std::less<Key>>::value && std::is_integral<Key>::value){
+			if constexpr(sizeof(Key) == 8){
+				// signed compares only, unsigned keys are shifted by 2^63
+				const __m256i bias = _mm256_set1_epi64x(std::is_signed<Key>::value ? 0 : INT64_MIN);
+				__m256i x = _mm256_xor_si256(_mm256_set1_epi64x(std::int64_t(key)), bias);
+				unsigned mask = 0;
+				for(int i = 0; i < 4; ++i){
+					__m256i y = _mm256_xor_si256(_mm256_load_si256(reinterpret_cast<const __m256i *>(node) + i), bias);
+					mask |= unsigned(_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(x, y)))) << 4 * i;
+				}
+				return __builtin_popcount(mask);
+			}
+			else if constexpr(sizeof(Key) == 4){
+				const __m256i bias = _mm256_set1_epi32(std::is_signed<Key>::value ? 0 : INT32_MIN);
+				__m256i x = _mm256_xor_si256(_mm256_set1_epi32(std::int32_t(key)), bias);
+				unsigned mask = 0;
+				for(int i = 0; i < 2; ++i){
+					__m256i y = _mm256_xor_si256(_mm256_load_si256(reinterpret_cast<const __m256i *>(node) + i), bias);
+					mask |= unsigned(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(x, y)))) << 8 * i;
+				}
+				return __builtin_popcount(mask);
+			}
+		}
+#endif
+		std::size_t less = 0;
+		for(std::size_t i = 0; i < nodekeys; ++i){less += comp(node[i], key);}
+		return less;
+	}
+
+	static void prefetch(const void *address){
+		__builtin_prefetch(address);
+		__builtin_prefetch(static_cast<const char *>(address) + 64);
+	}
+
+	Keys keys;
+	std::vector<Keys> layers; // internal layers, the root layer last
+	std::vector<Value> values;
+	std::size_t count = 0;
+	Compare comp;
+};
+
+// Copies a tree that will only be read any more into the flat layout
+template<typename Key, typename Value, typename Compare, typename Alloc>
+FrozenRbTree<Key, Value, Compare> freeze(const RbTree<Key, Value, Compare, Alloc> &tree){
+	return FrozenRbTree<Key, Value, Compare>(tree);
+}
+
+#endif
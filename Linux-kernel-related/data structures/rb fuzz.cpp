@@ -0,0 +1,799 @@
+/*
+   Red black tree fuzzer
+
+   Runs random operations on an RbTree and on a std::multimap (std::map
+   for the set operations) side by side and checks after every single
+   one that the tree is still a red black tree and holds what the model
+   holds:
+
+       the root is black and has no parent
+       every child links back to its parent
+       no red node has a red child
+       every path from a node to a null link has the same black height
+       the keys are in order and equal keys in insertion order
+       size() and both iteration directions agree with the model
+       maximum(), which the tree keeps, is the right most node
+
+   The keys come from a small range, so equal keys, erases that hit and
+   the fixup cases of both insert and erase come up all the time. Every
+   value is the serial number of its insert, which makes the nodes
+   distinguishable. Half of the seeds keep duplicates and use emplace(),
+   the other half keep the keys unique and also run split(), join() and
+   the set operations against a second random tree. Inserts and lookups
+   also go through emplace_hint() and find_from() with random hints, and
+   through emplace_near() and find_near().
+
+   Every seed also runs the legacy tree of "red black tree.cpp"
+   (insertrbnode(), removerbnode() and getrbnode()) against a
+   std::multiset with the same red black checks. The file is compiled
+   in here with its main() renamed.
+
+   Snapshots (rb snapshot.h) are written from a random tree and checked
+   against it with find(), scan() and foreach(), then changed in copy on
+   write mode against a std::map, saved over their own file and opened
+   again. A truncated file and a corrupt header must be rejected.
+
+   The persistent tree (rb persistent.h) runs insert(), assign() and
+   erase() against a std::map. After every write the new version must be
+   a red black tree that holds the model, and a few older snapshots, each
+   kept with a copy of the model of its time, must still hold exactly
+   that with find(), scan() and foreach().
+
+   The intrusive tree of rb intrusive.h runs through its augmented users:
+   every item sits in an order statistics tree (rb order statistics.h)
+   by key and in an interval tree (rb interval tree.h) by start. After
+   every rb_os_add(), rb_os_erase(), interval_tree_insert() and
+   interval_tree_remove() both must be red black trees with correct
+   parent links whose summaries, size and subtree_last, are those of
+   their subtrees. rb_os_select(), rb_os_position() and rb_os_rank() are
+   checked against a sorted vector of the keys and the overlaps from
+   interval_tree_iter_first() and interval_tree_iter_next() against a
+   linear scan.
+
+   A failure prints the seed, the operation and what is broken and exits
+   with 1; run that seed alone to reproduce it.
+
+   arguments: seeds, operations per seed, key range, first seed
+
+   g++ -O2 -std=c++17 -pthread "rb fuzz.cpp" && ./a.out 100 10000 64
+*/
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <optional>
+#include <random>
+#include <set>
+#include <vector>
+
+#include "benchmark.h"
+#include "rb interval tree.h"
+#include "rb order statistics.h"
+#include "rb persistent.h"
+#include "rb snapshot.h"
+#include "red black tree.h"
+
+#define main legacymain
+#include "red black tree.cpp"
+#undef main
+
+using namespace std;
+
+using Tree = RbTree<int, int>;
+using Node = Tree::Node;
+
+struct Fuzzer{
+	Fuzzer(uint64_t seed, size_t range, bool unique): rng(seed), seed(seed), range(range), unique(unique){}
+
+	void fail(const char *what){
+		cout << "seed " << seed << ", operation " << step << " (" << operation << "): " << what << endl;
+		exit(1);
+	}
+
+	void expect(bool condition, const char *what){
+		if(!condition){fail(what);}
+	}
+
+	// Checks the subtree below rbnode and returns its black height
+	int checksubtree(const Node *rbnode, const Node *parent){
+		if(!rbnode){
+			return 1;
+		}
+		expect(rbnode->parent == parent, "parent link broken");
+		expect(Tree::isblack(rbnode) || (Tree::isblack(rbnode->left) && Tree::isblack(rbnode->right)),
+			"red node with a red child");
+		int left = checksubtree(rbnode->left, rbnode);
+		int right = checksubtree(rbnode->right, rbnode);
+		expect(left == right, "black heights differ");
+		return left + Tree::isblack(rbnode);
+	}
+
+	// Checks the red black properties and that tree holds the model
+	void check(const Tree &tree, const multimap<int, int> &model){
+		if(tree.root()){
+			expect(Tree::isblack(tree.root()), "red root");
+		}
+		checksubtree(tree.root(), nullptr);
+		const Node *rightmost = tree.root();
+		while(rightmost && rightmost->right){rightmost = rightmost->right;}
+		expect(tree.maximum() == rightmost, "maximum() is not the right most node");
+
+		expect(tree.size() == model.size(), "size differs from the model");
+		auto it = model.begin();
+		for(const Node &rbnode : tree){
+			expect(it != model.end(), "more nodes than in the model");
+			expect(rbnode.key == it->first && rbnode.value == it->second, "node differs from the model");
+			++it;
+		}
+		expect(it == model.end(), "fewer nodes than in the model");
+		auto rit = model.rbegin();
+		for(auto node = tree.rbegin(); node != tree.rend(); ++node, ++rit){
+			expect(rit != model.rend() && node->value == rit->second, "reverse iteration differs");
+		}
+	}
+
+	int randomkey(){return int(rng() % range);}
+
+	// A tree of unique random keys and its model
+	void randomtree(Tree &tree, multimap<int, int> &model){
+		size_t n = rng() % (range / 2 + 1);
+		for(size_t i = 0; i < n; ++i){
+			int key = randomkey(), value = serial++;
+			if(tree.try_emplace(key, value).second){model.emplace(key, value);}
+		}
+	}
+
+	// A random position: end(), the first node or the node of a random key
+	Tree::const_iterator randomhint(){
+		switch(rng() % 3){
+		case 0:
+			return tree.cend();
+		case 1:
+			return tree.cbegin();
+		default:
+			return tree.lower_bound(randomkey());
+		}
+	}
+
+	void insert(){
+		int key = randomkey(), value = serial++;
+		if(rng() % 2 && !(unique && model.count(key))){
+			Tree::iterator it;
+			if(rng() % 2){
+				operation = "emplace_hint";
+				it = tree.emplace_hint(randomhint(), key, value);
+			}
+			else{
+				operation = "emplace_near";
+				it = tree.emplace_near(key, value);
+			}
+			expect(it->key == key && it->value == value, "hinted insert points to the wrong node");
+			model.emplace(key, value);
+		}
+		else if(unique){
+			operation = "try_emplace";
+			auto result = tree.try_emplace(key, value);
+			bool fresh = !model.count(key);
+			expect(result.second == fresh, "try_emplace result differs");
+			expect(result.first->key == key, "try_emplace points to the wrong node");
+			if(fresh){model.emplace(key, value);}
+		}
+		else{
+			operation = "emplace";
+			auto it = tree.emplace(key, value);
+			expect(it->key == key && it->value == value, "emplace points to the wrong node");
+			model.emplace(key, value);
+		}
+	}
+
+	void erasekey(){
+		operation = "erase(key)";
+		int key = randomkey();
+		// erase(key) may take any of the equal nodes, so see which one went
+		vector<int> before;
+		for(auto it = tree.lower_bound(key); it != tree.end() && it->key == key; ++it){
+			before.push_back(it->value);
+		}
+		expect(tree.erase(key) == !before.empty(), "erase result differs");
+		if(before.empty()){
+			return;
+		}
+		auto it = tree.lower_bound(key);
+		for(int value : before){
+			if(it != tree.end() && it->key == key && it->value == value){
+				++it;
+				continue;
+			}
+			auto range = model.equal_range(key);
+			for(auto m = range.first; m != range.second; ++m){
+				if(m->second == value){
+					model.erase(m);
+					return;
+				}
+			}
+			fail("erased node not in the model");
+		}
+		fail("erase removed nothing");
+	}
+
+	void eraseiterator(){
+		operation = "erase(iterator)";
+		int key = randomkey();
+		auto it = tree.lower_bound(key);
+		auto m = model.lower_bound(key);
+		expect((it == tree.end()) == (m == model.end()), "lower_bound differs");
+		if(it == tree.end()){
+			return;
+		}
+		auto next = tree.erase(it);
+		m = model.erase(m);
+		expect((next == tree.end()) == (m == model.end()), "erase returned the wrong iterator");
+		if(next != tree.end()){
+			expect(next->value == m->second, "erase returned the wrong iterator");
+		}
+	}
+
+	void lookup(){
+		operation = "find, find_from, lower_bound, upper_bound, count_range";
+		int key = randomkey();
+		auto it = tree.find(key);
+		expect((it != tree.end()) == (model.count(key) != 0), "find differs");
+		if(it != tree.end()){
+			expect(it->key == key, "find found the wrong key");
+		}
+		it = rng() % 2 ? tree.find_from(randomhint(), key) : tree.find_near(key);
+		expect((it != tree.end()) == (model.count(key) != 0), "find_from differs");
+		if(it != tree.end()){
+			expect(it->key == key, "find_from found the wrong key");
+		}
+		auto lower = tree.lower_bound(key);
+		auto mlower = model.lower_bound(key);
+		expect(lower == tree.end() ? mlower == model.end() : mlower != model.end() && lower->value == mlower->second,
+			"lower_bound differs");
+		auto upper = tree.upper_bound(key);
+		auto mupper = model.upper_bound(key);
+		expect(upper == tree.end() ? mupper == model.end() : mupper != model.end() && upper->value == mupper->second,
+			"upper_bound differs");
+
+		int lo = randomkey(), hi = randomkey();
+		size_t expected = lo < hi ? distance(model.lower_bound(lo), model.lower_bound(hi)) : 0;
+		expect(tree.count_range(lo, hi) == expected, "count_range differs");
+	}
+
+	void splitjoin(){
+		operation = "split, join";
+		int key = randomkey();
+		Tree right = tree.split(key);
+		multimap<int, int> mright(model.lower_bound(key), model.end());
+		multimap<int, int> mleft(model.begin(), model.lower_bound(key));
+		check(tree, mleft);
+		check(right, mright);
+		tree.join(move(right));
+		expect(right.empty(), "join left nodes behind");
+	}
+
+	void setoperation(){
+		Tree other;
+		multimap<int, int> mother;
+		randomtree(other, mother);
+		switch(rng() % 3){
+		case 0:
+			operation = "setunion";
+			tree.setunion(move(other));
+			for(auto &kv : mother){
+				if(!model.count(kv.first)){model.insert(kv);}
+			}
+			break;
+		case 1:
+			operation = "setintersection";
+			tree.setintersection(move(other));
+			for(auto it = model.begin(); it != model.end();){
+				it = mother.count(it->first) ? next(it) : model.erase(it);
+			}
+			break;
+		default:
+			operation = "setdifference";
+			tree.setdifference(move(other));
+			for(auto &kv : mother){model.erase(kv.first);}
+		}
+		expect(other.empty(), "set operation left nodes in other");
+	}
+
+	void assign(){
+		operation = "assign_sorted";
+		vector<pair<int, int>> sorted(model.begin(), model.end());
+		tree.assign_sorted(sorted.begin(), sorted.end());
+	}
+
+	void run(size_t operations){
+		for(step = 0; step < operations; ++step){
+			// keep the tree around the size of the key range
+			unsigned r = rng() % 100;
+			bool grow = model.size() < range;
+			if(r < (grow ? 40u : 25u)){insert();}
+			else if(r < 60){erasekey();}
+			else if(r < 70){eraseiterator();}
+			else if(r < 90){lookup();}
+			else if(r < 94){splitjoin();}
+			else if(r < 98 && unique){setoperation();}
+			else if(r < 99){assign();}
+			else if(!(rng() % 8)){
+				operation = "clear";
+				tree.clear();
+				model.clear();
+			}
+			check(tree, model);
+		}
+	}
+
+	mt19937_64 rng;
+	uint64_t seed;
+	size_t range;
+	bool unique;
+	size_t step = 0;
+	const char *operation = "";
+	int serial = 0;
+	Tree tree;
+	multimap<int, int> model;
+};
+
+// The same checks for the Rbnode tree of "red black tree.cpp", whose
+// color is true for red and which holds bare keys
+struct LegacyFuzzer{
+	LegacyFuzzer(uint64_t seed, size_t range): rng(seed), seed(seed), range(range){}
+
+	~LegacyFuzzer(){eraserbtree(root);}
+
+	void fail(const char *what){
+		cout << "legacy tree, seed " << seed << ", operation " << step << " (" << operation << "): "
+			<< what << endl;
+		exit(1);
+	}
+
+	void expect(bool condition, const char *what){
+		if(!condition){fail(what);}
+	}
+
+	int checksubtree(Rbnode *rbnode, const Rbnode *parent){
+		if(!rbnode){
+			return 1;
+		}
+		expect(rbnode->parent == parent, "parent link broken");
+		expect(isblack(rbnode) || (isblack(rbnode->left) && isblack(rbnode->right)), "red node with a red child");
+		int left = checksubtree(rbnode->left, rbnode);
+		int right = checksubtree(rbnode->right, rbnode);
+		expect(left == right, "black heights differ");
+		return left + isblack(rbnode);
+	}
+
+	void check(){
+		expect(isblack(root), "red root");
+		checksubtree(root, nullptr);
+		const Rbnode *rbnode = root;
+		while(rbnode && rbnode->left){rbnode = rbnode->left;}
+		auto it = model.begin();
+		for(; rbnode; rbnode = nextrbnode(rbnode, nullptr), ++it){
+			expect(it != model.end(), "more nodes than in the model");
+			expect(rbnode->key == *it, "node differs from the model");
+		}
+		expect(it == model.end(), "fewer nodes than in the model");
+	}
+
+	void run(size_t operations){
+		for(step = 0; step < operations; ++step){
+			int key = int(rng() % range);
+			unsigned r = rng() % 100;
+			if(r < (model.size() < range ? 45u : 30u)){
+				operation = "insertrbnode";
+				insertrbnode(key, root);
+				model.insert(key);
+			}
+			else if(r < 75){
+				operation = "removerbnode";
+				removerbnode(key, root);
+				auto it = model.find(key);
+				if(it != model.end()){model.erase(it);}
+			}
+			else if(r < 99){
+				operation = "getrbnode";
+				Rbnode *rbnode = getrbnode(key, root);
+				expect(!rbnode == !model.count(key), "getrbnode differs");
+				expect(!rbnode || rbnode->key == key, "getrbnode found the wrong key");
+			}
+			else{
+				operation = "eraserbtree";
+				eraserbtree(root);
+				model.clear();
+			}
+			check();
+		}
+	}
+
+	mt19937_64 rng;
+	uint64_t seed;
+	size_t range;
+	size_t step = 0;
+	const char *operation = "";
+	Rbnode *root = nullptr;
+	multiset<int> model;
+};
+
+// Checks snapshots against a tree and their changes against a std::map
+struct SnapshotFuzzer{
+	using Snapshot = RbSnapshot<int, int>;
+
+	SnapshotFuzzer(uint64_t seed, size_t range, const string &path): rng(seed), seed(seed), range(range),
+	path(path){}
+
+	void fail(const char *what){
+		cout << "snapshot, seed " << seed << ", operation " << step << " (" << operation << "): "
+			<< what << endl;
+		exit(1);
+	}
+
+	void expect(bool condition, const char *what){
+		if(!condition){fail(what);}
+	}
+
+	int randomkey(){return int(rng() % range);}
+
+	// Checks every lookup, a random scan and the full scan
+	void check(const Snapshot &snapshot){
+		expect(snapshot.size() == model.size(), "size differs from the model");
+		for(int key = -1; key <= int(range); ++key){
+			const int *value = snapshot.find(key);
+			auto it = model.find(key);
+			expect(!value == (it == model.end()), "find differs");
+			expect(!value || *value == it->second, "find returned the wrong value");
+		}
+		auto it = model.begin();
+		snapshot.foreach([&](int key, int value){
+			expect(it != model.end() && it->first == key && it->second == value, "foreach differs");
+			++it;
+		});
+		expect(it == model.end(), "foreach missed keys");
+		int lo = randomkey(), hi = randomkey();
+		it = model.lower_bound(lo);
+		snapshot.scan(lo, hi, [&](int key, int value){
+			expect(it != model.end() && it->first == key && it->second == value && key < hi, "scan differs");
+			++it;
+		});
+		expect(lo >= hi || it == model.lower_bound(hi), "scan missed keys");
+	}
+
+	void expectrejected(const char *what){
+		try{
+			Snapshot::open(path.c_str());
+		}
+		catch(const runtime_error &){
+			return;
+		}
+		fail(what);
+	}
+
+	void run(size_t operations){
+		operation = "write, open";
+		RbTree<int, int> tree;
+		for(size_t i = rng() % (range + 1); i; --i){
+			int key = randomkey(), value = int(rng());
+			if(tree.try_emplace(key, value).second){model.emplace(key, value);}
+		}
+		Snapshot::write(tree, path.c_str());
+		check(Snapshot::open(path.c_str()));
+
+		optional<Snapshot> opened(Snapshot::open(path.c_str(), Snapshot::copyonwrite));
+		Snapshot *snapshot = &*opened;
+		for(step = 0; step < operations; ++step){
+			int key = randomkey(), value = int(rng());
+			unsigned r = rng() % 100;
+			if(r < 40){
+				operation = "insert";
+				bool fresh = !model.count(key);
+				expect(snapshot->insert(key, value) == fresh, "insert result differs");
+				if(fresh){model.emplace(key, value);}
+			}
+			else if(r < 65){
+				operation = "assign";
+				auto it = model.find(key);
+				expect(snapshot->assign(key, value) == (it != model.end()), "assign result differs");
+				if(it != model.end()){it->second = value;}
+			}
+			else if(r < 98){
+				operation = "erase";
+				expect(snapshot->erase(key) == (model.erase(key) != 0), "erase result differs");
+			}
+			else{
+				// over the file it is mapped from
+				operation = "save, open";
+				snapshot->save(path.c_str());
+				check(*snapshot);
+				opened.reset();
+				snapshot = &opened.emplace(Snapshot::open(path.c_str(), Snapshot::copyonwrite));
+			}
+			check(*snapshot);
+		}
+
+		operation = "truncated file";
+		snapshot->save(path.c_str());
+		expect(truncate(path.c_str(), 10) == 0, "cannot truncate the file");
+		expectrejected("truncated file accepted");
+		operation = "corrupt header";
+		snapshot->save(path.c_str());
+		// the node count, after the magic and four 32-bit fields. 2^61
+		// nodes of 24 bytes wrap around to 0 bytes
+		FILE *file = fopen(path.c_str(), "r+b");
+		uint64_t count = uint64_t(1) << 61;
+		expect(file && fseek(file, 24, SEEK_SET) == 0 && fwrite(&count, sizeof(count), 1, file) == 1,
+			"cannot corrupt the file");
+		fclose(file);
+		expectrejected("corrupt header accepted");
+	}
+
+	mt19937_64 rng;
+	uint64_t seed;
+	size_t range;
+	string path;
+	size_t step = 0;
+	const char *operation = "";
+	map<int, int> model;
+};
+
+// Checks every version of a PersistentRbTree against a std::map, the
+// current one and older ones that later writes must not change
+struct PersistentFuzzer{
+	using Tree = PersistentRbTree<int, int>;
+
+	PersistentFuzzer(uint64_t seed, size_t range): rng(seed), seed(seed), range(range){}
+
+	void fail(const char *what){
+		cout << "persistent tree, seed " << seed << ", operation " << step << " (" << operation << "): "
+			<< what << endl;
+		exit(1);
+	}
+
+	void expect(bool condition, const char *what){
+		if(!condition){fail(what);}
+	}
+
+	int randomkey(){return int(rng() % range);}
+
+	void check(const Tree::Snapshot &snapshot, const map<int, int> &model){
+		expect(snapshot.blackheight() >= 0, "not a red black tree");
+		expect(snapshot.size() == model.size(), "size differs from the model");
+		for(int key = -1; key <= int(range); ++key){
+			const int *value = snapshot.find(key);
+			auto it = model.find(key);
+			expect(!value == (it == model.end()), "find differs");
+			expect(!value || *value == it->second, "find returned the wrong value");
+		}
+		auto it = model.begin();
+		snapshot.foreach([&](int key, int value){
+			expect(it != model.end() && it->first == key && it->second == value, "foreach differs");
+			++it;
+		});
+		expect(it == model.end(), "foreach missed keys");
+		int lo = randomkey(), hi = randomkey();
+		it = model.lower_bound(lo);
+		snapshot.scan(lo, hi, [&](int key, int value){
+			expect(it != model.end() && it->first == key && it->second == value && key < hi, "scan differs");
+			++it;
+		});
+		expect(lo >= hi || it == model.lower_bound(hi), "scan missed keys");
+	}
+
+	void run(size_t operations){
+		Tree tree;
+		// older versions with the model of their time
+		vector<pair<unique_ptr<Tree::Snapshot>, map<int, int>>> older;
+		for(step = 0; step < operations; ++step){
+			int key = randomkey(), value = int(rng());
+			unsigned r = rng() % 100;
+			if(r < (model.size() < range ? 40u : 25u)){
+				operation = "insert";
+				bool fresh = !model.count(key);
+				expect(tree.insert(key, value) == fresh, "insert result differs");
+				if(fresh){model.emplace(key, value);}
+			}
+			else if(r < 60){
+				operation = "assign";
+				expect(tree.assign(key, value) == !model.count(key), "assign result differs");
+				model[key] = value;
+			}
+			else if(r < 95){
+				operation = "erase";
+				expect(tree.erase(key) == (model.erase(key) != 0), "erase result differs");
+			}
+			else if(older.size() < 4){
+				operation = "snapshot";
+				older.emplace_back(make_unique<Tree::Snapshot>(tree), model);
+			}
+			else{
+				// without any snapshot the epoch frees the replaced nodes
+				operation = "drop snapshots";
+				older.erase(older.begin(), older.begin() + rng() % (older.size() + 1));
+			}
+			expect(tree.size() == model.size(), "size differs from the model");
+			check(tree.snapshot(), model);
+			for(auto &version : older){check(*version.first, version.second);}
+		}
+	}
+
+	mt19937_64 rng;
+	uint64_t seed;
+	size_t range;
+	size_t step = 0;
+	const char *operation = "";
+	map<int, int> model;
+};
+
+// Checks the augmented trees and the intrusive tree below them against
+// a vector of the items they hold
+struct AugmentedFuzzer{
+	struct Item{
+		rb_os_node os;
+		interval_tree_node<int> it;
+	};
+
+	AugmentedFuzzer(uint64_t seed, size_t range): rng(seed), seed(seed), range(range){}
+
+	~AugmentedFuzzer(){
+		for(Item *item : items){delete item;}
+	}
+
+	void fail(const char *what){
+		cout << "augmented tree, seed " << seed << ", operation " << step << " (" << operation << "): "
+			<< what << endl;
+		exit(1);
+	}
+
+	void expect(bool condition, const char *what){
+		if(!condition){fail(what);}
+	}
+
+	int randomkey(){return int(rng() % range);}
+
+	static int key(const rb_node *rb){return rb_entry(rb, Item, os.rb)->it.start;}
+
+	// Checks the subtree below rb and its summaries with summarized(rb)
+	// and returns its black height
+	template<typename Summarized>
+	int checksubtree(const rb_node *rb, const rb_node *parent, Summarized summarized){
+		if(!rb){
+			return 1;
+		}
+		expect(rb_parent(rb) == parent, "parent link broken");
+		expect(rb_is_black(rb) || ((!rb->rb_left || rb_is_black(rb->rb_left)) &&
+			(!rb->rb_right || rb_is_black(rb->rb_right))), "red node with a red child");
+		expect(summarized(rb), "summary differs from the subtree");
+		int left = checksubtree(rb->rb_left, rb, summarized);
+		int right = checksubtree(rb->rb_right, rb, summarized);
+		expect(left == right, "black heights differ");
+		return left + rb_is_black(rb);
+	}
+
+	void checkorderstatistics(){
+		expect(!ostree.node || rb_is_black(ostree.node), "red root");
+		checksubtree(ostree.node, nullptr, [](const rb_node *rb){
+			return rb_os_size(rb) == 1 + rb_os_size(rb->rb_left) + rb_os_size(rb->rb_right);
+		});
+		vector<int> sorted;
+		for(Item *item : items){sorted.push_back(item->it.start);}
+		sort(sorted.begin(), sorted.end());
+		expect(rb_os_count(&ostree) == sorted.size(), "rb_os_count differs");
+		size_t k = 0;
+		for(rb_node *rb = rb_first(&ostree); rb; rb = rb_next(rb), ++k){
+			expect(k < sorted.size() && key(rb) == sorted[k], "in order walk differs");
+		}
+		expect(k == sorted.size(), "in order walk missed nodes");
+		for(k = 0; k < sorted.size(); ++k){
+			rb_os_node *node = rb_os_select(&ostree, k);
+			expect(node && key(&node->rb) == sorted[k], "rb_os_select differs");
+			expect(rb_os_position(node) == k, "rb_os_position differs");
+		}
+		expect(!rb_os_select(&ostree, k), "rb_os_select past the end");
+		for(int probe = -1; probe <= int(range); ++probe){
+			size_t rank = lower_bound(sorted.begin(), sorted.end(), probe) - sorted.begin();
+			expect(rb_os_rank(probe, &ostree, [](int probe, const rb_node *rb){return probe - key(rb);}) == rank,
+				"rb_os_rank differs");
+		}
+	}
+
+	void checkintervals(){
+		expect(!intervals.rb_root.node || rb_is_black(intervals.rb_root.node), "red root");
+		checksubtree(intervals.rb_root.node, nullptr, [](const rb_node *rb){
+			int last = rb_entry(rb, interval_tree_node<int>, rb)->last;
+			for(const rb_node *child : {rb->rb_left, rb->rb_right}){
+				if(child){last = max(last, rb_entry(child, interval_tree_node<int>, rb)->subtree_last);}
+			}
+			return rb_entry(rb, interval_tree_node<int>, rb)->subtree_last == last;
+		});
+		expect(intervals.rb_leftmost == rb_first(&intervals.rb_root), "rb_leftmost is not the first node");
+		size_t n = 0;
+		int start = -1;
+		for(rb_node *rb = rb_first(&intervals.rb_root); rb; rb = rb_next(rb), ++n){
+			expect(start <= interval_tree_entry<int>(rb)->start, "intervals out of order");
+			start = interval_tree_entry<int>(rb)->start;
+		}
+		expect(n == items.size(), "interval count differs");
+
+		int lo = randomkey() - 2, hi = lo + int(rng() % (range / 4 + 1));
+		vector<const interval_tree_node<int> *> found, expected;
+		start = -1;
+		for(auto *it = interval_tree_iter_first(&intervals, lo, hi); it; it = interval_tree_iter_next(it, lo, hi)){
+			expect(it->start <= hi && lo <= it->last, "overlap iteration returned a disjoint interval");
+			expect(start <= it->start, "overlaps out of order");
+			start = it->start;
+			found.push_back(it);
+		}
+		for(Item *item : items){
+			if(item->it.start <= hi && lo <= item->it.last){expected.push_back(&item->it);}
+		}
+		sort(found.begin(), found.end());
+		sort(expected.begin(), expected.end());
+		expect(found == expected, "overlaps differ from a linear scan");
+	}
+
+	void run(size_t operations){
+		for(step = 0; step < operations; ++step){
+			if(items.empty() || rng() % 100 < (items.size() < range ? 55u : 40u)){
+				operation = "rb_os_add, interval_tree_insert";
+				Item *item = new Item;
+				item->it.start = randomkey();
+				item->it.last = item->it.start + int(rng() % (range / 8 + 1));
+				rb_os_add(&item->os, &ostree, [](const rb_node *a, const rb_node *b){return key(a) < key(b);});
+				interval_tree_insert(&item->it, &intervals);
+				items.push_back(item);
+			}
+			else{
+				operation = "rb_os_erase, interval_tree_remove";
+				size_t i = rng() % items.size();
+				rb_os_erase(&items[i]->os, &ostree);
+				interval_tree_remove(&items[i]->it, &intervals);
+				delete items[i];
+				items[i] = items.back();
+				items.pop_back();
+			}
+			checkorderstatistics();
+			checkintervals();
+		}
+	}
+
+	mt19937_64 rng;
+	uint64_t seed;
+	size_t range;
+	size_t step = 0;
+	const char *operation = "";
+	rb_root ostree;
+	rb_root_cached intervals;
+	vector<Item *> items;
+};
+
+int main(int argc, char **argv){
+	size_t seeds = argcount(argc, argv, 1, 100);
+	size_t operations = argcount(argc, argv, 2, 10000);
+	size_t range = argcount(argc, argv, 3, 64);
+	size_t first = argcount(argc, argv, 4, 0);
+	if(!range){range = 1;}
+
+	string path = "/tmp/rb fuzz " + to_string(getpid()) + ".snapshot";
+
+	Stopwatch watch;
+	for(size_t seed = first; seed < first + seeds; ++seed){
+		Fuzzer fuzzer(seed, range, seed % 2);
+		fuzzer.run(operations);
+		LegacyFuzzer legacy(seed, range);
+		legacy.run(operations);
+		SnapshotFuzzer snapshot(seed, range, path);
+		snapshot.run(operations / 10);
+		PersistentFuzzer persistent(seed, range);
+		persistent.run(operations);
+		AugmentedFuzzer augmented(seed, range);
+		augmented.run(operations);
+	}
+	unlink(path.c_str());
+	cout << seeds << " seeds, " << seeds * operations << " operations on each tree, no violations in "
+		<< watch.seconds() << " s" << endl;
+	return 0;
+}
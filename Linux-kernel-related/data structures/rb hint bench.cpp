@@ -0,0 +1,96 @@
+/*
+   Hinted insert benchmark
+
+   Keys that arrive nearly in order, inserted with emplace(), which
+   descends from the root every time, against emplace_hint(end()), which
+   appends to the kept maximum, and emplace_near(), which searches from
+   the last inserted node. Then the same keys looked up with find()
+   against find_near(). Three streams of n keys:
+
+       append      strictly ascending, like timestamps
+       mostly      ascending with every 100th key jittered back by up to
+                   1000 positions, like timestamps from a few clocks
+       clustered   ascending runs of 64 keys, each run starting anywhere,
+                   like several writers each appending to its own range
+
+   The clustered stream shows where fingers stop paying: the neighbours of
+   the last key of a run belong to other runs anywhere in the tree, and
+   climbing up to them through the parent pointers can cost more than a
+   descent from the root.
+
+   arguments: keys
+
+   g++ -O2 -std=c++17 "rb hint bench.cpp" && ./a.out 10000000
+*/
+
+#include <iostream>
+#include <string>
+
+#include "benchmark.h"
+#include "red black tree.h"
+
+using namespace std;
+
+using Tree = RbTree<uint64_t, uint64_t>;
+
+struct Stream{
+	const char *name;
+	vector<uint64_t> keys;
+};
+
+vector<Stream> makestreams(size_t n){
+	vector<Stream> streams;
+	vector<uint64_t> keys(n);
+	for(size_t i = 0; i < n; ++i){keys[i] = i * 4;}
+	streams.push_back({"append", keys});
+
+	mt19937_64 rng(1);
+	for(size_t i = 0; i < n; i += 100){keys[i] -= min<uint64_t>(keys[i], rng() % 1000 * 4 + 1);}
+	streams.push_back({"mostly", keys});
+
+	const size_t run = 64;
+	vector<uint64_t> bases = randomkeys((n + run - 1) / run);
+	for(size_t i = 0; i < n; ++i){keys[i] = bases[i / run] * run * 4 + i % run * 4;}
+	streams.push_back({"clustered", keys});
+	return streams;
+}
+
+template<typename Insert>
+void insert(const string &label, const vector<uint64_t> &keys, Insert insert){
+	Tree tree;
+	Stopwatch watch;
+	for(uint64_t key : keys){insert(tree, key);}
+	report(label.c_str(), keys.size(), watch.seconds());
+}
+
+int main(int argc, char **argv){
+	size_t n = argcount(argc, argv, 1, 10000000);
+	if(!n){n = 1;}
+
+	// so that the first run does not pay for growing the heap
+	insert("warm up, emplace", randomkeys(n), [](Tree &tree, uint64_t key){tree.emplace(key, key);});
+	cout << endl;
+
+	for(const Stream &stream : makestreams(n)){
+		const vector<uint64_t> &keys = stream.keys;
+		string prefix = string(stream.name) + ", ";
+		insert(prefix + "emplace", keys, [](Tree &tree, uint64_t key){tree.emplace(key, key);});
+		insert(prefix + "emplace_hint(end())", keys, [](Tree &tree, uint64_t key){
+			tree.emplace_hint(tree.cend(), key, key);
+		});
+		insert(prefix + "emplace_near", keys, [](Tree &tree, uint64_t key){tree.emplace_near(key, key);});
+
+		Tree tree;
+		for(uint64_t key : keys){tree.emplace_hint(tree.cend(), key, key);}
+		uint64_t sum = 0;
+		Stopwatch watch;
+		for(uint64_t key : keys){sum += tree.find(key)->value;}
+		report((prefix + "find").c_str(), n, watch.seconds());
+		watch.restart();
+		for(uint64_t key : keys){sum += tree.find_near(key)->value;}
+		report((prefix + "find_near").c_str(), n, watch.seconds());
+		donotoptimize(sum);
+		cout << endl;
+	}
+	return 0;
+}
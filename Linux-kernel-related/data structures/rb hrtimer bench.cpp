@@ -0,0 +1,186 @@
+/*
+   Timer queue benchmark
+
+   Churn: n live timers with deadlines spread over 10 s, then n random
+   operations of each kind on them:
+
+       cancel + arm    takes a timer off and arms it at a new random time
+       re-arm          hrtimer_start() on a queued timer, to a random time
+       push back       re-arms a timer 1 us later, which mostly keeps its
+                       place and only rewrites the expiry
+       next event      hrtimer_next_event()
+
+   against a std::multimap from expiry to timer, where every timer keeps
+   the iterator of its entry to be cancelled with, the usual way to get a
+   cancellable timer queue from the standard library.
+
+   Expiry: periodic timers with periods of 1 to 100 ms run for some
+   seconds of simulated time. Every wakeup goes to hrtimer_next_event()
+   and runs the queue there. With slack, timers that fall due within the
+   slack of each other share a wakeup, so the wakeups drop while the
+   callbacks stay the same.
+
+   arguments: live timers, periodic timers, simulated seconds
+
+   g++ -O2 -std=c++17 "rb hrtimer bench.cpp" && ./a.out 1000000 10000 10
+*/
+
+#include <iostream>
+#include <map>
+#include <string>
+
+#include "benchmark.h"
+#include "rb hrtimer.h"
+
+using namespace std;
+
+const uint64_t NSEC_PER_MSEC = 1000000, NSEC_PER_SEC = 1000000000;
+
+hrtimer_restart nothing(hrtimer *){return HRTIMER_NORESTART;}
+
+void churnhrtimer(const vector<uint64_t> &deadlines, const vector<uint64_t> &picks){
+	size_t n = deadlines.size();
+	hrtimer_clock_base base;
+	vector<hrtimer> timers(n);
+	Stopwatch watch;
+	for(size_t i = 0; i < n; ++i){
+		hrtimer_init(&timers[i], &base, nothing);
+		hrtimer_start(&timers[i], deadlines[i]);
+	}
+	report("hrtimer, arm", n, watch.seconds());
+
+	watch.restart();
+	for(size_t i = 0; i < n; ++i){
+		hrtimer *timer = &timers[picks[i] % n];
+		hrtimer_cancel(timer);
+		hrtimer_start(timer, deadlines[picks[i] % n] ^ picks[i] % NSEC_PER_SEC);
+	}
+	report("hrtimer, cancel + arm", n, watch.seconds());
+
+	watch.restart();
+	for(size_t i = 0; i < n; ++i){
+		hrtimer_start(&timers[picks[i] % n], deadlines[i]);
+	}
+	report("hrtimer, re-arm", n, watch.seconds());
+
+	watch.restart();
+	for(size_t i = 0; i < n; ++i){
+		hrtimer *timer = &timers[picks[i] % n];
+		hrtimer_start(timer, timer->expires + 1000);
+	}
+	report("hrtimer, push back 1 us", n, watch.seconds());
+
+	uint64_t sum = 0;
+	watch.restart();
+	for(size_t i = 0; i < n; ++i){sum += hrtimer_next_event(&base);}
+	report("hrtimer, next event", n, watch.seconds());
+	donotoptimize(sum);
+}
+
+// A cancellable timer on std::multimap
+struct MapTimer{
+	multimap<uint64_t, MapTimer *>::iterator entry;
+	bool queued = false;
+};
+
+struct MapQueue{
+	void start(MapTimer *timer, uint64_t expires){
+		if(timer->queued){timers.erase(timer->entry);}
+		timer->entry = timers.emplace(expires, timer);
+		timer->queued = true;
+	}
+
+	void cancel(MapTimer *timer){
+		if(timer->queued){
+			timers.erase(timer->entry);
+			timer->queued = false;
+		}
+	}
+
+	uint64_t nextevent() const{return timers.empty() ? KTIME_MAX : timers.begin()->first;}
+
+	multimap<uint64_t, MapTimer *> timers;
+};
+
+void churnmap(const vector<uint64_t> &deadlines, const vector<uint64_t> &picks){
+	size_t n = deadlines.size();
+	MapQueue queue;
+	vector<MapTimer> timers(n);
+	Stopwatch watch;
+	for(size_t i = 0; i < n; ++i){queue.start(&timers[i], deadlines[i]);}
+	report("std::multimap, arm", n, watch.seconds());
+
+	watch.restart();
+	for(size_t i = 0; i < n; ++i){
+		MapTimer *timer = &timers[picks[i] % n];
+		queue.cancel(timer);
+		queue.start(timer, deadlines[picks[i] % n] ^ picks[i] % NSEC_PER_SEC);
+	}
+	report("std::multimap, cancel + arm", n, watch.seconds());
+
+	watch.restart();
+	for(size_t i = 0; i < n; ++i){queue.start(&timers[picks[i] % n], deadlines[i]);}
+	report("std::multimap, re-arm", n, watch.seconds());
+
+	watch.restart();
+	for(size_t i = 0; i < n; ++i){
+		MapTimer *timer = &timers[picks[i] % n];
+		queue.start(timer, timer->entry->first + 1000);
+	}
+	report("std::multimap, push back 1 us", n, watch.seconds());
+
+	uint64_t sum = 0;
+	watch.restart();
+	for(size_t i = 0; i < n; ++i){sum += queue.nextevent();}
+	report("std::multimap, next event", n, watch.seconds());
+	donotoptimize(sum);
+}
+
+struct Periodic{
+	hrtimer timer;
+	uint64_t period;
+};
+
+hrtimer_restart tick(hrtimer *timer){
+	hrtimer_forward_now(timer, container_of(timer, Periodic, timer)->period);
+	return HRTIMER_RESTART;
+}
+
+void expiry(size_t n, uint64_t seconds, uint64_t slack){
+	hrtimer_clock_base base;
+	vector<Periodic> periodic(n);
+	mt19937_64 rng(3);
+	for(Periodic &p : periodic){
+		p.period = NSEC_PER_MSEC + rng() % (99 * NSEC_PER_MSEC);
+		hrtimer_init(&p.timer, &base, tick);
+		hrtimer_start_range_ns(&p.timer, rng() % p.period, slack);
+	}
+
+	uint64_t end = seconds * NSEC_PER_SEC;
+	size_t wakeups = 0, callbacks = 0;
+	Stopwatch watch;
+	for(uint64_t now; (now = hrtimer_next_event(&base)) < end; ++wakeups){
+		callbacks += hrtimer_run_queues(&base, now);
+	}
+	double elapsed = watch.seconds();
+	string label = "expiry, slack " + to_string(slack / 1000) + " us, per callback";
+	report(label.c_str(), callbacks, elapsed);
+	cout << "    " << wakeups << " wakeups for " << callbacks << " callbacks, "
+		<< double(callbacks) / wakeups << " per wakeup" << endl;
+}
+
+int main(int argc, char **argv){
+	size_t n = argcount(argc, argv, 1, 1000000);
+	size_t periodic = argcount(argc, argv, 2, 10000);
+	uint64_t seconds = argcount(argc, argv, 3, 10);
+	if(!n){n = 1;}
+
+	vector<uint64_t> deadlines = randomkeys(n, 1), picks = randomkeys(n, 2);
+	for(uint64_t &deadline : deadlines){deadline %= 10 * NSEC_PER_SEC;}
+	churnhrtimer(deadlines, picks);
+	churnmap(deadlines, picks);
+	cout << endl;
+
+	for(uint64_t slack : {uint64_t(0), uint64_t(50000), uint64_t(1000000)}){expiry(periodic, seconds, slack);}
+	return 0;
+}
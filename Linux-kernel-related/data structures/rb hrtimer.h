@@ -0,0 +1,208 @@
+/*
+   High resolution timer queue
+
+   The kernel keeps the pending hrtimers of a clock in a red black tree
+   ordered by expiry time (kernel/time/hrtimer.c on top of timerqueue),
+   with the earliest one cached so that programming the next clock event
+   never walks the tree. This is that queue on the intrusive tree of
+   rb intrusive.h: the hrtimer embeds its rb_node, so arming, cancelling
+   and re-arming a timer are O(log n) and never allocate, and
+   hrtimer_next_event() is a load of the cached left most node.
+
+       hrtimer_clock_base base;
+       hrtimer timeout;
+       hrtimer_init(&timeout, &base, ontimeout);
+       hrtimer_start(&timeout, now + 5000000);
+       ...
+       hrtimer_run_queues(&base, now);   // on every wakeup
+       program(hrtimer_next_event(&base));
+
+   hrtimer_run_queues() expires in one pass: it takes the due timers off
+   the left end of the tree one after the other, which costs amortized
+   O(1) rebalancing each, and runs their callbacks. A callback returns
+   HRTIMER_RESTART to be queued again, usually after hrtimer_forward()
+   moved its expiry by its period. Callbacks may arm and cancel any timer
+   of the base, including themselves.
+
+   Slack. hrtimer_start_range_ns() gives a timer a window instead of an
+   instant: it may fire anywhere between its soft expiry and the soft
+   expiry plus the slack. The tree is ordered by the hard end of the
+   window, so the next event is programmed for the earliest deadline that
+   must not be missed, and when it comes every timer whose window has
+   opened runs along. Timers a few microseconds apart then share one
+   wakeup instead of taking one each, which is what timer_slack_ns does
+   for sleeping tasks.
+
+   Re-arming a queued timer to a time that keeps its place between its
+   neighbours (a lease renewed, a timeout pushed back a little while
+   others are further out) only rewrites the expiry, without touching the
+   tree. Times are nanoseconds on any monotonic clock; a base and its
+   timers are not thread safe, the kernel has one base per cpu as well.
+*/
+
+#ifndef RB_HRTIMER_H
+#define RB_HRTIMER_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include "rb intrusive.h"
+
+enum hrtimer_restart{HRTIMER_NORESTART, HRTIMER_RESTART};
+
+struct hrtimer_clock_base;
+
+// hrtimer definition, the node is in the tree while the timer is queued
+struct hrtimer{
+	rb_node node;
+	std::uint64_t expires;     // hard expiry, the key of the tree
+	std::uint64_t softexpires; // the timer may run from here on
+	hrtimer_restart (*function)(hrtimer *);
+	hrtimer_clock_base *base;
+};
+
+struct hrtimer_clock_base{
+	rb_root_cached active;
+	std::size_t count = 0;     // queued timers
+	std::uint64_t now = 0;     // the time of the last hrtimer_run_queues()
+	hrtimer *running = nullptr;
+};
+
+const std::uint64_t KTIME_MAX = ~std::uint64_t(0);
+
+// a + b, KTIME_MAX where that would wrap, like the kernel's ktime_add_safe()
+inline std::uint64_t ktime_add_safe(std::uint64_t a, std::uint64_t b){
+	return a + b < a ? KTIME_MAX : a + b;
+}
+
+inline bool hrtimer_is_queued(const hrtimer *timer){
+	return !RB_EMPTY_NODE(&timer->node);
+}
+
+// A timer is active while it is queued or its callback runs
+inline bool hrtimer_active(const hrtimer *timer){
+	return hrtimer_is_queued(timer) || timer->base->running == timer;
+}
+
+// The current time as seen by callbacks
+inline std::uint64_t hrtimer_cb_get_time(const hrtimer *timer){
+	return timer->base->now;
+}
+
+inline bool hrtimer_before(const rb_node *a, const rb_node *b){
+	return rb_entry(a, hrtimer, node)->expires < rb_entry(b, hrtimer, node)->expires;
+}
+
+inline void hrtimer_init(hrtimer *timer, hrtimer_clock_base *base, hrtimer_restart (*function)(hrtimer *)){
+	RB_CLEAR_NODE(&timer->node);
+	timer->expires = timer->softexpires = 0;
+	timer->function = function;
+	timer->base = base;
+}
+
+inline void enqueue_hrtimer(hrtimer *timer){
+	rb_add_cached(&timer->node, &timer->base->active, hrtimer_before);
+	++timer->base->count;
+}
+
+inline void remove_hrtimer(hrtimer *timer){
+	rb_erase_cached(&timer->node, &timer->base->active);
+	RB_CLEAR_NODE(&timer->node);
+	--timer->base->count;
+}
+
+// Arms timer to run between softexpires and softexpires + slack, or
+// moves it there if it is queued already
+inline void hrtimer_start_range_ns(hrtimer *timer, std::uint64_t softexpires, std::uint64_t slack){
+	std::uint64_t expires = ktime_add_safe(softexpires, slack);
+	if(hrtimer_is_queued(timer)){
+		// only the neighbour on the side the expiry moves to can get in
+		// the way. Equal expiries queue in arming order, so the timer must
+		// stay behind the previous node and strictly before the next
+		bool keepsplace;
+		if(timer->expires <= expires){
+			const rb_node *next = rb_next(&timer->node);
+			keepsplace = !next || expires < rb_entry(next, hrtimer, node)->expires;
+		}
+		else{
+			const rb_node *prev = rb_prev(&timer->node);
+			keepsplace = !prev || rb_entry(prev, hrtimer, node)->expires <= expires;
+		}
+		if(keepsplace){
+			timer->expires = expires;
+			timer->softexpires = softexpires;
+			return;
+		}
+		remove_hrtimer(timer);
+	}
+	timer->expires = expires;
+	timer->softexpires = softexpires;
+	enqueue_hrtimer(timer);
+}
+
+inline void hrtimer_start(hrtimer *timer, std::uint64_t expires){
+	hrtimer_start_range_ns(timer, expires, 0);
+}
+
+// Takes timer off the queue. Returns whether it was queued
+inline bool hrtimer_cancel(hrtimer *timer){
+	if(!hrtimer_is_queued(timer)){
+		return false;
+	}
+	remove_hrtimer(timer);
+	return true;
+}
+
+// Moves the expiry of a timer that is not queued forward by whole
+// intervals until its window opens after now and returns how many
+// intervals that took, the overruns. The window is what counts: a timer
+// that ran early within its slack must still move, or it would be due
+// again at once. Both ends stop at KTIME_MAX instead of wrapping around
+// to the past, an expires that a huge slack saturated stays there
+inline std::uint64_t hrtimer_forward(hrtimer *timer, std::uint64_t now, std::uint64_t interval){
+	if(now < timer->softexpires || !interval){
+		return 0;
+	}
+	std::uint64_t overruns = (now - timer->softexpires) / interval + 1;
+	std::uint64_t delta = overruns > KTIME_MAX / interval ? KTIME_MAX : overruns * interval;
+	timer->expires = ktime_add_safe(timer->expires, delta);
+	timer->softexpires = ktime_add_safe(timer->softexpires, delta);
+	return overruns;
+}
+
+inline std::uint64_t hrtimer_forward_now(hrtimer *timer, std::uint64_t interval){
+	return hrtimer_forward(timer, hrtimer_cb_get_time(timer), interval);
+}
+
+// The earliest hard expiry, when the clock event has to fire next,
+// KTIME_MAX if no timer is queued. O(1)
+inline std::uint64_t hrtimer_next_event(const hrtimer_clock_base *base){
+	const rb_node *first = rb_first_cached(&base->active);
+	return first ? rb_entry(first, hrtimer, node)->expires : KTIME_MAX;
+}
+
+// Runs the callback of every timer whose window has opened at now, in
+// order of their hard expiry. Like the kernel it stops at the first timer
+// that may not run yet, even if a timer with a later deadline but more
+// slack could. A timer restarted without moving past now runs again in
+// the same pass. Returns the number of callbacks run
+inline std::size_t hrtimer_run_queues(hrtimer_clock_base *base, std::uint64_t now){
+	base->now = now;
+	std::size_t expired = 0;
+	while(rb_node *first = rb_first_cached(&base->active)){
+		hrtimer *timer = rb_entry(first, hrtimer, node);
+		if(now < timer->softexpires){
+			break;
+		}
+		remove_hrtimer(timer);
+		base->running = timer;
+		hrtimer_restart restart = timer->function(timer);
+		base->running = nullptr;
+		// the callback may have armed the timer itself already
+		if(restart == HRTIMER_RESTART && !hrtimer_is_queued(timer)){enqueue_hrtimer(timer);}
+		++expired;
+	}
+	return expired;
+}
+
+#endif
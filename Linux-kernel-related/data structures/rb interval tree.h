@@ -0,0 +1,154 @@
+/*
+   Interval tree
+
+   A port of the kernel's include/linux/interval_tree_generic.h. Closed
+   intervals [start, last] are kept ordered by start in an augmented tree
+   (rb augmented.h) whose nodes also know the largest last of their
+   subtree. A subtree whose largest last is before the query cannot hold
+   an overlapping interval and is skipped, so finding the first overlap
+   costs O(log n) and every further one O(log n) at most, O(log n + k)
+   for k overlaps in all. The matches come in order of their start.
+
+       struct Window{
+           interval_tree_node<uint64_t> it;
+           Payload payload;
+       };
+
+       rb_root_cached tree;
+       interval_tree_insert(&window->it, &tree);
+       for(auto *it = interval_tree_iter_first(&tree, from, to); it;
+           it = interval_tree_iter_next(it, from, to)){
+           use(rb_entry(it, Window, it));
+       }
+*/
+
+#ifndef RB_INTERVAL_TREE_H
+#define RB_INTERVAL_TREE_H
+
+#include "rb augmented.h"
+
+template<typename T>
+struct interval_tree_node{
+	rb_node rb;
+	T start;
+	T last;
+	T subtree_last;
+};
+
+template<typename T>
+inline T interval_tree_last(const interval_tree_node<T> *node){return node->last;}
+
+template<typename T>
+struct interval_tree_callbacks{
+	RB_DECLARE_CALLBACKS_MAX(augment, interval_tree_node<T>, rb, T, subtree_last, interval_tree_last)
+};
+
+template<typename T>
+inline interval_tree_node<T> *interval_tree_entry(rb_node *rb){
+	return rb_entry(rb, interval_tree_node<T>, rb);
+}
+
+template<typename T>
+inline void interval_tree_insert(interval_tree_node<T> *node, rb_root_cached *root){
+	rb_node **link = &root->rb_root.node, *rb_parent = nullptr;
+	T start = node->start, last = node->last;
+	bool leftmost = true;
+	while(*link){
+		rb_parent = *link;
+		interval_tree_node<T> *parent = interval_tree_entry<T>(rb_parent);
+		if(parent->subtree_last < last){parent->subtree_last = last;}
+		if(start < parent->start){
+			link = &parent->rb.rb_left;
+		}
+		else{
+			link = &parent->rb.rb_right;
+			leftmost = false;
+		}
+	}
+	node->subtree_last = last;
+	rb_link_node(&node->rb, rb_parent, link);
+	rb_insert_augmented_cached<typename interval_tree_callbacks<T>::augment>(&node->rb, root, leftmost);
+}
+
+template<typename T>
+inline void interval_tree_remove(interval_tree_node<T> *node, rb_root_cached *root){
+	rb_erase_augmented_cached<typename interval_tree_callbacks<T>::augment>(&node->rb, root);
+}
+
+// The left most interval below node that overlaps [start, last]. The
+// caller guarantees node->subtree_last >= start
+template<typename T>
+inline interval_tree_node<T> *interval_tree_subtree_search(interval_tree_node<T> *node, T start, T last){
+	while(true){
+		if(node->rb.rb_left){
+			interval_tree_node<T> *left = interval_tree_entry<T>(node->rb.rb_left);
+			if(start <= left->subtree_last){
+				// some interval on the left ends at or after start, and
+				// being on the left it starts before node, so if any
+				// interval overlaps, one on the left does
+				node = left;
+				continue;
+			}
+		}
+		if(node->start <= last){
+			if(start <= node->last){
+				return node;
+			}
+			if(node->rb.rb_right){
+				node = interval_tree_entry<T>(node->rb.rb_right);
+				if(start <= node->subtree_last){continue;}
+			}
+		}
+		return nullptr;
+	}
+}
+
+// The first interval overlapping [start, last], nullptr if none does
+template<typename T>
+inline interval_tree_node<T> *interval_tree_iter_first(const rb_root_cached *root, T start, T last){
+	if(!root->rb_root.node){
+		return nullptr;
+	}
+	interval_tree_node<T> *node = interval_tree_entry<T>(root->rb_root.node);
+	if(node->subtree_last < start){
+		return nullptr;
+	}
+	if(last < interval_tree_entry<T>(root->rb_leftmost)->start){
+		return nullptr;
+	}
+	return interval_tree_subtree_search(node, start, last);
+}
+
+// The next interval after node overlapping [start, last]
+template<typename T>
+inline interval_tree_node<T> *interval_tree_iter_next(interval_tree_node<T> *node, T start, T last){
+	rb_node *rb = node->rb.rb_right, *prev;
+	while(true){
+		// node->start <= last and rb is node's right child
+		if(rb){
+			interval_tree_node<T> *right = interval_tree_entry<T>(rb);
+			if(start <= right->subtree_last){
+				return interval_tree_subtree_search(right, start, last);
+			}
+		}
+		// up until coming from a left child
+		do{
+			rb = rb_parent(&node->rb);
+			if(!rb){
+				return nullptr;
+			}
+			prev = &node->rb;
+			node = interval_tree_entry<T>(rb);
+			rb = node->rb.rb_right;
+		}while(prev == rb);
+
+		if(last < node->start){
+			return nullptr;
+		}
+		if(start <= node->last){
+			return node;
+		}
+	}
+}
+
+#endif
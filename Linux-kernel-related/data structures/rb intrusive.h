@@ -0,0 +1,578 @@
+/*
+   Intrusive red black tree
+
+   The kernel does not allocate tree nodes at all. The rb_node is a member
+   of the object that is kept in the tree (the sched_entity of a task in the
+   cfs scheduler), the tree only links those embedded nodes together and
+   rb_entry() gets from an rb_node back to the object around it. This is the
+   same scheme, following include/linux/rbtree.h and lib/rbtree.c.
+
+   An rb_node is three words. The parent pointer and the color share the
+   first word: nodes are at least 4-byte aligned, so the low bit of the
+   parent address is always zero and holds the color instead (0 = red,
+   1 = black). Nothing is stored in the node except the links, the key lives
+   in the user's struct and the caller provides the ordering, so insertion
+   and erasure never allocate and a lookup reads the key right next to the
+   links it just followed.
+
+       struct Entity{
+           uint64_t vruntime;
+           rb_node node;
+       };
+
+       rb_root tree;
+       rb_add(&entity->node, &tree, [](const rb_node *a, const rb_node *b){
+           return rb_entry(a, Entity, node)->vruntime < rb_entry(b, Entity, node)->vruntime;
+       });
+       rb_erase(&entity->node, &tree);
+
+   The ordering callbacks are template parameters, so they are inlined into
+   the descent loops.
+
+   Stores to the child links go through RB_WRITE_ONCE() and follow the
+   kernel's order, so a lockless reader that walks the tree while it is
+   being changed may miss a node but never runs into a loop (the latched
+   tree in rb latched.h relies on this). On x86 these are plain stores.
+
+   rb_root_cached also keeps a pointer to the left most node, like the
+   kernel's tasks_timeline, so getting the minimum is a load instead of a
+   walk down the left spine. Use the *_cached functions on it.
+*/
+
+#ifndef RB_INTRUSIVE_H
+#define RB_INTRUSIVE_H
+
+#include <cstddef>
+#include <cstdint>
+
+// rb_node definition, parent pointer and color packed into one word
+struct alignas(sizeof(void *)) rb_node{
+	std::uintptr_t rb_parent_color;
+	rb_node *rb_right;
+	rb_node *rb_left;
+};
+
+static_assert(sizeof(rb_node) == 3 * sizeof(void *), "rb_node must be three words");
+
+struct rb_root{
+	rb_node *node = nullptr;
+};
+
+// rb_root with the left most node cached
+struct rb_root_cached{
+	struct rb_root rb_root;
+	rb_node *rb_leftmost = nullptr;
+};
+
+enum{RB_RED = 0, RB_BLACK = 1};
+
+// Gets the struct that embeds the member pointed by ptr. The C style
+// casts let it take const pointers too, like the kernel macro
+#define container_of(ptr, type, member) \
+	((type *)((char *)(ptr) - offsetof(type, member)))
+
+#define rb_entry(ptr, type, member) container_of(ptr, type, member)
+
+#define rb_entry_safe(ptr, type, member) \
+	((ptr) ? rb_entry(ptr, type, member) : nullptr)
+
+// Single copy atomic accesses of the links, the kernel's WRITE_ONCE()
+// and READ_ONCE(). The kernel relies on the address dependency of the
+// reader's loads to see a node initialized, C++ needs release and acquire
+// for that. On x86 both are still plain moves
+#define RB_WRITE_ONCE(x, value) __atomic_store_n(&(x), (value), __ATOMIC_RELEASE)
+#define RB_READ_ONCE(x) __atomic_load_n(&(x), __ATOMIC_ACQUIRE)
+
+inline rb_node *rb_pc_parent(std::uintptr_t pc){
+	return reinterpret_cast<rb_node *>(pc & ~std::uintptr_t(3));
+}
+
+inline rb_node *rb_parent(const rb_node *node){
+	return rb_pc_parent(node->rb_parent_color);
+}
+
+inline bool rb_pc_is_black(std::uintptr_t pc){return pc & 1;}
+inline bool rb_is_black(const rb_node *node){return rb_pc_is_black(node->rb_parent_color);}
+inline bool rb_is_red(const rb_node *node){return !rb_is_black(node);}
+
+inline void rb_set_parent(rb_node *node, rb_node *parent){
+	node->rb_parent_color = rb_is_black(node) | reinterpret_cast<std::uintptr_t>(parent);
+}
+
+inline void rb_set_parent_color(rb_node *node, rb_node *parent, int color){
+	node->rb_parent_color = reinterpret_cast<std::uintptr_t>(parent) | color;
+}
+
+inline void rb_set_black(rb_node *node){node->rb_parent_color |= RB_BLACK;}
+
+inline bool RB_EMPTY_ROOT(const rb_root *root){return root->node == nullptr;}
+
+// A node that is not in any tree points to itself
+inline bool RB_EMPTY_NODE(const rb_node *node){
+	return node->rb_parent_color == reinterpret_cast<std::uintptr_t>(node);
+}
+
+inline void RB_CLEAR_NODE(rb_node *node){
+	node->rb_parent_color = reinterpret_cast<std::uintptr_t>(node);
+}
+
+// Points the parent's link (or the root) at new_node instead of old
+inline void rb_change_child(rb_node *old, rb_node *new_node, rb_node *parent, rb_root *root){
+	if(parent){
+		if(parent->rb_left == old){RB_WRITE_ONCE(parent->rb_left, new_node);}
+		else{RB_WRITE_ONCE(parent->rb_right, new_node);}
+	}
+	else{
+		RB_WRITE_ONCE(root->node, new_node);
+	}
+}
+
+// Completes a rotation: new_node takes over old's parent and color and
+// old becomes new_node's child with the given color
+inline void rb_rotate_set_parents(rb_node *old, rb_node *new_node, rb_root *root, int color){
+	rb_node *parent = rb_parent(old);
+	new_node->rb_parent_color = old->rb_parent_color;
+	rb_set_parent_color(old, new_node, color);
+	rb_change_child(old, new_node, parent, root);
+}
+
+// Hangs a new (red) node at the link found by the caller's descent
+inline void rb_link_node(rb_node *node, rb_node *parent, rb_node **rb_link){
+	node->rb_parent_color = reinterpret_cast<std::uintptr_t>(parent);
+	node->rb_left = node->rb_right = nullptr;
+	*rb_link = node;
+}
+
+// rb_link_node() for trees with lockless readers: the node is published
+// with a release store, so a reader that finds it also sees its links
+inline void rb_link_node_rcu(rb_node *node, rb_node *parent, rb_node **rb_link){
+	node->rb_parent_color = reinterpret_cast<std::uintptr_t>(parent);
+	node->rb_left = node->rb_right = nullptr;
+	__atomic_store_n(rb_link, node, __ATOMIC_RELEASE);
+}
+
+// The callbacks of a tree without augmented data (see rb augmented.h),
+// they compile to nothing
+struct rb_dummy_callbacks{
+	static void propagate(rb_node *, rb_node *){}
+	static void copy(rb_node *, rb_node *){}
+	static void rotate(rb_node *, rb_node *){}
+};
+
+// Rebalances the tree after rb_link_node(). Augment::rotate() is told
+// about every rotation
+template<typename Augment = rb_dummy_callbacks>
+inline void rb_insert_color(rb_node *node, rb_root *root){
+	rb_node *parent = rb_parent(node), *gparent, *tmp;
+	while(true){
+		if(!parent){
+			rb_set_parent_color(node, nullptr, RB_BLACK);
+			break;
+		}
+		if(rb_is_black(parent)){
+			break;
+		}
+		gparent = rb_parent(parent);
+		tmp = gparent->rb_right;
+		if(parent != tmp){
+			// parent is the left child of gparent
+			if(tmp && rb_is_red(tmp)){
+				// red uncle, recolor and continue from the grand parent
+				rb_set_parent_color(tmp, gparent, RB_BLACK);
+				rb_set_parent_color(parent, gparent, RB_BLACK);
+				node = gparent;
+				parent = rb_parent(node);
+				rb_set_parent_color(node, parent, RB_RED);
+				continue;
+			}
+			tmp = parent->rb_right;
+			if(node == tmp){
+				// left rotate at parent
+				tmp = node->rb_left;
+				RB_WRITE_ONCE(parent->rb_right, tmp);
+				RB_WRITE_ONCE(node->rb_left, parent);
+				if(tmp){rb_set_parent_color(tmp, parent, RB_BLACK);}
+				rb_set_parent_color(parent, node, RB_RED);
+				Augment::rotate(parent, node);
+				parent = node;
+				tmp = node->rb_right;
+			}
+			// right rotate at gparent
+			RB_WRITE_ONCE(gparent->rb_left, tmp);
+			RB_WRITE_ONCE(parent->rb_right, gparent);
+			if(tmp){rb_set_parent_color(tmp, gparent, RB_BLACK);}
+			rb_rotate_set_parents(gparent, parent, root, RB_RED);
+			Augment::rotate(gparent, parent);
+			break;
+		}
+		else{
+			// parent is the right child of gparent
+			tmp = gparent->rb_left;
+			if(tmp && rb_is_red(tmp)){
+				rb_set_parent_color(tmp, gparent, RB_BLACK);
+				rb_set_parent_color(parent, gparent, RB_BLACK);
+				node = gparent;
+				parent = rb_parent(node);
+				rb_set_parent_color(node, parent, RB_RED);
+				continue;
+			}
+			tmp = parent->rb_left;
+			if(node == tmp){
+				// right rotate at parent
+				tmp = node->rb_right;
+				RB_WRITE_ONCE(parent->rb_left, tmp);
+				RB_WRITE_ONCE(node->rb_right, parent);
+				if(tmp){rb_set_parent_color(tmp, parent, RB_BLACK);}
+				rb_set_parent_color(parent, node, RB_RED);
+				Augment::rotate(parent, node);
+				parent = node;
+				tmp = node->rb_left;
+			}
+			// left rotate at gparent
+			RB_WRITE_ONCE(gparent->rb_right, tmp);
+			RB_WRITE_ONCE(parent->rb_left, gparent);
+			if(tmp){rb_set_parent_color(tmp, gparent, RB_BLACK);}
+			rb_rotate_set_parents(gparent, parent, root, RB_RED);
+			Augment::rotate(gparent, parent);
+			break;
+		}
+	}
+}
+
+// Rebalances the tree after a black leaf was taken out below parent
+template<typename Augment = rb_dummy_callbacks>
+inline void rb_erase_color(rb_node *parent, rb_root *root){
+	rb_node *node = nullptr, *sibling, *tmp1, *tmp2;
+	while(true){
+		sibling = parent->rb_right;
+		if(node != sibling){
+			// node is the left child of parent
+			if(rb_is_red(sibling)){
+				// left rotate at parent
+				tmp1 = sibling->rb_left;
+				RB_WRITE_ONCE(parent->rb_right, tmp1);
+				RB_WRITE_ONCE(sibling->rb_left, parent);
+				rb_set_parent_color(tmp1, parent, RB_BLACK);
+				rb_rotate_set_parents(parent, sibling, root, RB_RED);
+				Augment::rotate(parent, sibling);
+				sibling = tmp1;
+			}
+			tmp1 = sibling->rb_right;
+			if(!tmp1 || rb_is_black(tmp1)){
+				tmp2 = sibling->rb_left;
+				if(!tmp2 || rb_is_black(tmp2)){
+					// black sibling with black children, recolor and
+					// move the missing black up if parent is black too
+					rb_set_parent_color(sibling, parent, RB_RED);
+					if(rb_is_red(parent)){
+						rb_set_black(parent);
+					}
+					else{
+						node = parent;
+						parent = rb_parent(node);
+						if(parent){continue;}
+					}
+					break;
+				}
+				// right rotate at sibling
+				tmp1 = tmp2->rb_right;
+				RB_WRITE_ONCE(sibling->rb_left, tmp1);
+				RB_WRITE_ONCE(tmp2->rb_right, sibling);
+				RB_WRITE_ONCE(parent->rb_right, tmp2);
+				if(tmp1){rb_set_parent_color(tmp1, sibling, RB_BLACK);}
+				Augment::rotate(sibling, tmp2);
+				tmp1 = sibling;
+				sibling = tmp2;
+			}
+			// left rotate at parent
+			tmp2 = sibling->rb_left;
+			RB_WRITE_ONCE(parent->rb_right, tmp2);
+			RB_WRITE_ONCE(sibling->rb_left, parent);
+			rb_set_parent_color(tmp1, sibling, RB_BLACK);
+			if(tmp2){rb_set_parent(tmp2, parent);}
+			rb_rotate_set_parents(parent, sibling, root, RB_BLACK);
+			Augment::rotate(parent, sibling);
+			break;
+		}
+		else{
+			// node is the right child of parent
+			sibling = parent->rb_left;
+			if(rb_is_red(sibling)){
+				// right rotate at parent
+				tmp1 = sibling->rb_right;
+				RB_WRITE_ONCE(parent->rb_left, tmp1);
+				RB_WRITE_ONCE(sibling->rb_right, parent);
+				rb_set_parent_color(tmp1, parent, RB_BLACK);
+				rb_rotate_set_parents(parent, sibling, root, RB_RED);
+				Augment::rotate(parent, sibling);
+				sibling = tmp1;
+			}
+			tmp1 = sibling->rb_left;
+			if(!tmp1 || rb_is_black(tmp1)){
+				tmp2 = sibling->rb_right;
+				if(!tmp2 || rb_is_black(tmp2)){
+					rb_set_parent_color(sibling, parent, RB_RED);
+					if(rb_is_red(parent)){
+						rb_set_black(parent);
+					}
+					else{
+						node = parent;
+						parent = rb_parent(node);
+						if(parent){continue;}
+					}
+					break;
+				}
+				// left rotate at sibling
+				tmp1 = tmp2->rb_left;
+				RB_WRITE_ONCE(sibling->rb_right, tmp1);
+				RB_WRITE_ONCE(tmp2->rb_left, sibling);
+				RB_WRITE_ONCE(parent->rb_left, tmp2);
+				if(tmp1){rb_set_parent_color(tmp1, sibling, RB_BLACK);}
+				Augment::rotate(sibling, tmp2);
+				tmp1 = sibling;
+				sibling = tmp2;
+			}
+			// right rotate at parent
+			tmp2 = sibling->rb_right;
+			RB_WRITE_ONCE(parent->rb_left, tmp2);
+			RB_WRITE_ONCE(sibling->rb_right, parent);
+			rb_set_parent_color(tmp1, sibling, RB_BLACK);
+			if(tmp2){rb_set_parent(tmp2, parent);}
+			rb_rotate_set_parents(parent, sibling, root, RB_BLACK);
+			Augment::rotate(parent, sibling);
+			break;
+		}
+	}
+}
+
+// Unlinks node and returns the node below which a black leaf went
+// missing (nullptr if no rebalancing is needed). The augmented data is
+// copied to the successor that takes node's place and propagated up
+// from where a node went missing
+template<typename Augment = rb_dummy_callbacks>
+inline rb_node *rb_erase_unlink(rb_node *node, rb_root *root){
+	rb_node *child = node->rb_right, *tmp = node->rb_left;
+	rb_node *parent, *rebalance;
+	std::uintptr_t pc;
+	if(!tmp){
+		// no left child, the right child (if any) takes node's place
+		pc = node->rb_parent_color;
+		parent = rb_pc_parent(pc);
+		rb_change_child(node, child, parent, root);
+		if(child){
+			child->rb_parent_color = pc;
+			rebalance = nullptr;
+		}
+		else{
+			rebalance = rb_pc_is_black(pc) ? parent : nullptr;
+		}
+		tmp = parent;
+	}
+	else if(!child){
+		// only a left child, which must be a red leaf
+		tmp->rb_parent_color = pc = node->rb_parent_color;
+		parent = rb_pc_parent(pc);
+		rb_change_child(node, tmp, parent, root);
+		rebalance = nullptr;
+		tmp = parent;
+	}
+	else{
+		// two children, the in-order successor takes node's place
+		rb_node *successor = child, *child2;
+		tmp = child->rb_left;
+		if(!tmp){
+			parent = successor;
+			child2 = successor->rb_right;
+			Augment::copy(node, successor);
+		}
+		else{
+			do{
+				parent = successor;
+				successor = tmp;
+				tmp = tmp->rb_left;
+			}while(tmp);
+			child2 = successor->rb_right;
+			RB_WRITE_ONCE(parent->rb_left, child2);
+			RB_WRITE_ONCE(successor->rb_right, child);
+			rb_set_parent(child, successor);
+			Augment::copy(node, successor);
+			Augment::propagate(parent, successor);
+		}
+		tmp = node->rb_left;
+		RB_WRITE_ONCE(successor->rb_left, tmp);
+		rb_set_parent(tmp, successor);
+		pc = node->rb_parent_color;
+		rb_change_child(node, successor, rb_pc_parent(pc), root);
+		if(child2){
+			successor->rb_parent_color = pc;
+			rb_set_parent_color(child2, parent, RB_BLACK);
+			rebalance = nullptr;
+		}
+		else{
+			std::uintptr_t pc2 = successor->rb_parent_color;
+			successor->rb_parent_color = pc;
+			rebalance = rb_pc_is_black(pc2) ? parent : nullptr;
+		}
+		tmp = successor;
+	}
+	Augment::propagate(tmp, nullptr);
+	return rebalance;
+}
+
+// Removes node from the tree, the node itself is left to the caller
+inline void rb_erase(rb_node *node, rb_root *root){
+	if(rb_node *rebalance = rb_erase_unlink(node, root)){
+		rb_erase_color(rebalance, root);
+	}
+}
+
+// Puts new_node in the place of victim without rebalancing. The caller
+// guarantees that new_node sorts in the same position
+inline void rb_replace_node(rb_node *victim, rb_node *new_node, rb_root *root){
+	rb_node *parent = rb_parent(victim);
+	*new_node = *victim;
+	if(victim->rb_left){rb_set_parent(victim->rb_left, new_node);}
+	if(victim->rb_right){rb_set_parent(victim->rb_right, new_node);}
+	rb_change_child(victim, new_node, parent, root);
+}
+
+// Gets the left most node (minimum) of the tree
+inline rb_node *rb_first(const rb_root *root){
+	rb_node *node = root->node;
+	if(!node){return nullptr;}
+	while(node->rb_left){node = node->rb_left;}
+	return node;
+}
+
+// Gets the right most node (maximum) of the tree
+inline rb_node *rb_last(const rb_root *root){
+	rb_node *node = root->node;
+	if(!node){return nullptr;}
+	while(node->rb_right){node = node->rb_right;}
+	return node;
+}
+
+// Gets the in-order successor of node
+inline rb_node *rb_next(const rb_node *node){
+	if(node->rb_right){
+		node = node->rb_right;
+		while(node->rb_left){node = node->rb_left;}
+		return const_cast<rb_node *>(node);
+	}
+	rb_node *parent;
+	while((parent = rb_parent(node)) && node == parent->rb_right){node = parent;}
+	return parent;
+}
+
+// Gets the in-order predecessor of node
+inline rb_node *rb_prev(const rb_node *node){
+	if(node->rb_left){
+		node = node->rb_left;
+		while(node->rb_right){node = node->rb_right;}
+		return const_cast<rb_node *>(node);
+	}
+	rb_node *parent;
+	while((parent = rb_parent(node)) && node == parent->rb_left){node = parent;}
+	return parent;
+}
+
+// Inserts node into the tree. less(a, b) orders two nodes, equal nodes
+// go to the right of the existing ones
+template<typename Less>
+inline void rb_add(rb_node *node, rb_root *tree, Less less){
+	rb_node **link = &tree->node, *parent = nullptr;
+	while(*link){
+		parent = *link;
+		if(less(node, parent)){link = &parent->rb_left;}
+		else{link = &parent->rb_right;}
+	}
+	rb_link_node(node, parent, link);
+	rb_insert_color(node, tree);
+}
+
+// Inserts node unless an equal node is already in the tree, in which
+// case that node is returned. cmp(a, b) returns <0, 0 or >0
+template<typename Cmp>
+inline rb_node *rb_find_add(rb_node *node, rb_root *tree, Cmp cmp){
+	rb_node **link = &tree->node, *parent = nullptr;
+	while(*link){
+		parent = *link;
+		int c = cmp(node, parent);
+		if(c < 0){link = &parent->rb_left;}
+		else if(c > 0){link = &parent->rb_right;}
+		else{return parent;}
+	}
+	rb_link_node(node, parent, link);
+	rb_insert_color(node, tree);
+	return nullptr;
+}
+
+// Finds a node matching key. cmp(key, node) returns <0, 0 or >0
+template<typename Key, typename Cmp>
+inline rb_node *rb_find(const Key &key, const rb_root *tree, Cmp cmp){
+	rb_node *node = tree->node;
+	while(node){
+		int c = cmp(key, node);
+		if(c < 0){node = node->rb_left;}
+		else if(c > 0){node = node->rb_right;}
+		else{return node;}
+	}
+	return nullptr;
+}
+
+// Finds the left most node matching key
+template<typename Key, typename Cmp>
+inline rb_node *rb_find_first(const Key &key, const rb_root *tree, Cmp cmp){
+	rb_node *node = tree->node, *match = nullptr;
+	while(node){
+		int c = cmp(key, node);
+		if(c <= 0){
+			if(!c){match = node;}
+			node = node->rb_left;
+		}
+		else{
+			node = node->rb_right;
+		}
+	}
+	return match;
+}
+
+// Gets the left most node in O(1)
+inline rb_node *rb_first_cached(const rb_root_cached *root){
+	return root->rb_leftmost;
+}
+
+// Rebalances after rb_link_node(), leftmost tells whether the descent
+// went only left, in which case node is the new minimum
+inline void rb_insert_color_cached(rb_node *node, rb_root_cached *root, bool leftmost){
+	if(leftmost){root->rb_leftmost = node;}
+	rb_insert_color(node, &root->rb_root);
+}
+
+inline void rb_erase_cached(rb_node *node, rb_root_cached *root){
+	if(root->rb_leftmost == node){root->rb_leftmost = rb_next(node);}
+	rb_erase(node, &root->rb_root);
+}
+
+// rb_add() that keeps the left most node cached. Returns whether node
+// became the new left most node
+template<typename Less>
+inline bool rb_add_cached(rb_node *node, rb_root_cached *tree, Less less){
+	rb_node **link = &tree->rb_root.node, *parent = nullptr;
+	bool leftmost = true;
+	while(*link){
+		parent = *link;
+		if(less(node, parent)){
+			link = &parent->rb_left;
+		}
+		else{
+			link = &parent->rb_right;
+			leftmost = false;
+		}
+	}
+	rb_link_node(node, parent, link);
+	rb_insert_color_cached(node, tree, leftmost);
+	return leftmost;
+}
+
+#endif
@@ -0,0 +1,76 @@
+/*
+   Latched tree read scaling benchmark
+
+   One writer thread erases and reinserts random keys as fast as it can
+   while 1, 2, 4 ... reader threads look up random keys. The latched tree,
+   whose readers never lock, against an RbTree with a global mutex around
+   every lookup and every change.
+
+   arguments: keys, maximum readers, milliseconds per run
+
+   g++ -O2 -std=c++17 -pthread "rb latched bench.cpp" && ./a.out 1000000 64 1000
+*/
+
+#include <iostream>
+#include <thread>
+
+#include "benchmark.h"
+#include "rb latched.h"
+#include "red black tree.h"
+
+using namespace std;
+
+template<typename Tree>
+void run(const char *name, size_t n, unsigned readers, unsigned milliseconds){
+	Tree tree;
+	for(uint64_t key : randomkeys(n)){tree.insert(key, key);}
+
+	atomic<bool> stop{false};
+	atomic<uint64_t> lookups{0}, hits{0};
+	uint64_t writes = 0;
+
+	vector<thread> threads;
+	for(unsigned i = 0; i < readers; ++i){
+		threads.emplace_back([&, i]{
+			mt19937_64 rng(i + 1);
+			uint64_t done = 0, found = 0, value;
+			while(!stop.load(memory_order_relaxed)){
+				for(int j = 0; j < 64; ++j){found += tree.find(rng() % n, value);}
+				done += 64;
+			}
+			lookups += done;
+			hits += found;
+		});
+	}
+	threads.emplace_back([&]{
+		mt19937_64 rng(0);
+		while(!stop.load(memory_order_relaxed)){
+			uint64_t key = rng() % n;
+			tree.erase(key);
+			tree.insert(key, key);
+			writes += 2;
+		}
+	});
+
+	this_thread::sleep_for(chrono::milliseconds(milliseconds));
+	stop = true;
+	for(thread &t : threads){t.join();}
+
+	double seconds = milliseconds / 1000.0;
+	printf("%-8s %3u readers %12.0f lookups/s %12.0f lookups/s/reader %10.0f writes/s  hits %.3f\n",
+		name, readers, lookups / seconds, lookups / seconds / readers, writes / seconds,
+		lookups ? double(hits) / lookups : 0.0);
+}
+
+int main(int argc, char **argv){
+	size_t n = argcount(argc, argv, 1, 1000000);
+	unsigned maxreaders = argcount(argc, argv, 2, 64);
+	unsigned milliseconds = argcount(argc, argv, 3, 1000);
+
+	for(unsigned readers = 1; readers <= maxreaders; readers *= 2){
+		run<MutexTree>("mutex", n, readers, milliseconds);
+		run<LatchedRbTree<uint64_t, uint64_t>>("latched", n, readers, milliseconds);
+	}
+
+	return 0;
+}
@@ -0,0 +1,210 @@
+/*
+   Latched red black tree
+
+   One writer and many readers. Putting a mutex around every lookup makes
+   the readers wait for each other, and a reader cannot walk a tree that is
+   being rotated under it. The kernel solves this with the latch tree
+   (include/linux/rbtree_latch.h): every element is linked into two copies
+   of the tree and a sequence counter (the latch) tells the readers which
+   copy is stable. The writer bumps the counter, so readers move over to
+   copy 1, changes copy 0, bumps the counter again, so readers move back to
+   copy 0, and changes copy 1. A reader that races with a change of the copy
+   it is in notices it from the counter and retries. Readers never lock and
+   never write shared memory, and the writer never waits for a reader.
+
+   A reader in the copy that is being changed may still see a half done
+   rotation. The intrusive tree stores its links with RB_WRITE_ONCE() in the
+   kernel's order, so such a reader can miss nodes but never loops, and
+   new nodes are published with a release store. Erased elements are freed
+   through the epoch reclamation in epoch.h, so a reader never touches
+   freed memory.
+
+   latch_tree_insert/erase/find are the kernel interface on intrusive
+   latch_tree_nodes, LatchedRbTree<Key, Value> is a map built on it.
+*/
+
+#ifndef RB_LATCHED_H
+#define RB_LATCHED_H
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+
+#include "epoch.h"
+#include "rb intrusive.h"
+
+// Element links for both copies of the tree
+struct latch_tree_node{
+	rb_node node[2];
+};
+
+struct latch_tree_root{
+	std::atomic<unsigned> seq{0};
+	rb_root tree[2];
+};
+
+inline latch_tree_node *lt_from_rb(rb_node *node, int idx){
+	return reinterpret_cast<latch_tree_node *>(node - idx);
+}
+
+// Moves the readers over to the other copy (raw_write_seqcount_latch)
+inline void latch_tree_flip(latch_tree_root *root){
+	unsigned seq = root->seq.load(std::memory_order_relaxed);
+	root->seq.store(seq + 1, std::memory_order_release);
+	std::atomic_thread_fence(std::memory_order_release);
+}
+
+template<typename Less>
+inline void lt_insert(latch_tree_node *ltn, latch_tree_root *ltr, int idx, Less less){
+	rb_root *root = &ltr->tree[idx];
+	rb_node **link = &root->node, *parent = nullptr;
+	rb_node *node = &ltn->node[idx];
+	while(*link){
+		parent = *link;
+		if(less(ltn, lt_from_rb(parent, idx))){link = &parent->rb_left;}
+		else{link = &parent->rb_right;}
+	}
+	rb_link_node_rcu(node, parent, link);
+	rb_insert_color(node, root);
+}
+
+// Inserts node into both copies. Writers must be serialized by the caller
+template<typename Less>
+inline void latch_tree_insert(latch_tree_node *node, latch_tree_root *root, Less less){
+	latch_tree_flip(root);
+	lt_insert(node, root, 0, less);
+	latch_tree_flip(root);
+	lt_insert(node, root, 1, less);
+}
+
+// Removes node from both copies. The node may only be freed once the
+// readers are done with it (Epoch::retire)
+inline void latch_tree_erase(latch_tree_node *node, latch_tree_root *root){
+	latch_tree_flip(root);
+	rb_erase(&node->node[0], &root->tree[0]);
+	latch_tree_flip(root);
+	rb_erase(&node->node[1], &root->tree[1]);
+}
+
+template<typename Key, typename Cmp>
+inline latch_tree_node *lt_find(const Key &key, latch_tree_root *ltr, int idx, Cmp comp){
+	rb_node *node = RB_READ_ONCE(ltr->tree[idx].node);
+	while(node){
+		latch_tree_node *ltn = lt_from_rb(node, idx);
+		int c = comp(key, ltn);
+		if(c < 0){node = RB_READ_ONCE(node->rb_left);}
+		else if(c > 0){node = RB_READ_ONCE(node->rb_right);}
+		else{return ltn;}
+	}
+	return nullptr;
+}
+
+// Lockless lookup, retries when the copy it used changed meanwhile. The
+// caller must be inside an Epoch::Guard while it uses the result.
+// comp(key, node) returns <0, 0 or >0
+template<typename Key, typename Cmp>
+inline latch_tree_node *latch_tree_find(const Key &key, latch_tree_root *root, Cmp comp){
+	latch_tree_node *node;
+	unsigned seq;
+	do{
+		seq = root->seq.load(std::memory_order_acquire);
+		node = lt_find(key, root, seq & 1, comp);
+		std::atomic_thread_fence(std::memory_order_acquire);
+	}while(root->seq.load(std::memory_order_relaxed) != seq);
+	return node;
+}
+
+// Map with lock free lookups and serialized writers. Keys are unique and
+// the value of an element never changes after insertion, a new value
+// means erase and insert
+template<typename Key, typename Value, typename Compare = std::less<Key>>
+class LatchedRbTree{
+public:
+	LatchedRbTree() = default;
+	LatchedRbTree(const LatchedRbTree &) = delete;
+	LatchedRbTree &operator=(const LatchedRbTree &) = delete;
+
+	// No reader may be running any more
+	~LatchedRbTree(){
+		Epoch::synchronize();
+		while(rb_node *node = root.tree[0].node){
+			Element *element = fromnode(lt_from_rb(node, 0));
+			rb_erase(&element->node.node[0], &root.tree[0]);
+			delete element;
+		}
+	}
+
+	// Writer side. Returns false if the key is already there
+	bool insert(const Key &key, const Value &value){
+		std::lock_guard<std::mutex> lock(writer);
+		if(findlocked(key)){
+			return false;
+		}
+		Element *element = new Element{latch_tree_node(), key, value};
+		latch_tree_insert(&element->node, &root, [this](latch_tree_node *a, latch_tree_node *b){
+			return comp(fromnode(a)->key, fromnode(b)->key);
+		});
+		++count;
+		return true;
+	}
+
+	// Writer side. Returns false if the key was not there
+	bool erase(const Key &key){
+		std::lock_guard<std::mutex> lock(writer);
+		Element *element = findlocked(key);
+		if(!element){
+			return false;
+		}
+		latch_tree_erase(&element->node, &root);
+		Epoch::retire(element);
+		--count;
+		return true;
+	}
+
+	// Reader side, lock free. Copies the value out of the element
+	bool find(const Key &key, Value &value){
+		Epoch::Guard guard;
+		latch_tree_node *node = latch_tree_find(key, &root, [this](const Key &key, latch_tree_node *node){
+			const Key &other = fromnode(node)->key;
+			return comp(key, other) ? -1 : comp(other, key) ? 1 : 0;
+		});
+		if(!node){
+			return false;
+		}
+		value = fromnode(node)->value;
+		return true;
+	}
+
+	std::size_t size() const{return count;}
+
+private:
+	struct Element{
+		latch_tree_node node;
+		const Key key;
+		const Value value;
+	};
+
+	static Element *fromnode(latch_tree_node *node){
+		return container_of(node, Element, node);
+	}
+
+	// Lookup for the writer, copy 0 is stable while the writer lock is held
+	Element *findlocked(const Key &key){
+		rb_node *node = root.tree[0].node;
+		while(node){
+			Element *element = fromnode(lt_from_rb(node, 0));
+			if(comp(key, element->key)){node = node->rb_left;}
+			else if(comp(element->key, key)){node = node->rb_right;}
+			else{return element;}
+		}
+		return nullptr;
+	}
+
+	std::mutex writer;
+	latch_tree_root root;
+	std::size_t count = 0;
+	Compare comp;
+};
+
+#endif
@@ -0,0 +1,120 @@
+/*
+   Order statistics tree
+
+   An augmented intrusive tree (rb augmented.h) in which every node knows
+   how many nodes its subtree holds. The k-th smallest node and the rank
+   of a key, the number of nodes before it, are then found on one path
+   from the root in O(log n) instead of with an in-order walk.
+
+       struct Sample{
+           uint64_t latency;
+           rb_os_node os;
+       };
+
+       rb_root tree;
+       rb_os_add(&sample->os, &tree, [](const rb_node *a, const rb_node *b){
+           return rb_entry(a, Sample, os.rb)->latency < rb_entry(b, Sample, os.rb)->latency;
+       });
+       rb_os_node *median = rb_os_select(&tree, rb_os_count(&tree) / 2);
+       rb_os_erase(&sample->os, &tree);
+*/
+
+#ifndef RB_ORDER_STATISTICS_H
+#define RB_ORDER_STATISTICS_H
+
+#include <cstddef>
+
+#include "rb augmented.h"
+
+struct rb_os_node{
+	rb_node rb;
+	std::size_t size; // nodes in the subtree
+};
+
+inline std::size_t rb_os_size(const rb_node *rb){
+	return rb ? rb_entry(rb, rb_os_node, rb)->size : 0;
+}
+
+inline bool rb_os_compute(rb_os_node *node, bool exit){
+	std::size_t size = 1 + rb_os_size(node->rb.rb_left) + rb_os_size(node->rb.rb_right);
+	if(exit && node->size == size){return true;}
+	node->size = size;
+	return false;
+}
+
+RB_DECLARE_CALLBACKS(rb_os_callbacks, rb_os_node, rb, size, rb_os_compute)
+
+// Inserts node, counting it in every subtree on its way down. less(a, b)
+// orders two rb_nodes, equal nodes go to the right
+template<typename Less>
+inline void rb_os_add(rb_os_node *node, rb_root *tree, Less less){
+	rb_node **link = &tree->node, *parent = nullptr;
+	while(*link){
+		parent = *link;
+		++rb_entry(parent, rb_os_node, rb)->size;
+		if(less(&node->rb, parent)){link = &parent->rb_left;}
+		else{link = &parent->rb_right;}
+	}
+	node->size = 1;
+	rb_link_node(&node->rb, parent, link);
+	rb_insert_augmented<rb_os_callbacks>(&node->rb, tree);
+}
+
+inline void rb_os_erase(rb_os_node *node, rb_root *tree){
+	rb_erase_augmented<rb_os_callbacks>(&node->rb, tree);
+}
+
+// The number of nodes in the tree, O(1)
+inline std::size_t rb_os_count(const rb_root *tree){
+	return rb_os_size(tree->node);
+}
+
+// The k-th smallest node, counting from 0, nullptr if k >= the count
+inline rb_os_node *rb_os_select(const rb_root *tree, std::size_t k){
+	rb_node *rb = tree->node;
+	while(rb){
+		std::size_t left = rb_os_size(rb->rb_left);
+		if(k < left){
+			rb = rb->rb_left;
+		}
+		else if(k == left){
+			return rb_entry(rb, rb_os_node, rb);
+		}
+		else{
+			k -= left + 1;
+			rb = rb->rb_right;
+		}
+	}
+	return nullptr;
+}
+
+// The number of nodes before node in order
+inline std::size_t rb_os_position(const rb_os_node *node){
+	const rb_node *rb = &node->rb, *parent;
+	std::size_t position = rb_os_size(rb->rb_left);
+	while((parent = rb_parent(rb))){
+		if(rb == parent->rb_right){position += rb_os_size(parent->rb_left) + 1;}
+		rb = parent;
+	}
+	return position;
+}
+
+// The number of nodes less than key, which is the position of the first
+// node not less than it. cmp(key, node) returns <0, 0 or >0
+template<typename Key, typename Cmp>
+inline std::size_t rb_os_rank(const Key &key, const rb_root *tree, Cmp cmp){
+	const rb_node *rb = tree->node;
+	std::size_t rank = 0;
+	while(rb){
+		if(cmp(key, rb) <= 0){
+			rb = rb->rb_left;
+		}
+		else{
+			rank += rb_os_size(rb->rb_left) + 1;
+			rb = rb->rb_right;
+		}
+	}
+	return rank;
+}
+
+#endif
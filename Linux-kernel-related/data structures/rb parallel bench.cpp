@@ -0,0 +1,110 @@
+/*
+   Parallel traversal benchmark
+
+   The periodic whole tree passes of a big index, on the calling thread
+   with the iterators against parallel_for_each() and parallel_reduce()
+   on pools of 1, 2, 4, ... up to the given number of threads:
+
+       sum         the sum of all values
+       histogram   a 64 bucket histogram of the values, one per subtree,
+                   added up by combine
+       validate    checks that the keys are in order, reducing every
+                   subtree to its first and last key and whether it is
+                   sorted, which needs the in-order combine
+       for_each    increments every value in place
+
+   On one thread the pool pays for a fork per 2^10 nodes; with more
+   threads the passes should scale until memory bandwidth runs out.
+
+   arguments: keys, threads
+
+   g++ -O2 -std=c++17 -pthread "rb parallel bench.cpp" && ./a.out 10000000 8
+*/
+
+#include <array>
+#include <iostream>
+#include <string>
+
+#include "benchmark.h"
+#include "red black tree.h"
+
+using namespace std;
+
+using Tree = RbTree<uint64_t, uint64_t>;
+using Node = Tree::Node;
+using Histogram = array<uint64_t, 64>;
+
+// A subtree reduced for validation: its key range and whether it is sorted
+struct Ordered{
+	bool empty, sorted;
+	uint64_t first, last;
+};
+
+Ordered combineordered(const Ordered &a, const Ordered &b){
+	if(a.empty){return b;}
+	if(b.empty){return a;}
+	return Ordered{false, a.sorted && b.sorted && a.last <= b.first, a.first, b.last};
+}
+
+void run(Tree &tree, ThreadPool *pool, const string &name){
+	size_t n = tree.size();
+	Stopwatch watch;
+	uint64_t sum = tree.parallel_reduce(uint64_t(0), [](const Node &rbnode){return rbnode.value;},
+		[](uint64_t a, uint64_t b){return a + b;}, pool);
+	report((name + ", sum").c_str(), n, watch.seconds());
+
+	watch.restart();
+	Histogram histogram = tree.parallel_reduce(Histogram{},
+		[](const Node &rbnode){
+			Histogram one{};
+			one[rbnode.value % 64] = 1;
+			return one;
+		},
+		[](Histogram a, const Histogram &b){
+			for(size_t i = 0; i < a.size(); ++i){a[i] += b[i];}
+			return a;
+		}, pool);
+	report((name + ", histogram").c_str(), n, watch.seconds());
+
+	watch.restart();
+	Ordered ordered = tree.parallel_reduce(Ordered{true, true, 0, 0},
+		[](const Node &rbnode){return Ordered{false, true, rbnode.key, rbnode.key};}, combineordered, pool);
+	report((name + ", validate").c_str(), n, watch.seconds());
+	if(!ordered.sorted){cout << "keys out of order" << endl;}
+
+	watch.restart();
+	tree.parallel_for_each([](Node &rbnode){++rbnode.value;}, pool);
+	report((name + ", for_each").c_str(), n, watch.seconds());
+	donotoptimize(sum);
+	donotoptimize(histogram);
+}
+
+int main(int argc, char **argv){
+	size_t n = argcount(argc, argv, 1, 10000000);
+	unsigned threads = unsigned(argcount(argc, argv, 2, thread::hardware_concurrency()));
+	if(!threads){threads = 1;}
+
+	vector<uint64_t> keys = randomkeys(n);
+	sort(keys.begin(), keys.end());
+	vector<pair<uint64_t, uint64_t>> sorted;
+	sorted.reserve(n);
+	for(uint64_t key : keys){sorted.emplace_back(key, key);}
+	Tree tree;
+	tree.assign_sorted(sorted.begin(), sorted.end());
+
+	Stopwatch watch;
+	uint64_t sum = 0;
+	for(const Node &rbnode : tree){sum += rbnode.value;}
+	report("iterators, sum", n, watch.seconds());
+	donotoptimize(sum);
+
+	run(tree, nullptr, "no pool");
+	for(unsigned t = 1; ; t = t * 2 < threads ? t * 2 : threads){
+		ThreadPool pool(t);
+		run(tree, &pool, to_string(t) + " threads");
+		if(t == threads){
+			break;
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,119 @@
+/*
+   Persistent tree benchmark
+
+   What path copying costs the writer and what it buys the scans. First
+   single threaded: n upserts and n erases on the persistent tree against
+   an RbTree, and taking a snapshot. Then a writer thread upserts random
+   keys for the given time while a scanner walks the whole tree over and
+   over: on a snapshot of the persistent tree, against an RbTree whose
+   scans hold the mutex the writer needs, so ingest stalls for every
+   scan. The writes per second tell how much ingest the scans cost.
+
+   arguments: keys, milliseconds per run
+
+   g++ -O2 -std=c++17 -pthread "rb persistent bench.cpp" && ./a.out 1000000 2000
+*/
+
+#include <iostream>
+#include <mutex>
+#include <thread>
+
+#include "benchmark.h"
+#include "rb persistent.h"
+#include "red black tree.h"
+
+using namespace std;
+
+typedef PersistentRbTree<uint64_t, uint64_t> Persistent;
+
+void singlethreaded(const vector<uint64_t> &keys){
+	size_t n = keys.size();
+	{
+		Persistent tree;
+		Stopwatch watch;
+		for(uint64_t key : keys){tree.assign(key, key);}
+		report("persistent, upsert", n, watch.seconds());
+
+		uint64_t sum = 0;
+		watch.restart();
+		for(size_t i = 0; i < n; ++i){sum += tree.snapshot().size();}
+		report("persistent, snapshot", n, watch.seconds());
+		donotoptimize(sum);
+
+		watch.restart();
+		for(uint64_t key : keys){tree.erase(key);}
+		report("persistent, erase", n, watch.seconds());
+	}
+	RbTree<uint64_t, uint64_t> tree;
+	Stopwatch watch;
+	for(uint64_t key : keys){tree.try_emplace(key, key).first->value = key;}
+	report("RbTree, upsert", n, watch.seconds());
+	watch.restart();
+	for(uint64_t key : keys){tree.erase(key);}
+	report("RbTree, erase", n, watch.seconds());
+}
+
+// Runs write(key) in a loop on another thread while scan() repeats here
+template<typename Write, typename Scan>
+void ingest(const char *name, size_t n, unsigned milliseconds, Write write, Scan scan){
+	atomic<bool> stop{false};
+	uint64_t writes = 0;
+	thread writer([&]{
+		mt19937_64 rng(2);
+		while(!stop.load(memory_order_relaxed)){
+			write(rng() % (2 * n));
+			++writes;
+		}
+	});
+	size_t scans = 0;
+	uint64_t sum = 0;
+	Stopwatch watch;
+	while(watch.seconds() * 1000 < milliseconds){
+		sum += scan();
+		++scans;
+	}
+	stop = true;
+	writer.join();
+	double seconds = watch.seconds();
+	donotoptimize(sum);
+	cout << name << ": " << uint64_t(writes / seconds) << " writes/s, "
+		<< scans / seconds << " full scans/s" << endl;
+}
+
+int main(int argc, char **argv){
+	size_t n = argcount(argc, argv, 1, 1000000);
+	unsigned milliseconds = argcount(argc, argv, 2, 2000);
+	if(!n){n = 1;}
+	vector<uint64_t> keys = randomkeys(n);
+
+	singlethreaded(keys);
+
+	{
+		Persistent tree;
+		for(uint64_t key : keys){tree.assign(key, key);}
+		ingest("persistent, scans on snapshots", n, milliseconds,
+			[&](uint64_t key){tree.assign(key, key);},
+			[&]{
+				uint64_t sum = 0;
+				auto snapshot = tree.snapshot();
+				snapshot.foreach([&sum](uint64_t, uint64_t value){sum += value;});
+				return sum;
+			});
+	}
+
+	RbTree<uint64_t, uint64_t> tree;
+	mutex guard;
+	for(uint64_t key : keys){tree.try_emplace(key, key);}
+	ingest("RbTree, scans under the mutex", n, milliseconds,
+		[&](uint64_t key){
+			lock_guard<mutex> lock(guard);
+			tree.try_emplace(key, key).first->value = key;
+		},
+		[&]{
+			uint64_t sum = 0;
+			lock_guard<mutex> lock(guard);
+			for(const auto &rbnode : tree){sum += rbnode.value;}
+			return sum;
+		});
+	return 0;
+}
@@ -0,0 +1,488 @@
+/*
+   Persistent red black tree
+
+   Point in time views for long scans while writes go on. Nodes are never
+   changed once a version of the tree is published. A write copies the
+   nodes on the path from the root to where it changes the tree (and the
+   few siblings the fixup recolors), links the copies to the untouched
+   subtrees of the old version and publishes the new root, so a version
+   costs O(log n) new nodes and shares everything else with the one
+   before. A snapshot is the root of one version: taking it is a load,
+   and a scan of it sees exactly that version however long it takes.
+
+   The nodes have no parent pointers, a parent would have to be copied
+   along with every child. The writer remembers the path it came down in
+   a stack instead and runs the usual fixups on it. Every node carries
+   the number of the write that created it, so within one write a node is
+   copied once and then changed in place.
+
+   Nodes that a write replaced are still part of older versions, so they
+   are handed to the epoch reclamation of epoch.h and freed once every
+   snapshot that could reach them is gone. A snapshot holds an
+   Epoch::Guard for its lifetime, which makes it bound to the thread that
+   took it, and while it lives nothing retired after it is freed. One
+   writer at a time, writers take a mutex.
+
+       PersistentRbTree<uint64_t, Row> table;
+       table.insert(key, row);
+       {
+           auto snapshot = table.snapshot();   // O(1)
+           snapshot.scan(lo, hi, [](uint64_t key, const Row &row){...});
+       }
+*/
+
+#ifndef RB_PERSISTENT_H
+#define RB_PERSISTENT_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "epoch.h"
+
+template<typename Key, typename Value, typename Compare = std::less<Key>>
+class PersistentRbTree{
+	struct Node;
+	struct Version;
+
+public:
+	// One version of the tree, fixed when it was taken
+	class Snapshot{
+	public:
+		explicit Snapshot(const PersistentRbTree &tree):
+		version(tree.current.load(std::memory_order_acquire)), comp(tree.comp){}
+
+		Snapshot(const Snapshot &) = delete;
+		Snapshot &operator=(const Snapshot &) = delete;
+
+		// The value of the key, nullptr if there is none. Valid as long as
+		// the snapshot
+		const Value *find(const Key &key) const{
+			const Node *node = version->root;
+			while(node){
+				if(comp(key, node->key)){node = node->left;}
+				else if(comp(node->key, key)){node = node->right;}
+				else{return &node->value;}
+			}
+			return nullptr;
+		}
+
+		bool contains(const Key &key) const{return find(key) != nullptr;}
+
+		std::size_t size() const{return version->count;}
+
+		// Calls visit(key, value) for every key in order
+		template<typename Visit>
+		void foreach(Visit visit) const{
+			walk(version->root, [](const Key &){return true;}, visit);
+		}
+
+		// Calls visit(key, value) in key order for the keys in [lo, hi)
+		template<typename Visit>
+		void scan(const Key &lo, const Key &hi, Visit visit) const{
+			// the stack starts with the nodes not less than lo on the way
+			// down to lo, the ones smaller are skipped with their left
+			// subtrees
+			const Node *stack[maxheight];
+			int top = 0;
+			for(const Node *node = version->root; node;){
+				if(comp(node->key, lo)){
+					node = node->right;
+				}
+				else{
+					stack[top++] = node;
+					node = node->left;
+				}
+			}
+			inorder(stack, top, [&](const Key &key){return comp(key, hi);}, visit);
+		}
+
+		// The number of black nodes on every path from the root down, -1
+		// if the version breaks the red black rules. O(n), for tests
+		int blackheight() const{
+			return isred(version->root) ? -1 : blackheight(version->root);
+		}
+
+	private:
+		static int blackheight(const Node *node){
+			if(!node){
+				return 1;
+			}
+			if(node->red && (isred(node->left) || isred(node->right))){
+				return -1;
+			}
+			int left = blackheight(node->left), right = blackheight(node->right);
+			return left < 0 || left != right ? -1 : left + !node->red;
+		}
+
+		template<typename InRange, typename Visit>
+		static void walk(const Node *root, InRange inrange, Visit visit){
+			const Node *stack[maxheight];
+			int top = 0;
+			for(const Node *node = root; node; node = node->left){stack[top++] = node;}
+			inorder(stack, top, inrange, visit);
+		}
+
+		// Pops the stack in order, pushing the left spine of every right
+		// subtree, while inrange(key) holds
+		template<typename InRange, typename Visit>
+		static void inorder(const Node **stack, int top, InRange inrange, Visit visit){
+			while(top){
+				const Node *node = stack[--top];
+				if(!inrange(node->key)){
+					return;
+				}
+				visit(node->key, node->value);
+				for(node = node->right; node; node = node->left){stack[top++] = node;}
+			}
+		}
+
+		Epoch::Guard guard;
+		const Version *version;
+		const Compare &comp;
+	};
+
+	explicit PersistentRbTree(const Compare &comp = Compare()): comp(comp){
+		current.store(new Version{nullptr, 0}, std::memory_order_relaxed);
+	}
+
+	PersistentRbTree(const PersistentRbTree &) = delete;
+	PersistentRbTree &operator=(const PersistentRbTree &) = delete;
+
+	// No snapshot may be left
+	~PersistentRbTree(){
+		Epoch::synchronize();
+		const Version *version = current.load(std::memory_order_relaxed);
+		std::vector<const Node *> stack;
+		if(version->root){stack.push_back(version->root);}
+		while(!stack.empty()){
+			const Node *node = stack.back();
+			stack.pop_back();
+			if(node->left){stack.push_back(node->left);}
+			if(node->right){stack.push_back(node->right);}
+			delete node;
+		}
+		delete version;
+	}
+
+	// Takes a snapshot of the current version in O(1). C++17 returns it
+	// without a copy: auto snapshot = tree.snapshot();
+	Snapshot snapshot() const{return Snapshot(*this);}
+
+	// Writer side. Returns false if the key is already there
+	bool insert(const Key &key, const Value &value){
+		std::lock_guard<std::mutex> lock(writer);
+		if(findlocked(key)){
+			return false;
+		}
+		put(key, value);
+		return true;
+	}
+
+	// Writer side. Inserts the key or gives it a new value, returns
+	// whether it was inserted
+	bool assign(const Key &key, const Value &value){
+		std::lock_guard<std::mutex> lock(writer);
+		return put(key, value);
+	}
+
+	// Writer side. Returns false if the key was not there
+	bool erase(const Key &key){
+		std::lock_guard<std::mutex> lock(writer);
+		if(!findlocked(key)){
+			return false;
+		}
+		remove(key);
+		return true;
+	}
+
+	std::size_t size() const{return current.load(std::memory_order_acquire)->count;}
+
+private:
+	struct Node{
+		Key key;
+		Value value;
+		const Node *left, *right;
+		bool red;
+		std::uint64_t write; // the write that created the node
+	};
+
+	struct Version{
+		const Node *root;
+		std::size_t count;
+	};
+
+	// enough for 2 log2(n + 1) with any n that fits in memory
+	static constexpr int maxheight = 128;
+
+	static bool isred(const Node *node){return node && node->red;}
+
+	const Node *findlocked(const Key &key) const{
+		const Node *node = current.load(std::memory_order_relaxed)->root;
+		while(node){
+			if(comp(key, node->key)){node = node->left;}
+			else if(comp(node->key, key)){node = node->right;}
+			else{return node;}
+		}
+		return nullptr;
+	}
+
+	// The node for this write to change: the node itself if this write
+	// created it, otherwise a copy, and the original is retired once the
+	// new version is out
+	Node *own(const Node *node){
+		if(node->write == write){
+			return const_cast<Node *>(node);
+		}
+		replaced.push_back(node);
+		Node *copy = new Node(*node);
+		copy->write = write;
+		return copy;
+	}
+
+	// Owns the child of parent (the root for nullptr) on one side
+	Node *ownchild(Node *parent, bool left){
+		if(!parent){
+			return root = own(root);
+		}
+		const Node *&link = left ? parent->left : parent->right;
+		Node *child = own(link);
+		link = child;
+		return child;
+	}
+
+	// Points the link of parent (or the root) that held old at node
+	void replacechild(Node *parent, const Node *old, Node *node){
+		if(!parent){root = node;}
+		else if(parent->left == old){parent->left = node;}
+		else{parent->right = node;}
+	}
+
+	// The rotations work on nodes this write owns, parent is above node
+	void leftrotate(Node *node, Node *parent){
+		Node *right = const_cast<Node *>(node->right);
+		node->right = right->left;
+		right->left = node;
+		replacechild(parent, node, right);
+	}
+
+	void rightrotate(Node *node, Node *parent){
+		Node *left = const_cast<Node *>(node->left);
+		node->left = left->right;
+		left->right = node;
+		replacechild(parent, node, left);
+	}
+
+	// Starts a write on a private root
+	void begin(){
+		++write;
+		const Version *version = current.load(std::memory_order_relaxed);
+		root = version->root ? own(version->root) : nullptr;
+		count = version->count;
+		path.clear();
+	}
+
+	// Publishes the new version and retires what it replaced
+	void commit(){
+		const Version *old = current.load(std::memory_order_relaxed);
+		current.store(new Version{root, count}, std::memory_order_release);
+		Epoch::retire(const_cast<Version *>(old));
+		for(const Node *node : replaced){Epoch::retire(const_cast<Node *>(node));}
+		replaced.clear();
+	}
+
+	// Copies the path down to the key or to where it goes, leaving the
+	// owned ancestors in path. Returns the node with the key, nullptr if
+	// there is none, and in left the side the key goes below path.back()
+	Node *descend(const Key &key, bool &left){
+		Node *node = root;
+		while(node){
+			if(!comp(key, node->key) && !comp(node->key, key)){
+				return node;
+			}
+			path.push_back(node);
+			left = comp(key, node->key);
+			const Node *next = left ? node->left : node->right;
+			node = next ? ownchild(node, left) : nullptr;
+		}
+		return nullptr;
+	}
+
+	bool put(const Key &key, const Value &value){
+		begin();
+		bool left = false;
+		if(Node *node = descend(key, left)){
+			node->value = value;
+			commit();
+			return false;
+		}
+		Node *node = new Node{key, value, nullptr, nullptr, true, write};
+		if(path.empty()){root = node;}
+		else if(left){path.back()->left = node;}
+		else{path.back()->right = node;}
+		++count;
+		insertfixup(node);
+		commit();
+		return true;
+	}
+
+	// The fixup of RbTree with the ancestors on the path stack
+	void insertfixup(Node *node){
+		while(!path.empty() && path.back()->red){
+			Node *parent = path.back();
+			Node *gparent = path[path.size() - 2];
+			Node *ggparent = path.size() >= 3 ? path[path.size() - 3] : nullptr;
+			bool parentleft = gparent->left == parent;
+			const Node *uncle = parentleft ? gparent->right : gparent->left;
+			if(isred(uncle)){
+				Node *owned = ownchild(gparent, !parentleft);
+				owned->red = false;
+				parent->red = false;
+				gparent->red = true;
+				node = gparent;
+				path.pop_back();
+				path.pop_back();
+				continue;
+			}
+			if(parentleft){
+				if(node == parent->right){
+					leftrotate(parent, gparent);
+					std::swap(node, parent);
+				}
+				rightrotate(gparent, ggparent);
+			}
+			else{
+				if(node == parent->left){
+					rightrotate(parent, gparent);
+					std::swap(node, parent);
+				}
+				leftrotate(gparent, ggparent);
+			}
+			parent->red = false;
+			gparent->red = true;
+			break;
+		}
+		root->red = false;
+	}
+
+	void remove(const Key &key){
+		begin();
+		bool left = false;
+		Node *node = descend(key, left);
+		// a node with two children takes over the key and value of its
+		// successor, which has no left child and goes instead
+		if(node->left && node->right){
+			Node *successor = ownchild(node, false);
+			path.push_back(node);
+			while(successor->left){
+				path.push_back(successor);
+				successor = ownchild(successor, true);
+			}
+			node->key = successor->key;
+			node->value = successor->value;
+			node = successor;
+		}
+
+		Node *parent = path.empty() ? nullptr : path.back();
+		const Node *child = node->left ? node->left : node->right;
+		bool childleft = parent && parent->left == node;
+		replacechild(parent, node, const_cast<Node *>(child));
+		bool black = !node->red;
+		delete node;
+		--count;
+		if(black){erasefixup(child, childleft);}
+		commit();
+	}
+
+	// The fixup of RbTree for a missing black on the paths through child,
+	// whose parent is path.back() and which hangs on its left if left
+	void erasefixup(const Node *child, bool left){
+		while(!path.empty() && !isred(child)){
+			Node *parent = path.back();
+			Node *gparent = path.size() >= 2 ? path[path.size() - 2] : nullptr;
+			if(left){
+				Node *sibling = ownchild(parent, false);
+				if(sibling->red){
+					sibling->red = false;
+					parent->red = true;
+					leftrotate(parent, gparent);
+					path.back() = sibling;
+					path.push_back(parent);
+					gparent = sibling;
+					sibling = ownchild(parent, false);
+				}
+				if(!isred(sibling->left) && !isred(sibling->right)){
+					sibling->red = true;
+					child = parent;
+					path.pop_back();
+					left = !path.empty() && path.back()->left == parent;
+					continue;
+				}
+				if(!isred(sibling->right)){
+					Node *nephew = ownchild(sibling, true);
+					nephew->red = false;
+					sibling->red = true;
+					rightrotate(sibling, parent);
+					sibling = nephew;
+				}
+				sibling->red = parent->red;
+				parent->red = false;
+				ownchild(sibling, false)->red = false;
+				leftrotate(parent, gparent);
+			}
+			else{
+				Node *sibling = ownchild(parent, true);
+				if(sibling->red){
+					sibling->red = false;
+					parent->red = true;
+					rightrotate(parent, gparent);
+					path.back() = sibling;
+					path.push_back(parent);
+					gparent = sibling;
+					sibling = ownchild(parent, true);
+				}
+				if(!isred(sibling->left) && !isred(sibling->right)){
+					sibling->red = true;
+					child = parent;
+					path.pop_back();
+					left = !path.empty() && path.back()->left == parent;
+					continue;
+				}
+				if(!isred(sibling->left)){
+					Node *nephew = ownchild(sibling, false);
+					nephew->red = false;
+					sibling->red = true;
+					leftrotate(sibling, parent);
+					sibling = nephew;
+				}
+				sibling->red = parent->red;
+				parent->red = false;
+				ownchild(sibling, true)->red = false;
+				rightrotate(parent, gparent);
+			}
+			return;
+		}
+		// a red child takes the black, at the root the black leaves the tree
+		if(isred(child)){
+			Node *parent = path.empty() ? nullptr : path.back();
+			ownchild(parent, left)->red = false;
+		}
+	}
+
+	std::atomic<const Version *> current{nullptr};
+	Compare comp;
+	std::mutex writer;
+
+	// state of the write in progress
+	std::uint64_t write = 0;
+	Node *root = nullptr;
+	std::size_t count = 0;
+	std::vector<Node *> path;
+	std::vector<const Node *> replaced;
+};
+
+#endif
@@ -0,0 +1,129 @@
+/*
+   Inline key prefix benchmark
+
+   Inserts and lookups on trees of long string keys, stored as std::string
+   (with std::less<>, so a std::string_view lookup needs no temporary
+   either) against PrefixKey with 8, 16 and 32 prefix bytes:
+
+       uuid    random version 4 UUIDs in text form, 36 characters that
+               differ from the first one on
+       url     URLs of 256 hosts under one domain with paths of a few
+               segments, "https://www.host17.example.com/docs/4711/..."
+               with long common prefixes
+       binary  the UUIDs as 16 normalized bytes, the two halves big
+               endian, which a 16 byte prefix holds completely
+
+   Lookups go by std::string_view in random order, half of them for
+   keys that are not in the tree; for PrefixKey also with a PrefixProbe
+   packed once per lookup. The keys are allocated in random order so
+   that their characters are scattered over the heap as in a long
+   running process.
+
+   arguments: keys
+
+   g++ -O2 -std=c++17 "rb prefix key bench.cpp" && ./a.out 1000000
+*/
+
+#include <iostream>
+#include <string>
+#include <string_view>
+
+#include "benchmark.h"
+#include "rb prefix key.h"
+#include "red black tree.h"
+
+using namespace std;
+
+struct KeySet{
+	const char *name;
+	vector<string> keys, misses;
+};
+
+string uuid(mt19937_64 &rng){
+	static const char hex[] = "0123456789abcdef";
+	string text;
+	uint64_t bits[2] = {rng(), rng()};
+	for(int i = 0; i < 32; ++i){
+		if(i == 8 || i == 12 || i == 16 || i == 20){text += '-';}
+		int nibble = bits[i / 16] >> (4 * (i % 16)) & 15;
+		if(i == 12){nibble = 4;}
+		text += hex[nibble];
+	}
+	return text;
+}
+
+string url(mt19937_64 &rng){
+	static const char *const sections[] = {"docs", "api", "blog", "static", "users", "search"};
+	string text = "https://www.host" + to_string(rng() % 256) + ".example.com/" + sections[rng() % 6];
+	for(int depth = 1 + rng() % 3; depth; --depth){text += "/" + to_string(rng() % 100000);}
+	return text;
+}
+
+// A UUID as 16 bytes whose memcmp() order is the order of its halves
+string binary(mt19937_64 &rng){
+	string bytes(16, '\0');
+	for(int half = 0; half < 2; ++half){
+		uint64_t value = rng();
+		for(int i = 0; i < 8; ++i){bytes[8 * half + i] = char(value >> (56 - 8 * i));}
+	}
+	return bytes;
+}
+
+KeySet makekeys(const char *name, size_t n, string (*make)(mt19937_64 &)){
+	mt19937_64 rng(7);
+	KeySet set{name, {}, {}};
+	for(size_t i = 0; i < n; ++i){set.keys.push_back(make(rng));}
+	for(size_t i = 0; i < n; ++i){set.misses.push_back(make(rng));}
+	return set;
+}
+
+template<typename Tree, typename MakeKey, typename MakeProbe>
+void run(const KeySet &set, const string &name, MakeKey makekey, MakeProbe makeprobe){
+	const vector<string> &keys = set.keys;
+	size_t n = keys.size();
+	vector<size_t> order(n);
+	iota(order.begin(), order.end(), size_t(0));
+	shuffle(order.begin(), order.end(), mt19937_64(3));
+
+	Tree tree;
+	Stopwatch watch;
+	for(size_t i : order){tree.try_emplace(makekey(keys[i]), i);}
+	report((string(set.name) + ", " + name + ", insert").c_str(), n, watch.seconds());
+
+	size_t hits = 0;
+	watch.restart();
+	for(size_t i = 0; i < n; ++i){
+		hits += tree.contains(string_view(i % 2 ? set.misses[order[i]] : keys[order[i]]));
+	}
+	report((string(set.name) + ", " + name + ", find string_view").c_str(), n, watch.seconds());
+
+	watch.restart();
+	for(size_t i = 0; i < n; ++i){
+		hits += tree.contains(makeprobe(string_view(i % 2 ? set.misses[order[i]] : keys[order[i]])));
+	}
+	report((string(set.name) + ", " + name + ", find probe").c_str(), n, watch.seconds());
+	donotoptimize(hits);
+}
+
+template<size_t Bytes>
+void runprefix(const KeySet &set){
+	run<RbTree<PrefixKey<Bytes>, size_t, PrefixLess<Bytes>>>(set, "PrefixKey<" + to_string(Bytes) + ">",
+		[](const string &key){return PrefixKey<Bytes>(key);},
+		[](string_view key){return PrefixProbe<Bytes>(key);});
+}
+
+int main(int argc, char **argv){
+	size_t n = argcount(argc, argv, 1, 1000000);
+	if(!n){n = 1;}
+
+	for(const KeySet &set : {makekeys("uuid", n, uuid), makekeys("url", n, url), makekeys("binary", n, binary)}){
+		run<RbTree<string, size_t, less<>>>(set, "std::string",
+			[](const string &key){return key;},
+			[](string_view key){return key;});
+		runprefix<8>(set);
+		runprefix<16>(set);
+		runprefix<32>(set);
+		cout << endl;
+	}
+	return 0;
+}
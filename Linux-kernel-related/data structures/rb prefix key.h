@@ -0,0 +1,149 @@
+/*
+   String keys with an inline prefix
+
+   A std::string key keeps its characters in the node only up to the
+   short string limit (15 bytes with libstdc++); URLs, paths and textual
+   UUIDs live in a heap block of their own. Then every comparison of a
+   descent reads the node and follows the pointer to the characters, two
+   cache misses per level instead of one.
+
+   PrefixKey<Bytes> stores the first Bytes bytes of the string in the key
+   itself, packed big endian into 64-bit words, so comparing words orders
+   them like memcmp() orders the bytes. PrefixLess compares the prefix
+   words first and reads the characters only when the prefixes tie, which
+   with distinct keys happens in the last few levels of a descent at most.
+   Keys that fit into the prefix altogether never leave the node.
+
+       RbTree<PrefixKey<16>, Page, PrefixLess<16>> pages;
+       pages.emplace(PrefixKey<16>(url), page);
+       auto it = pages.find(std::string_view(request.path));
+
+   PrefixLess is transparent: find(), contains(), lower_bound(),
+   upper_bound() and equal_range() take a std::string_view (or anything
+   that converts to one) as it is, without building a key and without
+   allocating. Its prefix is packed again at every step of the descent
+   though, which with 32 bytes costs more than the prefix saves; lookups
+   on a hot path pack it once into a PrefixProbe.
+
+   How many bytes pay off depends on where the keys start to differ: for
+   random UUIDs 8 bytes separate practically all of them, URLs share
+   "https://www." and maybe a host name, so their prefix must reach past
+   that. A composite key (a tenant id and a timestamp, a UUID as two 64
+   bit halves) becomes a string of normalized bytes, with big endian
+   integers and fixed width fields, whose memcmp() order is the order of
+   the fields; with Bytes covering all of it comparisons never tie.
+
+   The prefix makes the key, and so the node, larger. Where the heap
+   blocks of the strings stay in the cache anyway it is no faster than
+   std::string (the bench measures it); it pays when the key is mostly in
+   the prefix, short or normalized keys that outgrow the short string.
+*/
+
+#ifndef RB_PREFIX_KEY_H
+#define RB_PREFIX_KEY_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+
+// The first Bytes bytes of a string packed big endian into words, zero
+// padded. Comparing the words in order compares the bytes like memcmp()
+template<std::size_t Bytes>
+struct KeyPrefix{
+	static_assert(Bytes && Bytes % 8 == 0, "the prefix is a whole number of 64-bit words");
+	static constexpr std::size_t words = Bytes / 8;
+
+	explicit KeyPrefix(std::string_view text){
+		for(std::size_t w = 0; w < words; ++w){
+			std::uint64_t word = 0;
+			for(std::size_t i = 8 * w; i < 8 * w + 8; ++i){
+				word = word << 8 | (i < text.size() ? static_cast<unsigned char>(text[i]) : 0);
+			}
+			packed[w] = word;
+		}
+	}
+
+	std::uint64_t packed[words];
+};
+
+// A string key with its first Bytes bytes inline
+template<std::size_t Bytes = 16>
+class PrefixKey{
+public:
+	explicit PrefixKey(std::string text): prefix(text), text(std::move(text)){}
+	explicit PrefixKey(std::string_view text): prefix(text), text(text){}
+	explicit PrefixKey(const char *text): PrefixKey(std::string_view(text)){}
+
+	const std::string &str() const{return text;}
+	std::size_t size() const{return text.size();}
+	operator std::string_view() const{return text;}
+
+	KeyPrefix<Bytes> prefix;
+
+private:
+	std::string text;
+};
+
+// A lookup key with its prefix packed once, for lookups that are repeated
+// or run against several trees. It refers to the characters of text
+template<std::size_t Bytes = 16>
+struct PrefixProbe{
+	explicit PrefixProbe(std::string_view text): prefix(text), text(text){}
+
+	KeyPrefix<Bytes> prefix;
+	std::string_view text;
+};
+
+// Transparent comparator of PrefixKey, PrefixProbe and std::string_view
+template<std::size_t Bytes = 16>
+struct PrefixLess{
+	using is_transparent = void;
+
+	bool operator()(const PrefixKey<Bytes> &a, const PrefixKey<Bytes> &b) const{
+		return less(a.prefix, a, b.prefix, b);
+	}
+
+	bool operator()(const PrefixKey<Bytes> &a, const PrefixProbe<Bytes> &b) const{
+		return less(a.prefix, a, b.prefix, b.text);
+	}
+
+	bool operator()(const PrefixProbe<Bytes> &a, const PrefixKey<Bytes> &b) const{
+		return less(a.prefix, a.text, b.prefix, b);
+	}
+
+	bool operator()(const PrefixKey<Bytes> &a, std::string_view b) const{
+		return less(a.prefix, a, KeyPrefix<Bytes>(b), b);
+	}
+
+	bool operator()(std::string_view a, const PrefixKey<Bytes> &b) const{
+		return less(KeyPrefix<Bytes>(a), a, b.prefix, b);
+	}
+
+	// Compares the words first. On a tie the sizes decide if both strings
+	// fit into the prefix (the padding cannot hide a difference then),
+	// otherwise the characters after the prefix do. Text is either a
+	// PrefixKey or a std::string_view; only the tie converts it
+	template<typename A, typename B>
+	static bool less(const KeyPrefix<Bytes> &pa, const A &a, const KeyPrefix<Bytes> &pb, const B &b){
+		for(std::size_t w = 0; w < KeyPrefix<Bytes>::words; ++w){
+			if(pa.packed[w] != pb.packed[w]){return pa.packed[w] < pb.packed[w];}
+		}
+		std::size_t asize = textsize(a), bsize = textsize(b);
+		if(asize <= Bytes && bsize <= Bytes){
+			return asize < bsize;
+		}
+		std::string_view atext = a, btext = b;
+		if(asize >= Bytes && bsize >= Bytes){
+			return atext.substr(Bytes) < btext.substr(Bytes);
+		}
+		return atext < btext;
+	}
+
+private:
+	static std::size_t textsize(const PrefixKey<Bytes> &key){return key.size();}
+	static std::size_t textsize(std::string_view text){return text.size();}
+};
+
+#endif
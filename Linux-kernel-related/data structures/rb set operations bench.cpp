@@ -0,0 +1,94 @@
+/*
+   Set operations benchmark
+
+   Union, intersection and difference of two trees of n keys each, drawn
+   at random from [0, 2n) so that about half of the keys overlap. The join
+   based operations, sequential and on a thread pool, against the way it
+   is done with single key operations: one insert per key for the union,
+   one lookup (and insert of the hits) per key for the intersection and
+   one erase per key for the difference.
+
+   arguments: n, threads
+
+   g++ -O2 -std=c++17 -pthread "rb set operations bench.cpp" && ./a.out 10000000 8
+*/
+
+#include <iostream>
+
+#include "benchmark.h"
+#include "red black tree.h"
+
+using namespace std;
+
+using Tree = RbTree<uint64_t, uint64_t>;
+
+struct Input{
+	vector<pair<uint64_t, uint64_t>> a, b;
+};
+
+Input makeinput(size_t n){
+	Input input;
+	vector<uint64_t> a = randomkeys(2 * n, 1), b = randomkeys(2 * n, 2);
+	a.resize(n);
+	b.resize(n);
+	sort(a.begin(), a.end());
+	sort(b.begin(), b.end());
+	for(uint64_t key : a){input.a.emplace_back(key, key);}
+	for(uint64_t key : b){input.b.emplace_back(key, key);}
+	return input;
+}
+
+// Times operation(a, b) on fresh copies of the input trees
+template<typename Operation>
+void run(const char *label, const Input &input, Operation operation){
+	Tree a, b;
+	a.assign_sorted(input.a.begin(), input.a.end());
+	b.assign_sorted(input.b.begin(), input.b.end());
+	Stopwatch watch;
+	operation(a, b);
+	report(label, input.b.size(), watch.seconds());
+}
+
+int main(int argc, char **argv){
+	size_t n = argcount(argc, argv, 1, 10000000);
+	unsigned threads = argcount(argc, argv, 2, thread::hardware_concurrency());
+	ThreadPool pool(threads ? threads : 1);
+	Input input = makeinput(n);
+	cout << "n = " << n << ", " << pool.threads() << " threads" << endl;
+
+	run("union, insert per key", input, [](Tree &a, Tree &b){
+		for(const auto &rbnode : b){a.try_emplace(rbnode.key, rbnode.value);}
+	});
+	run("union, join", input, [](Tree &a, Tree &b){
+		a.setunion(move(b));
+	});
+	run("union, join parallel", input, [&](Tree &a, Tree &b){
+		a.setunion(move(b), &pool);
+	});
+
+	run("intersection, lookup per key", input, [](Tree &a, Tree &b){
+		Tree result;
+		for(const auto &rbnode : b){
+			if(a.contains(rbnode.key)){result.emplace(rbnode.key, rbnode.value);}
+		}
+		a = move(result);
+	});
+	run("intersection, join", input, [](Tree &a, Tree &b){
+		a.setintersection(move(b));
+	});
+	run("intersection, join parallel", input, [&](Tree &a, Tree &b){
+		a.setintersection(move(b), &pool);
+	});
+
+	run("difference, erase per key", input, [](Tree &a, Tree &b){
+		for(const auto &rbnode : b){a.erase(rbnode.key);}
+	});
+	run("difference, join", input, [](Tree &a, Tree &b){
+		a.setdifference(move(b));
+	});
+	run("difference, join parallel", input, [&](Tree &a, Tree &b){
+		a.setdifference(move(b), &pool);
+	});
+
+	return 0;
+}
@@ -0,0 +1,82 @@
+/*
+   Sharded map write scaling benchmark
+
+   1, 2, 4 ... threads run a mixed stream of operations on random keys,
+   a quarter inserts, a quarter erases and half lookups, against an RbTree
+   behind one mutex and against the sharded map, once starting from a
+   single shard that splits itself as it grows and once partitioned into
+   as many shards as the largest thread count up front.
+
+   arguments: key range, maximum threads, operations per thread
+
+   g++ -O2 -std=c++17 -pthread "rb sharded bench.cpp" && ./a.out 1000000 64 1000000
+*/
+
+#include <iostream>
+#include <thread>
+
+#include "benchmark.h"
+#include "rb sharded.h"
+#include "red black tree.h"
+
+using namespace std;
+
+using ShardedTree = ShardedRbTree<uint64_t, uint64_t>;
+
+// Runs ops mixed operations on each of threads threads, the tree holds
+// about half of the key range throughout
+template<typename Tree>
+void run(const char *name, Tree &tree, size_t range, unsigned threads, size_t ops){
+	for(uint64_t key = 0; key < range; key += 2){tree.insert(key, key);}
+
+	vector<thread> workers;
+	Stopwatch watch;
+	for(unsigned i = 0; i < threads; ++i){
+		workers.emplace_back([&, i]{
+			mt19937_64 rng(i + 1);
+			uint64_t value, found = 0;
+			for(size_t j = 0; j < ops; ++j){
+				uint64_t r = rng();
+				uint64_t key = (r >> 2) % range;
+				switch(r & 3){
+				case 0: tree.insert(key, key); break;
+				case 1: tree.erase(key); break;
+				default: found += tree.find(key, value);
+				}
+			}
+			donotoptimize(found);
+		});
+	}
+	for(thread &worker : workers){worker.join();}
+	double seconds = watch.seconds();
+
+	printf("%-16s %3u threads %12.0f ops/s\n", name, threads, threads * ops / seconds);
+}
+
+int main(int argc, char **argv){
+	size_t range = argcount(argc, argv, 1, 1000000);
+	unsigned maxthreads = argcount(argc, argv, 2, 64);
+	size_t ops = argcount(argc, argv, 3, 1000000);
+
+	// even partitions of the key range, one per thread at most
+	vector<uint64_t> boundaries;
+	for(unsigned i = 1; i < maxthreads; ++i){boundaries.push_back(range * i / maxthreads);}
+
+	for(unsigned threads = 1; threads <= maxthreads; threads *= 2){
+		{
+			MutexTree tree;
+			run("mutex", tree, range, threads, ops);
+		}
+		{
+			ShardedTree tree;
+			run("sharded, split", tree, range, threads, ops);
+			printf("%-16s %zu shards\n", "", tree.shards());
+		}
+		{
+			ShardedTree tree(boundaries);
+			run("sharded, preset", tree, range, threads, ops);
+		}
+	}
+
+	return 0;
+}
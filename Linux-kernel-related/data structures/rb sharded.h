@@ -0,0 +1,272 @@
+/*
+   Sharded ordered map
+
+   One tree behind one lock lets only one writer in at a time, however
+   many cores there are. ShardedRbTree splits the key space into ranges,
+   each with an RbTree and a lock of its own, so writers to different
+   ranges never meet. A directory of the lower bounds of the shards routes
+   every key to its shard with a binary search.
+
+   A shard that grows past maxshard keys, or whose lock is often found
+   taken, is split in two at its root key with RbTree::split() in
+   O(log n). Only the shard being split is locked while that happens, the
+   others keep working. The split publishes a new directory, and an
+   operation that was routed by the old one notices from the bounds of the
+   shard it locked that its key has moved and routes again. Old
+   directories are freed through the epoch reclamation in epoch.h, shards
+   live as long as the map.
+
+   scan() and foreach() visit the keys in order across the shards, locking
+   one shard at a time. Every shard is seen consistently, the map as a
+   whole is not a snapshot: a scan may miss changes made behind it.
+
+       ShardedRbTree<uint64_t, Payload> map({1000000, 2000000, 3000000});
+       map.insert(key, payload);        // from any thread
+       map.scan(lo, hi, [](uint64_t key, const Payload &payload){...});
+*/
+
+#ifndef RB_SHARDED_H
+#define RB_SHARDED_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+#include "epoch.h"
+#include "red black tree.h"
+
+template<typename Key, typename Value, typename Compare = std::less<Key>>
+class ShardedRbTree{
+public:
+	// boundaries are the sorted lower bounds of the initial shards after
+	// the first. Shards with more than maxshard keys are split
+	explicit ShardedRbTree(const std::vector<Key> &boundaries = {},
+		std::size_t maxshard = 65536, const Compare &comp = Compare()):
+	maxshard(maxshard), comp(comp){
+		Directory *initial = new Directory;
+		std::optional<Key> low;
+		for(std::size_t i = 0; i <= boundaries.size(); ++i){
+			std::optional<Key> high;
+			if(i < boundaries.size()){high = boundaries[i];}
+			initial->shards.push_back(newshard(low, high));
+			if(i > 0){initial->lows.push_back(*low);}
+			low = high;
+		}
+		directory.store(initial, std::memory_order_release);
+	}
+
+	ShardedRbTree(const ShardedRbTree &) = delete;
+	ShardedRbTree &operator=(const ShardedRbTree &) = delete;
+
+	// No other thread may be using the map any more
+	~ShardedRbTree(){
+		Epoch::synchronize();
+		delete directory.load(std::memory_order_relaxed);
+	}
+
+	// Returns false if the key is already there
+	bool insert(const Key &key, const Value &value){
+		Shard *shard = lock(key);
+		bool inserted = shard->tree.try_emplace(key, value).second;
+		if(shard->tree.size() > maxshard ||
+			(shard->contended > hotcontention && shard->tree.size() >= minshard)){
+			split(shard);
+		}
+		shard->lock.unlock();
+		return inserted;
+	}
+
+	// Returns false if the key was not there
+	bool erase(const Key &key){
+		Shard *shard = lock(key);
+		bool erased = shard->tree.erase(key);
+		shard->lock.unlock();
+		return erased;
+	}
+
+	// Copies the value out, the node may be gone once the shard is unlocked
+	bool find(const Key &key, Value &value){
+		Shard *shard = lock(key);
+		auto it = shard->tree.find(key);
+		bool found = it != shard->tree.end();
+		if(found){value = it->value;}
+		shard->lock.unlock();
+		return found;
+	}
+
+	bool contains(const Key &key){
+		Shard *shard = lock(key);
+		bool found = shard->tree.contains(key);
+		shard->lock.unlock();
+		return found;
+	}
+
+	// Calls visit(key, value) in key order for the keys in [lo, hi)
+	template<typename Visit>
+	void scan(const Key &lo, const Key &hi, Visit visit){
+		std::optional<Key> from = lo;
+		while(from && comp(*from, hi)){
+			Shard *shard = lock(*from);
+			shard->tree.scan(*from, hi, [&](const Node &rbnode){visit(rbnode.key, rbnode.value);});
+			from = shard->high;
+			shard->lock.unlock();
+		}
+	}
+
+	// Calls visit(key, value) for every key in order
+	template<typename Visit>
+	void foreach(Visit visit){
+		Shard *shard = lockfirst();
+		while(true){
+			for(const auto &rbnode : shard->tree){visit(rbnode.key, rbnode.value);}
+			std::optional<Key> next = shard->high;
+			shard->lock.unlock();
+			if(!next){
+				break;
+			}
+			shard = lock(*next);
+		}
+	}
+
+	// Counts the keys, shard by shard
+	std::size_t size(){
+		std::size_t total = 0;
+		foreachshard([&](Shard *shard){total += shard->tree.size();});
+		return total;
+	}
+
+	// The current number of shards
+	std::size_t shards(){
+		Epoch::Guard guard;
+		return directory.load(std::memory_order_acquire)->shards.size();
+	}
+
+private:
+	using Tree = RbTree<Key, Value, Compare>;
+	using Node = typename Tree::Node;
+
+	// A range [low, high) of the keys, unbounded where a bound is missing.
+	// The bounds change only under the shard's lock
+	struct alignas(64) Shard{
+		explicit Shard(const Compare &comp): tree(comp){}
+
+		std::mutex lock;
+		Tree tree;
+		std::optional<Key> low, high;
+		unsigned contended = 0;
+	};
+
+	// shards in key order and the lower bounds of all but the first,
+	// never changed once published
+	struct Directory{
+		std::vector<Key> lows;
+		std::vector<Shard *> shards;
+	};
+
+	// A shard whose lock was found taken this many times since it was
+	// created is hot and split if it has at least minshard keys
+	static constexpr unsigned hotcontention = 1024;
+	static constexpr std::size_t minshard = 256;
+
+	Shard *newshard(const std::optional<Key> &low, const std::optional<Key> &high){
+		std::lock_guard<std::mutex> guard(storagelock);
+		storage.push_back(std::make_unique<Shard>(comp));
+		Shard *shard = storage.back().get();
+		shard->low = low;
+		shard->high = high;
+		return shard;
+	}
+
+	bool covers(const Shard *shard, const Key &key) const{
+		return (!shard->low || !comp(key, *shard->low)) && (!shard->high || comp(key, *shard->high));
+	}
+
+	// Locks and returns the shard of key, routing again if a split moved
+	// the key away while the lock was awaited
+	Shard *lock(const Key &key){
+		while(true){
+			Shard *shard;
+			{
+				Epoch::Guard guard;
+				const Directory *current = directory.load(std::memory_order_acquire);
+				auto it = std::upper_bound(current->lows.begin(), current->lows.end(), key, comp);
+				shard = current->shards[it - current->lows.begin()];
+			}
+			if(!shard->lock.try_lock()){
+				shard->lock.lock();
+				++shard->contended;
+			}
+			if(covers(shard, key)){
+				return shard;
+			}
+			shard->lock.unlock();
+		}
+	}
+
+	// Locks the shard without a lower bound, which never changes
+	Shard *lockfirst(){
+		Shard *shard;
+		{
+			Epoch::Guard guard;
+			shard = directory.load(std::memory_order_acquire)->shards.front();
+		}
+		shard->lock.lock();
+		return shard;
+	}
+
+	template<typename Function>
+	void foreachshard(Function function){
+		Shard *shard = lockfirst();
+		while(true){
+			function(shard);
+			std::optional<Key> next = shard->high;
+			shard->lock.unlock();
+			if(!next){
+				break;
+			}
+			shard = lock(*next);
+		}
+	}
+
+	// Moves the upper half of a locked shard into a new shard and
+	// publishes a directory with both. Splits of different shards only
+	// meet at the directory lock, which is never held while waiting for a
+	// shard
+	void split(Shard *shard){
+		Key middle = shard->tree.root()->key;
+		Tree upper = shard->tree.split(middle);
+		if(shard->tree.empty()){
+			shard->tree.join(std::move(upper));
+			return;
+		}
+		Shard *right = newshard(middle, shard->high);
+		right->tree = std::move(upper);
+
+		{
+			std::lock_guard<std::mutex> guard(directorylock);
+			const Directory *old = directory.load(std::memory_order_relaxed);
+			Directory *next = new Directory(*old);
+			auto it = std::find(next->shards.begin(), next->shards.end(), shard);
+			std::size_t index = it - next->shards.begin();
+			next->shards.insert(it + 1, right);
+			next->lows.insert(next->lows.begin() + index, middle);
+			directory.store(next, std::memory_order_release);
+			Epoch::retire(const_cast<Directory *>(old));
+		}
+		shard->high = middle;
+		shard->contended = 0;
+	}
+
+	std::atomic<const Directory *> directory{nullptr};
+	std::mutex directorylock, storagelock;
+	std::vector<std::unique_ptr<Shard>> storage;
+	std::size_t maxshard;
+	Compare comp;
+};
+
+#endif
@@ -0,0 +1,95 @@
+/*
+   Snapshot benchmark
+
+   What it costs to get a tree of n keys back at startup. Rebuilding it
+   with an insert per key and from sorted pairs with assign_sorted(),
+   against opening a snapshot (rb snapshot.h), then the first lookups on
+   the fresh mapping, which pay the page faults, a full scan of it and
+   lookups once it is warm. The file stays in the page cache, so the
+   faults are minor ones; from a cold disk they cost a read each.
+
+   arguments: keys, lookups, snapshot file
+
+   g++ -O2 -std=c++17 "rb snapshot bench.cpp" && ./a.out 10000000 1000000 /tmp/rb.snapshot
+*/
+
+#include <cstdio>
+#include <iostream>
+
+#include "benchmark.h"
+#include "rb snapshot.h"
+
+using namespace std;
+
+typedef RbSnapshot<uint64_t, uint64_t> Snapshot;
+
+int main(int argc, char **argv){
+	size_t n = argcount(argc, argv, 1, 10000000);
+	size_t lookups = argcount(argc, argv, 2, 1000000);
+	const char *path = argc > 3 ? argv[3] : "/tmp/rb.snapshot";
+	if(!n){n = 1;}
+
+	vector<uint64_t> keys = randomkeys(n);
+	RbTree<uint64_t, uint64_t> tree;
+	Stopwatch watch;
+	for(uint64_t key : keys){tree.emplace(key, ~key);}
+	report("rebuild by insert", n, watch.seconds());
+
+	vector<pair<uint64_t, uint64_t>> sorted;
+	sorted.reserve(n);
+	for(const auto &rbnode : tree){sorted.emplace_back(rbnode.key, rbnode.value);}
+	RbTree<uint64_t, uint64_t> rebuilt;
+	watch.restart();
+	rebuilt.assign_sorted(sorted.begin(), sorted.end());
+	report("rebuild by assign_sorted", n, watch.seconds());
+	rebuilt.clear();
+
+	watch.restart();
+	Snapshot::write(tree, path);
+	report("write snapshot", n, watch.seconds());
+
+	watch.restart();
+	Snapshot snapshot = Snapshot::open(path);
+	double seconds = watch.seconds();
+	cout << "open snapshot: " << seconds * 1e6 << " us for " << snapshot.size() << " keys" << endl;
+
+	mt19937_64 rng(3);
+	uint64_t sum = 0;
+	watch.restart();
+	for(size_t i = 0; i < lookups; ++i){
+		const uint64_t *value = snapshot.find(keys[rng() % n]);
+		sum += value ? *value : 0;
+	}
+	report("first lookups, mapped", lookups, watch.seconds());
+
+	watch.restart();
+	snapshot.foreach([&](uint64_t key, uint64_t value){sum += key ^ value;});
+	report("scan, mapped", n, watch.seconds());
+
+	watch.restart();
+	for(size_t i = 0; i < lookups; ++i){
+		const uint64_t *value = snapshot.find(keys[rng() % n]);
+		sum += value ? *value : 0;
+	}
+	report("warm lookups, mapped", lookups, watch.seconds());
+
+	watch.restart();
+	for(size_t i = 0; i < lookups; ++i){
+		auto it = tree.find(keys[rng() % n]);
+		sum += it != tree.end() ? it->value : 0;
+	}
+	report("lookups, pointer tree", lookups, watch.seconds());
+
+	Snapshot changed = Snapshot::open(path, Snapshot::copyonwrite);
+	watch.restart();
+	for(size_t i = 0; i < lookups; ++i){
+		uint64_t key = keys[rng() % n];
+		if(i % 2){changed.assign(key, i);}
+		else{changed.insert(rng(), i);}
+	}
+	report("copy on write changes", lookups, watch.seconds());
+	donotoptimize(sum);
+
+	remove(path);
+	return 0;
+}
@@ -0,0 +1,376 @@
+/*
+   Memory mapped tree snapshots
+
+   Rebuilding a big tree at startup costs an insert per key. A snapshot
+   instead writes the tree into one file whose nodes link to each other by
+   32-bit node index instead of by pointer, so the file means the same
+   wherever it is mapped. RbSnapshot::open() maps the file and serves
+   lookups and in-order scans straight from the mapping: nothing is parsed
+   or copied, the kernel pages the nodes in on first touch, and reopening
+   costs an mmap however big the tree is.
+
+   The file is a header followed by the nodes, laid out in key order so
+   that a scan reads the file sequentially. The links form a balanced
+   binary search tree over them (the middle node is the root, the middle
+   of each half its children, as in assign_sorted()), so a lookup descends
+   ceil(log2(n + 1)) nodes at most. Keys and values are stored as their
+   bytes and must be trivially copyable; a snapshot is read back by the
+   same build on the same architecture. Up to 2^32 - 1 nodes.
+
+   Opened with RbSnapshot::copyonwrite, the snapshot can be changed in
+   memory: inserts, new values and erases go to an RbTree of changes that
+   lookups and scans consult first, and the file itself is never written.
+   save() writes the merged state to a new snapshot, which may replace the
+   file the snapshot was opened from. Changes treat keys as unique.
+
+       RbSnapshot<uint64_t, Payload>::write(tree, "index.rb");
+       auto snapshot = RbSnapshot<uint64_t, Payload>::open("index.rb");
+       const Payload *payload = snapshot.find(key);
+*/
+
+#ifndef RB_SNAPSHOT_H
+#define RB_SNAPSHOT_H
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <type_traits>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "red black tree.h"
+
+template<typename Key, typename Value, typename Compare = std::less<Key>>
+class RbSnapshot{
+	static_assert(std::is_trivially_copyable<Key>::value && std::is_trivially_copyable<Value>::value,
+		"snapshots store keys and values as their bytes");
+
+public:
+	enum Mode{readonly, copyonwrite};
+
+	// Node of the file, links are node indices, nil for none
+	struct Node{
+		Key key;
+		Value value;
+		std::uint32_t left, right;
+	};
+
+	static constexpr std::uint32_t nil = 0xffffffff;
+
+	// Writes the nodes of tree to a new snapshot file at path
+	template<typename Alloc>
+	static void write(const RbTree<Key, Value, Compare, Alloc> &tree, const char *path){
+		writesorted(path, tree.size(), [&](Node *nodes){
+			for(const auto &rbnode : tree){
+				nodes->key = rbnode.key;
+				nodes->value = rbnode.value;
+				++nodes;
+			}
+		});
+	}
+
+	// Maps the snapshot at path. Throws std::system_error if the file
+	// cannot be mapped and std::runtime_error if it is no snapshot of
+	// this Key and Value
+	static RbSnapshot open(const char *path, Mode mode = readonly, const Compare &comp = Compare()){
+		int fd = ::open(path, O_RDONLY);
+		if(fd < 0){throw std::system_error(errno, std::generic_category(), path);}
+		struct stat st;
+		if(fstat(fd, &st) < 0){
+			int error = errno;
+			::close(fd);
+			throw std::system_error(error, std::generic_category(), path);
+		}
+		if(std::size_t(st.st_size) < sizeof(Header)){
+			::close(fd);
+			throw std::runtime_error(std::string(path) + ": not a snapshot, too short for its header");
+		}
+		RbSnapshot snapshot(mode, comp);
+		snapshot.length = st.st_size;
+		snapshot.mapping = mmap(nullptr, snapshot.length, PROT_READ, MAP_SHARED, fd, 0);
+		int error = errno;
+		::close(fd);
+		if(snapshot.mapping == MAP_FAILED){
+			throw std::system_error(error, std::generic_category(), path);
+		}
+
+		const Header *header = static_cast<const Header *>(snapshot.mapping);
+		if(std::memcmp(header->magic, magic, sizeof(magic)) ||
+			header->keysize != sizeof(Key) || header->valuesize != sizeof(Value) ||
+			header->nodesize != sizeof(Node)){
+			throw std::runtime_error(std::string(path) + ": not a snapshot of this tree type");
+		}
+		// divides instead of multiplying, a corrupt count must not wrap
+		if(header->count > (snapshot.length - sizeof(Header)) / sizeof(Node) ||
+			(header->count && header->root >= header->count)){
+			throw std::runtime_error(std::string(path) + ": not a snapshot, corrupt header");
+		}
+		snapshot.nodes = reinterpret_cast<const Node *>(header + 1);
+		snapshot.count = header->count;
+		snapshot.root = header->root;
+		return snapshot;
+	}
+
+	RbSnapshot(RbSnapshot &&other) noexcept:
+	mapping(other.mapping), length(other.length), nodes(other.nodes), count(other.count),
+	root(other.root), mode(other.mode), changes(std::move(other.changes)), added(other.added),
+	comp(std::move(other.comp)){
+		other.mapping = MAP_FAILED;
+		other.count = 0;
+		other.added = 0;
+	}
+
+	RbSnapshot(const RbSnapshot &) = delete;
+	RbSnapshot &operator=(const RbSnapshot &) = delete;
+
+	~RbSnapshot(){
+		if(mapping != MAP_FAILED){munmap(mapping, length);}
+	}
+
+	// The value of the key, nullptr if there is none. The pointer is
+	// valid until the key is changed
+	const Value *find(const Key &key) const{
+		if(mode == copyonwrite){
+			auto it = changes.find(key);
+			if(it != changes.end()){
+				return it->value.erased ? nullptr : &it->value.value;
+			}
+		}
+		const Node *node = findnode(key);
+		return node ? &node->value : nullptr;
+	}
+
+	bool contains(const Key &key) const{return find(key) != nullptr;}
+
+	std::size_t size() const{return count + added;}
+	bool empty() const{return size() == 0;}
+
+	// Calls visit(key, value) for every key in order
+	template<typename Visit>
+	void foreach(Visit visit) const{
+		merge(0, changes.begin(), [](const Key &){return true;}, visit);
+	}
+
+	// Calls visit(key, value) in key order for the keys in [lo, hi)
+	template<typename Visit>
+	void scan(const Key &lo, const Key &hi, Visit visit) const{
+		merge(lowerbound(lo), changes.lower_bound(lo), [&](const Key &key){return comp(key, hi);}, visit);
+	}
+
+	// Copy on write only. Inserts the key, returns false if it is there
+	bool insert(const Key &key, const Value &value){
+		changeable();
+		if(contains(key)){
+			return false;
+		}
+		auto result = changes.try_emplace(key, Change{value, false});
+		if(!result.second){result.first->value = Change{value, false};}
+		++added;
+		return true;
+	}
+
+	// Copy on write only. Gives the key a new value, returns false if the
+	// key is not there
+	bool assign(const Key &key, const Value &value){
+		changeable();
+		if(!contains(key)){
+			return false;
+		}
+		auto result = changes.try_emplace(key, Change{value, false});
+		if(!result.second){result.first->value.value = value;}
+		return true;
+	}
+
+	// Copy on write only. Returns false if the key was not there
+	bool erase(const Key &key){
+		changeable();
+		if(!contains(key)){
+			return false;
+		}
+		if(findnode(key)){
+			auto result = changes.try_emplace(key, Change{Value(), true});
+			if(!result.second){result.first->value.erased = true;}
+		}
+		else{
+			changes.erase(key);
+		}
+		--added;
+		return true;
+	}
+
+	// Writes the current contents, changes included, to a new snapshot
+	void save(const char *path) const{
+		writesorted(path, size(), [&](Node *nodes){
+			foreach([&](const Key &key, const Value &value){
+				nodes->key = key;
+				nodes->value = value;
+				++nodes;
+			});
+		});
+	}
+
+private:
+	struct Header{
+		char magic[8];
+		std::uint32_t keysize, valuesize, nodesize;
+		std::uint32_t root;
+		std::uint64_t count;
+	};
+
+	// A change made in copy on write mode
+	struct Change{
+		Value value;
+		bool erased;
+	};
+
+	static constexpr char magic[8] = {'R', 'B', 'S', 'N', 'A', 'P', '0', '1'};
+
+	// linksorted() builds trees of at most 32 levels
+	static constexpr int maxdepth = 32;
+
+	RbSnapshot(Mode mode, const Compare &comp): mode(mode), changes(comp), comp(comp){}
+
+	void changeable() const{
+		if(mode != copyonwrite){throw std::logic_error("snapshot opened read only");}
+	}
+
+	// The descents stop at a link that is nil or out of range, and after
+	// maxdepth steps in case corrupt links form a cycle
+	const Node *findnode(const Key &key) const{
+		std::uint32_t index = count ? root : nil;
+		for(int depth = 0; index < count && depth < maxdepth; ++depth){
+			const Node *node = &nodes[index];
+			if(comp(key, node->key)){index = node->left;}
+			else if(comp(node->key, key)){index = node->right;}
+			else{return node;}
+		}
+		return nullptr;
+	}
+
+	// Index of the first node not less than key, count if there is none
+	std::size_t lowerbound(const Key &key) const{
+		std::size_t result = count;
+		std::uint32_t index = count ? root : nil;
+		for(int depth = 0; index < count && depth < maxdepth; ++depth){
+			if(comp(nodes[index].key, key)){
+				index = nodes[index].right;
+			}
+			else{
+				result = index;
+				index = nodes[index].left;
+			}
+		}
+		return result;
+	}
+
+	// Visits the nodes from index i and the changes from it in key order
+	// while inrange(key) holds. Changes replace the nodes with their key
+	template<typename Iterator, typename InRange, typename Visit>
+	void merge(std::size_t i, Iterator it, InRange inrange, Visit visit) const{
+		auto end = changes.end();
+		while(true){
+			bool node = i < count && inrange(nodes[i].key);
+			bool change = it != end && inrange(it->key);
+			if(!node && !change){
+				break;
+			}
+			if(change && (!node || !comp(nodes[i].key, it->key))){
+				if(node && !comp(it->key, nodes[i].key)){++i;}
+				if(!it->value.erased){visit(it->key, it->value.value);}
+				++it;
+			}
+			else{
+				visit(nodes[i].key, nodes[i].value);
+				++i;
+			}
+		}
+	}
+
+	// Links nodes[lo, hi) into a balanced tree and returns its root
+	static std::uint32_t linksorted(Node *nodes, std::uint32_t lo, std::uint32_t hi){
+		if(lo == hi){
+			return nil;
+		}
+		std::uint32_t middle = lo + (hi - lo) / 2;
+		nodes[middle].left = linksorted(nodes, lo, middle);
+		nodes[middle].right = linksorted(nodes, middle + 1, hi);
+		return middle;
+	}
+
+	// Creates the file at path with room for n nodes, lets fill(nodes)
+	// write them in key order and links them. The file is written through
+	// a shared mapping, so nothing is buffered twice. It is built as
+	// path.tmp, synced and renamed over path, so that a crash leaves the
+	// old file or the new one, and fill() can read the file at path
+	// through a snapshot while it is replaced
+	template<typename Fill>
+	static void writesorted(const char *path, std::size_t n, Fill fill){
+		if(n >= nil){throw std::length_error("snapshot too large");}
+		std::size_t length = sizeof(Header) + n * sizeof(Node);
+		std::string temporary = std::string(path) + ".tmp";
+		int fd = ::open(temporary.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+		if(fd < 0){throw std::system_error(errno, std::generic_category(), temporary);}
+		void *mapping = MAP_FAILED;
+		auto fail = [&](int error, const std::string &what){
+			if(mapping != MAP_FAILED){munmap(mapping, length);}
+			::close(fd);
+			unlink(temporary.c_str());
+			throw std::system_error(error, std::generic_category(), what);
+		};
+		if(ftruncate(fd, length) < 0){fail(errno, temporary);}
+		mapping = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if(mapping == MAP_FAILED){fail(errno, temporary);}
+
+		Header *header = static_cast<Header *>(mapping);
+		Node *nodes = reinterpret_cast<Node *>(header + 1);
+		try{
+			fill(nodes);
+		}
+		catch(...){
+			munmap(mapping, length);
+			::close(fd);
+			unlink(temporary.c_str());
+			throw;
+		}
+		std::memcpy(header->magic, magic, sizeof(magic));
+		header->keysize = sizeof(Key);
+		header->valuesize = sizeof(Value);
+		header->nodesize = sizeof(Node);
+		header->count = n;
+		header->root = linksorted(nodes, 0, std::uint32_t(n));
+		if(msync(mapping, length, MS_SYNC) < 0 || fsync(fd) < 0){fail(errno, temporary);}
+		munmap(mapping, length);
+		mapping = MAP_FAILED;
+		if(rename(temporary.c_str(), path) < 0){fail(errno, path);}
+		::close(fd);
+
+		// the rename is durable once the directory is synced
+		std::string directory(path);
+		std::size_t slash = directory.rfind('/');
+		directory = slash == std::string::npos ? "." : slash ? directory.substr(0, slash) : "/";
+		int dirfd = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY);
+		if(dirfd >= 0){
+			fsync(dirfd);
+			::close(dirfd);
+		}
+	}
+
+	void *mapping = MAP_FAILED;
+	std::size_t length = 0;
+	const Node *nodes = nullptr;
+	std::size_t count = 0;
+	std::uint32_t root = nil;
+	Mode mode;
+	RbTree<Key, Change, Compare> changes;
+	std::ptrdiff_t added = 0; // inserted minus erased keys
+	Compare comp;
+};
+
+#endif
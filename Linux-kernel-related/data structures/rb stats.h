@@ -0,0 +1,247 @@
+/*
+   Red black tree statistics
+
+   Compiled with -DRB_TREE_STATS, RbTree counts what its operations do:
+   rotations, recolorings, iterations of the insert and erase fixup loops,
+   the length of the search path of every lookup, and the latency of every
+   insert, find and erase in a histogram. Without the flag the hooks
+   expand to nothing and the tree is the same code as before. The flag
+   must be the same in every translation unit of a program.
+
+   The counters are per thread, like the records of epoch.h, so counting
+   never writes to a cache line that another thread writes to. A thread
+   updates its own record with plain relaxed stores, and
+   RbStats::snapshot() adds up the records of the running threads and
+   what the exited ones left behind, without stopping anybody. The numbers
+   of one snapshot are not taken at one instant, but every counter only
+   grows, so monitoring can take differences between two snapshots.
+
+   The histograms are log-linear like HdrHistogram: values below 16 have
+   a bucket each, every power of two above that is cut into 16 buckets,
+   so a percentile is off by less than 1/16 of its value, and a histogram
+   is a fixed array of counts that costs an increment to update.
+   Latencies are in nanoseconds.
+
+       RbStats::write(std::cout, RbStats::snapshot());
+       RbStats::writeshape(std::cout, "timers", tree);
+
+   write() prints the Prometheus text format, one value per line.
+   writeshape() adds the size and the height of a tree against the
+   2 log2(n + 1) bound of red black trees; it walks the tree, so the
+   caller must hold whatever protects it from writers.
+*/
+
+#ifndef RB_STATS_H
+#define RB_STATS_H
+
+#ifdef RB_TREE_STATS
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+
+class RbStats{
+public:
+	enum Counter{rotations, recolors, insertfixups, erasefixups, ncounters};
+	enum Histograms{insertns, findns, erasens, searchpath, nhistograms};
+
+	// Log-linear histogram, values of 2^40 and above count in the last bucket
+	struct Histogram{
+		static constexpr int subbits = 4;
+		static constexpr int sub = 1 << subbits;
+		static constexpr int maxbits = 40;
+		static constexpr int buckets = (maxbits - subbits + 1) * sub;
+
+		static int bucket(std::uint64_t value){
+			if(value < std::uint64_t(sub)){
+				return int(value);
+			}
+			if(value >> maxbits){value = (std::uint64_t(1) << maxbits) - 1;}
+			int shift = 63 - __builtin_clzll(value) - subbits;
+			return (shift + 1) * sub + int(value >> shift & (sub - 1));
+		}
+
+		// The smallest value that goes to bucket b
+		static std::uint64_t lowest(int b){
+			if(b < sub){
+				return b;
+			}
+			int shift = b / sub - 1;
+			return std::uint64_t(sub + b % sub) << shift;
+		}
+
+		std::uint64_t total() const{
+			std::uint64_t n = 0;
+			for(std::uint64_t count : counts){n += count;}
+			return n;
+		}
+
+		// The value below which a fraction p of the recorded values lie,
+		// rounded up to the end of its bucket
+		std::uint64_t percentile(double p) const{
+			std::uint64_t n = total();
+			if(!n){
+				return 0;
+			}
+			std::uint64_t rank = std::uint64_t(std::ceil(p * n));
+			if(!rank){rank = 1;}
+			std::uint64_t seen = 0;
+			for(int b = 0; b < buckets; ++b){
+				seen += counts[b];
+				if(seen >= rank){return b + 1 < buckets ? lowest(b + 1) - 1 : lowest(b);}
+			}
+			return lowest(buckets - 1);
+		}
+
+		std::uint64_t counts[buckets] = {};
+	};
+
+	struct Snapshot{
+		std::uint64_t counters[ncounters] = {};
+		Histogram histograms[nhistograms];
+	};
+
+	// Times its scope into one of the latency histograms
+	class Timer{
+	public:
+		explicit Timer(Histograms histogram):
+		histogram(histogram), start(std::chrono::steady_clock::now()){}
+
+		~Timer(){
+			record(histogram, std::chrono::duration_cast<std::chrono::nanoseconds>(
+				std::chrono::steady_clock::now() - start).count());
+		}
+
+		Timer(const Timer &) = delete;
+		Timer &operator=(const Timer &) = delete;
+
+	private:
+		Histograms histogram;
+		std::chrono::steady_clock::time_point start;
+	};
+
+	static void add(Counter counter, std::uint64_t n){
+		bump(self().counters[counter], n);
+	}
+
+	static void record(Histograms histogram, std::uint64_t value){
+		bump(self().histograms[histogram][Histogram::bucket(value)], 1);
+	}
+
+	// Adds up the counts of every thread so far
+	static Snapshot snapshot(){
+		std::lock_guard<std::mutex> lock(registry);
+		Snapshot result = exited();
+		for(const Record *record = records; record; record = record->next){
+			record->addto(result);
+		}
+		return result;
+	}
+
+	static void write(std::ostream &out, const Snapshot &snapshot){
+		static const char *const counternames[ncounters] = {
+			"rb_rotations_total", "rb_recolors_total",
+			"rb_insert_fixup_iterations_total", "rb_erase_fixup_iterations_total"};
+		static const char *const histogramnames[nhistograms] = {
+			"rb_insert_ns", "rb_find_ns", "rb_erase_ns", "rb_search_path_length"};
+		static const struct{
+			const char *label;
+			double p;
+		} quantiles[] = {{"0.5", 0.5}, {"0.9", 0.9}, {"0.99", 0.99}, {"0.999", 0.999}, {"1", 1}};
+
+		for(int c = 0; c < ncounters; ++c){
+			out << counternames[c] << ' ' << snapshot.counters[c] << '\n';
+		}
+		for(int h = 0; h < nhistograms; ++h){
+			const Histogram &histogram = snapshot.histograms[h];
+			for(const auto &quantile : quantiles){
+				out << histogramnames[h] << "{quantile=\"" << quantile.label << "\"} "
+					<< histogram.percentile(quantile.p) << '\n';
+			}
+			out << histogramnames[h] << "_count " << histogram.total() << '\n';
+		}
+	}
+
+	// Prints the size and height of tree and the height bound for its size
+	template<typename Tree>
+	static void writeshape(std::ostream &out, const char *name, const Tree &tree){
+		std::size_t n = tree.size();
+		out << "rb_tree_size{tree=\"" << name << "\"} " << n << '\n';
+		out << "rb_tree_height{tree=\"" << name << "\"} " << tree.height() << '\n';
+		out << "rb_tree_height_bound{tree=\"" << name << "\"} "
+			<< std::size_t(2 * std::log2(double(n) + 1)) << '\n';
+	}
+
+private:
+	// Per thread counts, linked into the registry for its lifetime
+	struct alignas(64) Record{
+		Record(){
+			std::lock_guard<std::mutex> lock(registry);
+			next = records;
+			records = this;
+		}
+
+		// the counts of an exiting thread stay in the totals
+		~Record(){
+			std::lock_guard<std::mutex> lock(registry);
+			for(Record **link = &records; *link; link = &(*link)->next){
+				if(*link == this){
+					*link = next;
+					break;
+				}
+			}
+			addto(exited());
+		}
+
+		void addto(Snapshot &snapshot) const{
+			for(int c = 0; c < ncounters; ++c){
+				snapshot.counters[c] += counters[c].load(std::memory_order_relaxed);
+			}
+			for(int h = 0; h < nhistograms; ++h){
+				for(int b = 0; b < Histogram::buckets; ++b){
+					snapshot.histograms[h].counts[b] += histograms[h][b].load(std::memory_order_relaxed);
+				}
+			}
+		}
+
+		std::atomic<std::uint64_t> counters[ncounters] = {};
+		std::atomic<std::uint64_t> histograms[nhistograms][Histogram::buckets] = {};
+		Record *next = nullptr;
+	};
+
+	static Record &self(){
+		thread_local Record record;
+		return record;
+	}
+
+	// Only the owning thread writes, so no read-modify-write is needed
+	static void bump(std::atomic<std::uint64_t> &count, std::uint64_t n){
+		count.store(count.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+	}
+
+	// the counts left behind by exited threads
+	static Snapshot &exited(){
+		static Snapshot totals;
+		return totals;
+	}
+
+	static inline std::mutex registry;
+	static inline Record *records = nullptr;
+};
+
+#define RB_STAT(counter, n) RbStats::add(RbStats::counter, n)
+#define RB_STAT_VALUE(histogram, value) RbStats::record(RbStats::histogram, value)
+#define RB_STAT_TIME(histogram) RbStats::Timer rbstatstimer(RbStats::histogram)
+
+#else
+
+#define RB_STAT(counter, n) ((void)0)
+#define RB_STAT_VALUE(histogram, value) ((void)(value))
+#define RB_STAT_TIME(histogram) ((void)0)
+
+#endif
+
+#endif
@@ -0,0 +1,113 @@
+/*
+   Traversal benchmark
+
+   Full in-order scans of an RbTree with the recursive walk of printrbtree()
+   (with the printing replaced by summing the keys) against the iterators,
+   which step through the parent pointers without recursion or a stack.
+   Also compares the recursive getrbnode() style lookup with find(), and
+   a scan of a window of 100 keys with range() against filtering a walk
+   over the whole tree.
+
+   g++ -O2 -std=c++17 "rb traversal bench.cpp" && ./a.out 1000000 10000000 50000000
+*/
+
+#include <iostream>
+
+#include "benchmark.h"
+#include "red black tree.h"
+
+using namespace std;
+
+using Tree = RbTree<uint64_t, uint64_t>;
+using Node = Tree::Node;
+
+// printrbtree() without the I/O
+void recursivewalk(const Node *rbnode, uint64_t &sum){
+	if(rbnode){
+		recursivewalk(rbnode->left, sum);
+		sum += rbnode->key;
+		recursivewalk(rbnode->right, sum);
+	}
+}
+
+// getrbnode()
+const Node *recursivefind(uint64_t key, const Node *rbnode){
+	if(rbnode){
+		if(key < rbnode->key){
+			return recursivefind(key, rbnode->left);
+		}
+		else if(rbnode->key < key){
+			return recursivefind(key, rbnode->right);
+		}
+	}
+	return rbnode;
+}
+
+void run(size_t n){
+	vector<uint64_t> keys = randomkeys(n);
+	Tree tree;
+	for(uint64_t key : keys){tree.emplace(key, key);}
+	cout << "n = " << n << endl;
+
+	Stopwatch watch;
+	uint64_t sum = 0;
+	recursivewalk(tree.root(), sum);
+	donotoptimize(sum);
+	report("recursive in-order walk", n, watch.seconds());
+
+	watch.restart();
+	sum = 0;
+	for(const Node &rbnode : tree){sum += rbnode.key;}
+	donotoptimize(sum);
+	report("forward iterator scan", n, watch.seconds());
+
+	watch.restart();
+	sum = 0;
+	for(auto it = tree.rbegin(); it != tree.rend(); ++it){sum += it->key;}
+	donotoptimize(sum);
+	report("reverse iterator scan", n, watch.seconds());
+
+	watch.restart();
+	sum = 0;
+	for(uint64_t key : keys){sum += recursivefind(key, tree.root())->value;}
+	donotoptimize(sum);
+	report("recursive lookup", n, watch.seconds());
+
+	watch.restart();
+	sum = 0;
+	for(uint64_t key : keys){sum += tree.find(key)->value;}
+	donotoptimize(sum);
+	report("iterative lookup", n, watch.seconds());
+
+	// windows of 100 keys, the keys are 0 ... n - 1
+	size_t windows = 1000;
+	watch.restart();
+	sum = 0;
+	for(size_t i = 0; i < windows; ++i){
+		uint64_t lo = keys[i] / 2;
+		for(const Node &rbnode : tree.range(lo, lo + 100)){sum += rbnode.value;}
+	}
+	donotoptimize(sum);
+	report("window of 100 by range()", windows, watch.seconds());
+
+	size_t walks = windows / 100 + 1;
+	watch.restart();
+	sum = 0;
+	for(size_t i = 0; i < walks; ++i){
+		uint64_t lo = keys[i] / 2;
+		for(const Node &rbnode : tree){
+			if(rbnode.key >= lo && rbnode.key < lo + 100){sum += rbnode.value;}
+		}
+	}
+	donotoptimize(sum);
+	report("window of 100 by full walk", walks, watch.seconds());
+}
+
+int main(int argc, char **argv){
+	int runs = argc > 1 ? argc - 1 : 1;
+	for(int i = 0; i < runs; ++i){
+		run(argcount(argc, argv, i + 1, 1000000));
+	}
+
+	return 0;
+}
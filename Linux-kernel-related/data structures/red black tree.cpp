@@ -34,33 +34,66 @@ struct Rbnode{
 	Rbnode *parent, *left = nullptr, *right = nullptr;
 };
 
+// Gets the in-order successor of rbnode inside the subtree below top
+// (the parent of the subtree's root). Climbs through the parent pointers
+// instead of keeping a stack
+const Rbnode *nextrbnode(const Rbnode *rbnode, const Rbnode *top){
+	if(rbnode->right){
+		rbnode = rbnode->right;
+		while(rbnode->left){rbnode = rbnode->left;}
+		return rbnode;
+	}
+	while(rbnode->parent != top && rbnode == rbnode->parent->right){
+		rbnode = rbnode->parent;
+	}
+	return rbnode->parent != top ? rbnode->parent : nullptr;
+}
+
 // Prints the red black tree in ascending order
 void printrbtree(const Rbnode *rbnode){
-	if(rbnode){
-		printrbtree(rbnode->left);
+	if(!rbnode){
+		return;
+	}
+	const Rbnode *top = rbnode->parent;
+	while(rbnode->left){rbnode = rbnode->left;}
+	for(; rbnode; rbnode = nextrbnode(rbnode, top)){
 		cout << rbnode->key;
 		if(rbnode->color){cout << " red ";}
 		else{cout << " black ";}
 		if(rbnode->parent){cout << " " << rbnode->parent->key << endl;}
 		else{cout << " <-- root node" << endl;}
-		printrbtree(rbnode->right);
 	}
 }
 
-// Erases the red black tree and reallocates the memory
-void eraserbtree(Rbnode *&rbnode){
-	if(rbnode){
-		eraserbtree(rbnode->right);
-		eraserbtree(rbnode->left);
-		delete rbnode;
-		rbnode = nullptr;
+// Erases the red black tree and reallocates the memory. Deletes the
+// leaves bottom up, so no recursion is needed
+void eraserbtree(Rbnode *&rbroot){
+	Rbnode *rbnode = rbroot;
+	Rbnode *top = rbroot ? rbroot->parent : nullptr;
+	while(rbnode != top){
+		if(rbnode->left){
+			rbnode = rbnode->left;
+		}
+		else if(rbnode->right){
+			rbnode = rbnode->right;
+		}
+		else{
+			Rbnode *parent = rbnode->parent;
+			if(parent){
+				if(parent->left == rbnode){parent->left = nullptr;}
+				else{parent->right = nullptr;}
+			}
+			delete rbnode;
+			rbnode = parent;
+		}
 	}
+	rbroot = nullptr;
 }
 
 // Gets the sibling rbnode
 Rbnode *getsibling(Rbnode *rbnode){
 	if(rbnode->parent){
-		if(rbnode->key < rbnode->parent->key){
+		if(rbnode == rbnode->parent->left){
 			return rbnode->parent->right;
 		}
 		return rbnode->parent->left;
@@ -71,10 +104,7 @@ Rbnode *getsibling(Rbnode *rbnode){
 // Gets the uncle rbnode
 Rbnode *getuncle(Rbnode *rbnode){
 	if(rbnode->parent && rbnode->parent->parent){
-		if(rbnode->parent->key < rbnode->parent->parent->key){
-			return rbnode->parent->parent->right;
-		}
-		return rbnode->parent->parent->left;
+		return getsibling(rbnode->parent);
 	}
 	return nullptr;
 }
@@ -89,7 +119,7 @@ void leftrotate(Rbnode *rbnode, Rbnode *&rbroot){
 	rbnode->left = old;
 	old->parent = rbnode;
 	if(rbnode->parent){
-		if(rbnode->key < rbnode->parent->key){
+		if(rbnode->parent->left == old){
 			rbnode->parent->left = rbnode;
 		}
 		else{
@@ -111,7 +141,7 @@ void rightrotate(Rbnode *rbnode, Rbnode *&rbroot){
 	rbnode->right = old;
 	old->parent = rbnode;
 	if(rbnode->parent){
-		if(rbnode->key < rbnode->parent->key){
+		if(rbnode->parent->left == old){
 			rbnode->parent->left = rbnode;
 		}
 		else{
@@ -166,21 +196,21 @@ void insertrbnode(const int &key, Rbnode *&rbroot){
     			rbnode->parent->color = false;
     		}
     		else{
-    			if(rbnode->key < rbnode->parent->key && 
-    				rbnode->parent->key < rbnode->parent->parent->key){
+    			if(rbnode == rbnode->parent->left &&
+    				rbnode->parent == rbnode->parent->parent->left){
     				rightrotate(rbnode->parent->parent, rbroot);
     				rbnode->parent->color = false;
     				getsibling(rbnode)->color = true;
     			}
-    			else if(rbnode->parent->key < rbnode->key && 
-    				rbnode->key < rbnode->parent->parent->key){
+    			else if(rbnode == rbnode->parent->right &&
+    				rbnode->parent == rbnode->parent->parent->left){
     				leftrotate(rbnode->parent, rbroot);
     				rightrotate(rbnode->parent, rbroot);
     				rbnode->color = false;
     				rbnode->right->color = true;
     			}
-    			else if(rbnode->parent->parent->key < rbnode->parent->key && 
-    				rbnode->parent->key < rbnode->key){
+    			else if(rbnode == rbnode->parent->right &&
+    				rbnode->parent == rbnode->parent->parent->right){
     				leftrotate(rbnode->parent->parent, rbroot);
     				rbnode->parent->color = false;
     				getsibling(rbnode)->color = true;
@@ -202,12 +232,15 @@ void insertrbnode(const int &key, Rbnode *&rbroot){
 
 // Finds the rbnode with help of key
 Rbnode *getrbnode(const int &key, Rbnode *rbnode){
-	if(rbnode){
+	while(rbnode){
 		if(key < rbnode->key){
-			return getrbnode(key, rbnode->left);
+			rbnode = rbnode->left;
 		}
 		else if(rbnode->key < key){
-			return getrbnode(key, rbnode->right);
+			rbnode = rbnode->right;
+		}
+		else{
+			break;
 		}
 	}
 	return rbnode;
@@ -215,16 +248,16 @@ Rbnode *getrbnode(const int &key, Rbnode *rbnode){
 
 // Gets the right most rbnode (maximum) of subtree
 Rbnode *maximumrbnode(Rbnode *rbnode){
-	if(rbnode && rbnode->right){
-		return maximumrbnode(rbnode->right);
+	while(rbnode && rbnode->right){
+		rbnode = rbnode->right;
 	}
 	return rbnode;
 }
 
 // Gets the left most rbnode (minimum) of subtree
 Rbnode *minimumrbnode(Rbnode *rbnode){
-	if(rbnode && rbnode->left){
-		return minimumrbnode(rbnode->left);
+	while(rbnode && rbnode->left){
+		rbnode = rbnode->left;
 	}
 	return rbnode;
 }
@@ -237,112 +270,95 @@ Rbnode *getreplacer(Rbnode *rbnode){
 	else if(rbnode && rbnode->left){
 		return maximumrbnode(rbnode->left);
 	}
+	return nullptr;
 }
 
-// Removes rbnode from rbtre and fixes occured
-// violations
+// Removes rbnode from rbtree and fixes occured violations. A node with
+// two children takes over the key of its replacer, which has one child
+// at most and is unlinked instead. The sides are told apart by the links,
+// not by the keys, which stop being distinct once the key is copied
 void removerbnode(const int &key, Rbnode *&rbroot){
 	Rbnode *rbnode = getrbnode(key, rbroot);
 	if(!rbnode){
 		return;
 	}
 	Rbnode *repl = getreplacer(rbnode);
-    if(repl){
-    	rbnode->key = repl->key;
-    	if(rbroot == rbnode){rbroot->key = repl->key;}
-    }
-    rbnode = repl ? repl : rbnode;
-    if(!isblack(rbnode) || !isblack(rbnode->left) || !isblack(rbnode->right)){
-    	Rbnode *child = rbnode->left ? rbnode->left : rbnode->right;
-    	if(rbnode->parent){
-    		if(rbnode->key < rbnode->parent->key){
-    			rbnode->parent->left = child;
-    		}
-    		else{
-    			rbnode->parent->right = child;
-    		}
-    	}
-    	if(child){child->color = false;}
-    	delete rbnode;
-    	rbnode = nullptr;
-    	return;
-    }
+	if(repl){
+		rbnode->key = repl->key;
+		rbnode = repl;
+	}
 
-    Rbnode *copy = rbnode;
-    while(true){
-    	Rbnode *sibling = getsibling(rbnode);
-    	if(!rbnode->parent){
-    		rbnode->color = false;
-    		break;
-    	}
-		else if(isblack(rbnode->parent) && !isblack(sibling) &&
-			isblack(sibling->left) && isblack(sibling->right)){
-			if(rbnode->key < rbnode->parent->key){
-				leftrotate(rbnode->parent, rbroot);
+	Rbnode *child = rbnode->left ? rbnode->left : rbnode->right;
+	Rbnode *parent = rbnode->parent;
+	if(parent){
+		if(parent->left == rbnode){parent->left = child;}
+		else{parent->right = child;}
+	}
+	else{
+		rbroot = child;
+	}
+	if(child){child->parent = parent;}
+	bool black = isblack(rbnode);
+	delete rbnode;
+	if(!black){
+		return;
+	}
+
+	// A black node is missing on the paths through child
+	while(child != rbroot && isblack(child)){
+		if(child == parent->left){
+			Rbnode *sibling = parent->right;
+			if(!isblack(sibling)){
+				sibling->color = false;
+				parent->color = true;
+				leftrotate(parent, rbroot);
+				sibling = parent->right;
 			}
-			else{
-				rightrotate(rbnode->parent, rbroot);
+			if(isblack(sibling->left) && isblack(sibling->right)){
+				sibling->color = true;
+				child = parent;
+				parent = child->parent;
+				continue;
 			}
-			sibling->color = false;
-			rbnode->parent->color = true;
-		}
-		else if(isblack(rbnode->parent) && isblack(sibling) &&
-			isblack(sibling->left) && isblack(sibling->right)){
-			sibling->color = true;
-		    rbnode = rbnode->parent;
-		}
-		else if(!isblack(rbnode->parent) && isblack(sibling) && 
-			isblack(sibling->left) && isblack(sibling->right)){
-			rbnode->parent->color = false;
-		    sibling->color = true;
-
-		    break;
-		}
-		else if(isblack(rbnode->parent) && isblack(sibling) &&
-			((rbnode->key < rbnode->parent->key) && !isblack(sibling->left) &&
-				isblack(sibling->right)) || (rbnode->parent->key < rbnode->key) &&
-			isblack(sibling->left) && !isblack(sibling->right)){
-			if(rbnode->key < rbnode->parent->key){
+			if(isblack(sibling->right)){
+				sibling->left->color = false;
+				sibling->color = true;
 				rightrotate(sibling, rbroot);
-			    sibling->color = true;
-			    sibling->parent->color = false;
-			}
-			else if(rbnode->parent->key < rbnode->key){
-				leftrotate(sibling, rbroot);
-			    sibling->color = true;
-			    sibling->parent->color = false;
+				sibling = parent->right;
 			}
+			sibling->color = parent->color;
+			parent->color = false;
+			sibling->right->color = false;
+			leftrotate(parent, rbroot);
 		}
-		else if(isblack(sibling)){
-			if(rbnode->key < rbnode->parent->key &&
-				!isblack(sibling->right)){
-				leftrotate(rbnode->parent, rbroot);
-                sibling->color = rbnode->parent->color;
-                rbnode->parent->color = false;
-                sibling->right->color = false;
+		else{
+			Rbnode *sibling = parent->left;
+			if(!isblack(sibling)){
+				sibling->color = false;
+				parent->color = true;
+				rightrotate(parent, rbroot);
+				sibling = parent->left;
 			}
-			else if(rbnode->parent->key < rbnode->key &&
-				!isblack(sibling->left)){
-				rightrotate(rbnode->parent, rbroot);
-                sibling->color = rbnode->parent->color;
-                rbnode->parent->color = false;
-                sibling->left->color = false;
+			if(isblack(sibling->left) && isblack(sibling->right)){
+				sibling->color = true;
+				child = parent;
+				parent = child->parent;
+				continue;
 			}
+			if(isblack(sibling->left)){
+				sibling->right->color = false;
+				sibling->color = true;
+				leftrotate(sibling, rbroot);
+				sibling = parent->left;
+			}
+			sibling->color = parent->color;
+			parent->color = false;
+			sibling->left->color = false;
+			rightrotate(parent, rbroot);
 		}
-    }
-
-    Rbnode *child = copy->left ? copy->left : copy->right;
-    if(copy->parent){
-    	if(copy->key < copy->parent->key){
-    		copy->parent->left = child;
-        }
-        else{
-        	copy->parent->right = child;
-        }
-    }
-    if(rbroot == copy){rbroot = nullptr;}
-    delete copy;
-    copy = nullptr;
+		child = rbroot;
+	}
+	if(child){child->color = false;}
 }
 
 int main(){
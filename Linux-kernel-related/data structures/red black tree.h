@@ -0,0 +1,1504 @@
+/*
+   Generic red black tree
+
+   The same red black tree as in red black tree.cpp, but as a header only
+   container template RbTree<Key, Value, Compare, Alloc>. The key can be any
+   type that the comparator can order (64-bit timestamps, small structs...)
+   and every node carries a value next to the key. The comparator is a
+   template parameter, so the calls to it get inlined into the descent loops
+   instead of going through a function pointer. Values are constructed in
+   place inside the node with emplace(), so a payload is never copied on its
+   way into the tree and move only types work as well.
+
+   Like insertrbnode(), emplace() sends equal keys to the right, so the tree
+   keeps duplicates in insertion order. try_emplace() inserts only when the
+   key is not yet present.
+
+       RbTree<uint64_t, Payload> tree;
+       tree.emplace(timestamp, arg1, arg2);   // Payload(arg1, arg2) in place
+       auto it = tree.find(timestamp);
+       if(it != tree.end()){
+           use(it->value);
+       }
+       tree.erase(timestamp);
+
+   Nothing in the tree recurses. Lookups descend in a loop, clear() tears
+   the tree down bottom up and the bidirectional iterators step to the in
+   order successor or predecessor through the parent pointers, so a scan of
+   any size needs neither recursion nor an auxiliary stack. An iterator
+   dereferences to the node; its value may be changed, its key must not.
+
+   assign_sorted() builds the tree from a sorted range of (key, value)
+   pairs in linear time instead of n inserts with a fixup each. The range
+   is split at the middle recursively, which gives every path from the
+   root to a null link the same length within one, so it is enough to
+   color the nodes on the deepest, incomplete level red and all the others
+   black. With an allocator that can reserve (RbArena) all the nodes come
+   from one contiguous block, laid out in key order.
+
+   Keys that arrive nearly sorted need not be looked for from the root.
+   The tree keeps its rightmost node, so emplace_hint(end(), ...) appends
+   a key not less than the maximum without any descent. Other hints, and
+   the fingers of find_from(), are climbed from through the parent
+   pointers to the smallest subtree whose key range holds the key and
+   searched from there, O(log d) for a key d positions away from the
+   finger. emplace_near() and find_near() keep the last node they touched
+   as the finger themselves.
+
+   lower_bound(), upper_bound() and equal_range() work like those of
+   std::multimap, and range(), scan() and count_range() visit the keys in
+   [lo, hi), all in O(log n + k) for k nodes in the range instead of a walk
+   over the whole tree.
+
+   join(), split() and the set operations setunion(), setintersection()
+   and setdifference() move whole subtrees between trees instead of
+   inserting node by node, following the join based algorithms of
+   Blelloch, Ferizovic and Sun ("Just join for parallel ordered sets").
+   Their two recursive halves are independent, so they can run on a
+   ThreadPool.
+
+   parallel_for_each() and parallel_reduce() visit the whole tree the same
+   way: the halves below the top nodes go to the work stealing ThreadPool
+   and every small subtree is walked with the iterators. parallel_reduce()
+   combines in key order, so it also collects ordered results.
+
+   After long insert and erase churn the nodes lie wherever the allocator
+   had room, and every step of a lookup or scan is a cache miss on its
+   own. On an RbArena, compact() moves all the nodes into one fresh block
+   in preorder or van Emde Boas order and drops the old chunks.
+
+   Compiled with -DRB_TREE_STATS the tree counts its rotations, recolorings
+   and fixup iterations and records search path lengths and operation
+   latencies (rb stats.h); height() gives the current height to compare
+   with the 2 log2(n + 1) bound.
+*/
+
+#ifndef RED_BLACK_TREE_H
+#define RED_BLACK_TREE_H
+
+#include <cassert>
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "rb stats.h"
+#include "thread pool.h"
+
+// Detects allocators (like RbArena) that can release all their objects
+// at once, which lets the tree skip deallocating node by node
+template<typename Alloc, typename = void>
+struct hasrelease: std::false_type{};
+
+template<typename Alloc>
+struct hasrelease<Alloc, std::void_t<decltype(std::declval<Alloc &>().release())>>:
+std::true_type{};
+
+// Detects allocators that can set aside room for n objects in one block
+template<typename Alloc, typename = void>
+struct hasreserve: std::false_type{};
+
+template<typename Alloc>
+struct hasreserve<Alloc, std::void_t<decltype(std::declval<Alloc &>().reserve(std::size_t()))>>:
+std::true_type{};
+
+// Detects comparators that order keys against other types too (like
+// std::less<>), which lets lookups take those types as they are
+template<typename Compare, typename = void>
+struct istransparent: std::false_type{};
+
+template<typename Compare>
+struct istransparent<Compare, std::void_t<typename Compare::is_transparent>>: std::true_type{};
+
+// rbtree node definition
+template<typename Key, typename Value>
+struct RbTreeNode{
+	template<typename K, typename... Args>
+	RbTreeNode(RbTreeNode *parent, K &&key, Args&&... args):
+	key(std::forward<K>(key)), value(std::forward<Args>(args)...), parent(parent){}
+
+	Key key;
+	Value value;
+	bool color = true; // true = red, false = black
+	RbTreeNode *parent, *left = nullptr, *right = nullptr;
+};
+
+template<typename Key, typename Value, typename Compare = std::less<Key>,
+	typename Alloc = std::allocator<std::pair<const Key, Value>>>
+class RbTree{
+public:
+	using Node = RbTreeNode<Key, Value>;
+	using NodeAlloc = typename std::allocator_traits<Alloc>::template rebind_alloc<Node>;
+	using NodeTraits = std::allocator_traits<NodeAlloc>;
+
+	// Bidirectional in-order iterator, end() is the null node
+	template<bool Const>
+	class Iterator{
+	public:
+		using iterator_category = std::bidirectional_iterator_tag;
+		using value_type = Node;
+		using difference_type = std::ptrdiff_t;
+		using pointer = typename std::conditional<Const, const Node *, Node *>::type;
+		using reference = typename std::conditional<Const, const Node &, Node &>::type;
+
+		Iterator() = default;
+		Iterator(Node *rbnode, const RbTree *tree): rbnode(rbnode), tree(tree){}
+
+		operator Iterator<true>() const{return Iterator<true>(rbnode, tree);}
+
+		reference operator*() const{return *rbnode;}
+		pointer operator->() const{return rbnode;}
+
+		Iterator &operator++(){
+			rbnode = successor(rbnode);
+			return *this;
+		}
+
+		Iterator operator++(int){
+			Iterator old = *this;
+			++*this;
+			return old;
+		}
+
+		// Stepping back from end() gets the maximum
+		Iterator &operator--(){
+			rbnode = rbnode ? predecessor(rbnode) : tree->maximum();
+			return *this;
+		}
+
+		Iterator operator--(int){
+			Iterator old = *this;
+			--*this;
+			return old;
+		}
+
+		bool operator==(const Iterator &other) const{return rbnode == other.rbnode;}
+		bool operator!=(const Iterator &other) const{return rbnode != other.rbnode;}
+
+		Node *node() const{return rbnode;}
+
+	private:
+		Node *rbnode = nullptr;
+		const RbTree *tree = nullptr;
+	};
+
+	using iterator = Iterator<false>;
+	using const_iterator = Iterator<true>;
+
+	// A pair of iterators for range based for loops
+	template<bool Const>
+	struct Range{
+		Iterator<Const> first, last;
+
+		Iterator<Const> begin() const{return first;}
+		Iterator<Const> end() const{return last;}
+	};
+	using reverse_iterator = std::reverse_iterator<iterator>;
+	using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+
+	RbTree() = default;
+
+	explicit RbTree(const Compare &comp, const Alloc &alloc = Alloc()):
+	comp(comp), alloc(alloc){}
+
+	RbTree(RbTree &&other) noexcept:
+	rbroot(other.rbroot), rightmost(other.rightmost), finger(other.finger), count(other.count),
+	comp(std::move(other.comp)), alloc(std::move(other.alloc)){
+		other.rbroot = other.rightmost = other.finger = nullptr;
+		other.count = 0;
+	}
+
+	RbTree &operator=(RbTree &&other) noexcept{
+		if(this != &other){
+			clear();
+			rbroot = other.rbroot;
+			rightmost = other.rightmost;
+			finger = other.finger;
+			count = other.count;
+			comp = std::move(other.comp);
+			alloc = std::move(other.alloc);
+			other.rbroot = other.rightmost = other.finger = nullptr;
+			other.count = 0;
+		}
+		return *this;
+	}
+
+	RbTree(const RbTree &) = delete;
+	RbTree &operator=(const RbTree &) = delete;
+
+	~RbTree(){clear();}
+
+	// Inserts a new node, constructing the value in place from args.
+	// Equal keys are placed to the right of the existing ones
+	template<typename K, typename... Args>
+	iterator emplace(K &&key, Args&&... args){
+		RB_STAT_TIME(insertns);
+		Node *parent = nullptr;
+		bool left = false;
+		descend(rbroot, probe(key), parent, left);
+		Node *rbnode = createnode(parent, std::forward<K>(key), std::forward<Args>(args)...);
+		return iterator(link(rbnode, parent, left), this);
+	}
+
+	// Inserts a new node like emplace(), looking for its place from hint
+	// instead of from the root. With end() (or the maximum) as hint, a key
+	// not less than the maximum is linked right below it in O(1). A key
+	// that goes right next to the hint, where the hint has a free link, is
+	// linked there once the neighbour on that side is checked
+	template<typename K, typename... Args>
+	iterator emplace_hint(const_iterator hint, K &&key, Args&&... args){
+		RB_STAT_TIME(insertns);
+		const auto &lookup = probe(key);
+		Node *from = hint.node() ? hint.node() : rightmost;
+		Node *parent = from;
+		bool left = false;
+		if(from && from != rightmost && !comp(lookup, from->key)){
+			Node *next = from->right ? nullptr : successor(from);
+			if(from->right || (next && !comp(lookup, next->key))){
+				descend(climb(from, lookup, true), lookup, parent, left);
+			}
+		}
+		else if(from && comp(lookup, from->key)){
+			Node *prev = from->left ? nullptr : predecessor(from);
+			left = true;
+			if(from->left || (prev && comp(lookup, prev->key))){
+				descend(climb(from, lookup, true), lookup, parent, left);
+			}
+		}
+		Node *rbnode = createnode(parent, std::forward<K>(key), std::forward<Args>(args)...);
+		return iterator(link(rbnode, parent, left), this);
+	}
+
+	// emplace_hint() from the node last inserted or found by emplace_near()
+	// or find_near(), from the maximum at first
+	template<typename K, typename... Args>
+	iterator emplace_near(K &&key, Args&&... args){
+		iterator it = emplace_hint(const_iterator(finger, this), std::forward<K>(key), std::forward<Args>(args)...);
+		finger = it.node();
+		return it;
+	}
+
+	// Inserts a new node only if the key is not in the tree yet. Returns
+	// the node with the key and whether it was inserted
+	template<typename K, typename... Args>
+	std::pair<iterator, bool> try_emplace(K &&key, Args&&... args){
+		RB_STAT_TIME(insertns);
+		const auto &lookup = probe(key);
+		Node *parent = nullptr;
+		bool left = false;
+		for(Node *rbnode = rbroot; rbnode;){
+			parent = rbnode;
+			if(comp(lookup, rbnode->key)){
+				left = true;
+				rbnode = rbnode->left;
+			}
+			else if(comp(rbnode->key, lookup)){
+				left = false;
+				rbnode = rbnode->right;
+			}
+			else{
+				return {iterator(rbnode, this), false};
+			}
+		}
+		Node *rbnode = createnode(parent, std::forward<K>(key), std::forward<Args>(args)...);
+		return {iterator(link(rbnode, parent, left), this), true};
+	}
+
+	// Finds a node with the key, end() if there is none
+	iterator find(const Key &key){
+		RB_STAT_TIME(findns);
+		return iterator(findnode(key), this);
+	}
+
+	const_iterator find(const Key &key) const{
+		RB_STAT_TIME(findns);
+		return const_iterator(findnode(key), this);
+	}
+
+	bool contains(const Key &key) const{
+		RB_STAT_TIME(findns);
+		return findnode(key) != nullptr;
+	}
+
+	// With a transparent comparator (one that has is_transparent, like
+	// std::less<>) the lookups also take any type it can order against
+	// the keys, such as a std::string_view for std::string keys, without
+	// building a Key for it
+	template<typename K, typename C = Compare, typename = typename C::is_transparent>
+	iterator find(const K &key){
+		RB_STAT_TIME(findns);
+		return iterator(findnode(key), this);
+	}
+
+	template<typename K, typename C = Compare, typename = typename C::is_transparent>
+	const_iterator find(const K &key) const{
+		RB_STAT_TIME(findns);
+		return const_iterator(findnode(key), this);
+	}
+
+	template<typename K, typename C = Compare, typename = typename C::is_transparent>
+	bool contains(const K &key) const{
+		RB_STAT_TIME(findns);
+		return findnode(key) != nullptr;
+	}
+
+	// Finds a node with the key searching from the node of it, end() if
+	// there is none. From end() the search starts at the maximum
+	iterator find_from(const_iterator it, const Key &key){
+		RB_STAT_TIME(findns);
+		Node *from = it.node() ? it.node() : rightmost;
+		return iterator(from ? findbelow(climb(from, key, false), key) : nullptr, this);
+	}
+
+	const_iterator find_from(const_iterator it, const Key &key) const{
+		RB_STAT_TIME(findns);
+		Node *from = it.node() ? it.node() : rightmost;
+		return const_iterator(from ? findbelow(climb(from, key, false), key) : nullptr, this);
+	}
+
+	// find_from() the node last inserted or found by emplace_near() or
+	// find_near()
+	iterator find_near(const Key &key){
+		iterator it = find_from(const_iterator(finger, this), key);
+		if(it != end()){finger = it.node();}
+		return it;
+	}
+
+	// Gets the first node with a key not less than key, end() if there is
+	// none. Of equal keys that is the one inserted first
+	iterator lower_bound(const Key &key){return iterator(lowerbound(key), this);}
+	const_iterator lower_bound(const Key &key) const{return const_iterator(lowerbound(key), this);}
+
+	// Gets the first node with a key greater than key, end() if there is none
+	iterator upper_bound(const Key &key){return iterator(upperbound(key), this);}
+	const_iterator upper_bound(const Key &key) const{return const_iterator(upperbound(key), this);}
+
+	template<typename K, typename C = Compare, typename = typename C::is_transparent>
+	iterator lower_bound(const K &key){return iterator(lowerbound(key), this);}
+	template<typename K, typename C = Compare, typename = typename C::is_transparent>
+	const_iterator lower_bound(const K &key) const{return const_iterator(lowerbound(key), this);}
+	template<typename K, typename C = Compare, typename = typename C::is_transparent>
+	iterator upper_bound(const K &key){return iterator(upperbound(key), this);}
+	template<typename K, typename C = Compare, typename = typename C::is_transparent>
+	const_iterator upper_bound(const K &key) const{return const_iterator(upperbound(key), this);}
+
+	// Gets the nodes with the key, in insertion order
+	std::pair<iterator, iterator> equal_range(const Key &key){
+		return {lower_bound(key), upper_bound(key)};
+	}
+
+	std::pair<const_iterator, const_iterator> equal_range(const Key &key) const{
+		return {lower_bound(key), upper_bound(key)};
+	}
+
+	template<typename K, typename C = Compare, typename = typename C::is_transparent>
+	std::pair<iterator, iterator> equal_range(const K &key){
+		return {lower_bound(key), upper_bound(key)};
+	}
+
+	template<typename K, typename C = Compare, typename = typename C::is_transparent>
+	std::pair<const_iterator, const_iterator> equal_range(const K &key) const{
+		return {lower_bound(key), upper_bound(key)};
+	}
+
+	// Iterates over the nodes with keys in [lo, hi):
+	// for(auto &rbnode : tree.range(lo, hi)){...}
+	Range<false> range(const Key &lo, const Key &hi){
+		if(!comp(lo, hi)){return {end(), end()};}
+		return {lower_bound(lo), lower_bound(hi)};
+	}
+
+	Range<true> range(const Key &lo, const Key &hi) const{
+		if(!comp(lo, hi)){return {end(), end()};}
+		return {lower_bound(lo), lower_bound(hi)};
+	}
+
+	// Calls visit(rbnode) for the nodes with keys in [lo, hi) in order,
+	// O(log n + k) for k nodes
+	template<typename Visit>
+	void scan(const Key &lo, const Key &hi, Visit visit){
+		for(Node *rbnode = lowerbound(lo); rbnode && comp(rbnode->key, hi); rbnode = successor(rbnode)){
+			visit(*rbnode);
+		}
+	}
+
+	template<typename Visit>
+	void scan(const Key &lo, const Key &hi, Visit visit) const{
+		for(const Node *rbnode = lowerbound(lo); rbnode && comp(rbnode->key, hi); rbnode = successor(rbnode)){
+			visit(*rbnode);
+		}
+	}
+
+	// Counts the nodes with keys in [lo, hi) by stepping through them,
+	// O(log n + k)
+	std::size_t count_range(const Key &lo, const Key &hi) const{
+		std::size_t n = 0;
+		scan(lo, hi, [&n](const Node &){++n;});
+		return n;
+	}
+
+	// Removes one node with the key. Returns false if there was none
+	bool erase(const Key &key){
+		RB_STAT_TIME(erasens);
+		Node *rbnode = findnode(key);
+		if(!rbnode){
+			return false;
+		}
+		unlink(rbnode);
+		destroynode(rbnode);
+		return true;
+	}
+
+	// Removes the node from the tree and releases it. Returns the iterator
+	// to the next node
+	iterator erase(const_iterator pos){
+		RB_STAT_TIME(erasens);
+		Node *rbnode = pos.node();
+		Node *next = successor(rbnode);
+		unlink(rbnode);
+		destroynode(rbnode);
+		return iterator(next, this);
+	}
+
+	// Releases every node. Walks the tree bottom up through the parent
+	// pointers, so no recursion is needed. With an allocator that can
+	// release all of its nodes at once the walk only runs destructors,
+	// and is skipped completely when they are trivial
+	void clear(){
+		if constexpr(hasrelease<NodeAlloc>::value){
+			if constexpr(!std::is_trivially_destructible<Node>::value){
+				destroyall(false);
+			}
+			alloc.release();
+		}
+		else{
+			destroyall(true);
+		}
+		rbroot = rightmost = finger = nullptr;
+		count = 0;
+	}
+
+	// Replaces the contents with a sorted range of (key, value) pairs in
+	// O(n). With unique only the first of equal keys is kept
+	template<typename ForwardIt>
+	void assign_sorted(ForwardIt first, ForwardIt last, bool unique = false){
+		clear();
+		std::size_t n = 0;
+		for(ForwardIt it = first; it != last; ++n){it = nextkey(it, last, unique);}
+		if(!n){
+			return;
+		}
+		if constexpr(hasreserve<NodeAlloc>::value){alloc.reserve(n);}
+
+		std::vector<Node *> nodes;
+		nodes.reserve(n);
+		try{
+			for(ForwardIt it = first; it != last; it = nextkey(it, last, unique)){
+				nodes.push_back(createnode(nullptr, it->first, it->second));
+			}
+		}
+		catch(...){
+			for(Node *rbnode : nodes){destroynode(rbnode);}
+			throw;
+		}
+
+		// a complete tree has no red nodes, otherwise the deepest level is red
+		int reddepth = -1;
+		if((n + 1) & n){
+			reddepth = 0;
+			while(n >> (reddepth + 1)){++reddepth;}
+		}
+		rbroot = linksorted(nodes.data(), n, 0, reddepth);
+		rbroot->parent = nullptr;
+		rightmost = nodes.back();
+		count = n;
+	}
+
+	// Appends the nodes of right, whose keys must all be greater than or
+	// equal to the keys of this tree, in O(log n)
+	void join(RbTree &&right){
+		static_assert(!hasrelease<NodeAlloc>::value,
+			"nodes cannot move between trees that release their arenas at once");
+		assert(alloc == right.alloc);
+		Sub result = join2(Sub{rbroot, blackheight(rbroot)},
+			Sub{right.rbroot, blackheight(right.rbroot)});
+		rbroot = result.root;
+		if(right.rightmost){rightmost = right.rightmost;}
+		count += right.count;
+		right.rbroot = right.rightmost = right.finger = nullptr;
+		right.count = 0;
+	}
+
+	// Moves the nodes with keys greater than or equal to key into the
+	// returned tree in O(log n), plus the walk that counts the smaller of
+	// the two
+	RbTree split(const Key &key){
+		static_assert(!hasrelease<NodeAlloc>::value,
+			"nodes cannot move between trees that release their arenas at once");
+		RbTree right(comp, Alloc(alloc));
+		Sub l, r;
+		splitbefore(Sub{rbroot, blackheight(rbroot)}, key, l, r);
+		rbroot = l.root;
+		right.rbroot = r.root;
+		right.rightmost = r.root ? rightmost : nullptr;
+		rightmost = maximumof(rbroot);
+		finger = nullptr;
+		// both halves in step until the smaller one ends, so size() stays
+		// a plain read that concurrent readers can share
+		std::size_t counted = 0;
+		const Node *lnode = minimumof(rbroot), *rnode = minimumof(right.rbroot);
+		while(lnode && rnode){
+			lnode = successor(lnode);
+			rnode = successor(rnode);
+			++counted;
+		}
+		right.count = lnode ? counted : count - counted;
+		count -= right.count;
+		return right;
+	}
+
+	// Set operations. They treat both trees as sets, take over the nodes
+	// of other and leave it empty. They split this tree at the root key of
+	// other, recurse on both halves and join the results, which costs
+	// O(m log(n/m + 1)) for trees of m <= n nodes instead of m inserts or
+	// lookups. With a pool, halves above a size cutoff run in parallel.
+	// The trees must use equal allocators
+
+	// Adds the keys of other that are not in this tree. For keys in both,
+	// the node of this tree stays
+	void setunion(RbTree &&other, ThreadPool *pool = nullptr){
+		setoperation(other, SetOperation::unite, pool);
+	}
+
+	// Keeps the keys that are in other too
+	void setintersection(RbTree &&other, ThreadPool *pool = nullptr){
+		setoperation(other, SetOperation::intersect, pool);
+	}
+
+	// Removes the keys that are in other
+	void setdifference(RbTree &&other, ThreadPool *pool = nullptr){
+		setoperation(other, SetOperation::subtract, pool);
+	}
+
+	// Parallel traversals. They split the tree at its top nodes into
+	// subtrees, hand the halves to the pool down to subtrees of about
+	// 2^parallelblackheight nodes and walk those through the iterators, so
+	// work stealing spreads the pieces over the threads however unevenly
+	// they come out. Without a pool they run on the calling thread. Nothing
+	// may change the tree while they run
+
+	// Calls visit(node) for every node, in no particular order and from
+	// several threads at once. visit may change the values, not the keys
+	template<typename Visit>
+	void parallel_for_each(Visit visit, ThreadPool *pool = nullptr){
+		foreachbelow(rbroot, blackheight(rbroot), visit, pool);
+	}
+
+	template<typename Visit>
+	void parallel_for_each(Visit visit, ThreadPool *pool = nullptr) const{
+		auto constvisit = [&visit](const Node &rbnode){visit(rbnode);};
+		foreachbelow(rbroot, blackheight(rbroot), constvisit, pool);
+	}
+
+	// Folds map(node) over all nodes with combine, starting from identity.
+	// The results are combined in key order, the left subtree's before the
+	// node's before the right subtree's, so combine only has to be
+	// associative: concatenating gives the values in order, as
+	// std::reduce would not promise
+	template<typename T, typename Map, typename Combine>
+	T parallel_reduce(T identity, Map map, Combine combine, ThreadPool *pool = nullptr) const{
+		return reducebelow(rbroot, blackheight(rbroot), identity, map, combine, pool);
+	}
+
+	// Node orders for compact(). Preorder puts every node in front of its
+	// subtrees, the left one first. Van Emde Boas order cuts the tree at
+	// half its height and puts the top part first, then the subtrees
+	// hanging below it one after the other, each laid out the same way,
+	// so a descent of any length touches about log_B(n) blocks of B nodes
+	// without knowing B (cache lines, pages, TLB reach all at once)
+	enum Layout{preorder, vanemdeboas};
+
+	// Moves every node into one contiguous block of a new arena, in the
+	// given order, and releases the old arena with everything churn left
+	// scattered in it. O(n) plus the height walk; all iterators and node
+	// pointers are invalidated, nothing else changes
+	void compact(Layout layout = vanemdeboas){
+		static_assert(hasrelease<NodeAlloc>::value && hasreserve<NodeAlloc>::value,
+			"compact() needs an allocator that reserves and releases blocks, like RbArena");
+		static_assert(std::is_nothrow_move_constructible<Key>::value &&
+			std::is_nothrow_move_constructible<Value>::value,
+			"compact() cannot undo a move that throws halfway");
+		if(!rbroot){
+			return;
+		}
+		std::vector<Node *> order;
+		order.reserve(size());
+		if(layout == preorder){preorderof(rbroot, order);}
+		else{vanemdeboasof(rbroot, height(), order);}
+
+		NodeAlloc fresh;
+		fresh.reserve(order.size());
+		// parents come before their children in both orders, so the copy
+		// of the parent exists already; every old node keeps a pointer to
+		// its copy in its parent field from then on
+		for(Node *old : order){
+			Node *parent = old->parent ? old->parent->parent : nullptr;
+			Node *rbnode = NodeTraits::allocate(fresh, 1);
+			NodeTraits::construct(fresh, rbnode, parent, std::move(old->key), std::move(old->value));
+			rbnode->color = old->color;
+			if(parent){
+				if(old->parent->left == old){parent->left = rbnode;}
+				else{parent->right = rbnode;}
+			}
+			old->parent = rbnode;
+		}
+		rbroot = rbroot->parent;
+		rightmost = rightmost->parent;
+		if(finger){finger = finger->parent;}
+		if constexpr(!std::is_trivially_destructible<Node>::value){
+			for(Node *old : order){NodeTraits::destroy(alloc, old);}
+		}
+		alloc.release();
+		alloc = std::move(fresh);
+	}
+
+	// Gets the left most node (minimum), nullptr if the tree is empty
+	Node *minimum() const{
+		Node *rbnode = rbroot;
+		while(rbnode && rbnode->left){rbnode = rbnode->left;}
+		return rbnode;
+	}
+
+	// Gets the right most node (maximum), nullptr if the tree is empty.
+	// The tree keeps it, O(1)
+	Node *maximum() const{return rightmost;}
+
+	iterator begin(){return iterator(minimum(), this);}
+	iterator end(){return iterator(nullptr, this);}
+	const_iterator begin() const{return const_iterator(minimum(), this);}
+	const_iterator end() const{return const_iterator(nullptr, this);}
+	const_iterator cbegin() const{return begin();}
+	const_iterator cend() const{return end();}
+	reverse_iterator rbegin(){return reverse_iterator(end());}
+	reverse_iterator rend(){return reverse_iterator(begin());}
+	const_reverse_iterator rbegin() const{return const_reverse_iterator(end());}
+	const_reverse_iterator rend() const{return const_reverse_iterator(begin());}
+
+	// Gets the in-order successor of rbnode, nullptr after the maximum
+	static Node *successor(const Node *rbnode){
+		if(rbnode->right){
+			rbnode = rbnode->right;
+			while(rbnode->left){rbnode = rbnode->left;}
+			return const_cast<Node *>(rbnode);
+		}
+		Node *parent;
+		while((parent = rbnode->parent) && rbnode == parent->right){rbnode = parent;}
+		return parent;
+	}
+
+	// Gets the in-order predecessor of rbnode, nullptr before the minimum
+	static Node *predecessor(const Node *rbnode){
+		if(rbnode->left){
+			rbnode = rbnode->left;
+			while(rbnode->right){rbnode = rbnode->right;}
+			return const_cast<Node *>(rbnode);
+		}
+		Node *parent;
+		while((parent = rbnode->parent) && rbnode == parent->left){rbnode = parent;}
+		return parent;
+	}
+
+	Node *root() const{return rbroot;}
+	bool empty() const{return rbroot == nullptr;}
+
+	std::size_t size() const{return count;}
+	const Compare &key_comp() const{return comp;}
+
+	// Gets the number of nodes on the longest path from the root, at most
+	// 2 log2(n + 1). Walks the whole tree through the parent pointers
+	std::size_t height() const{
+		const Node *rbnode = rbroot;
+		if(!rbnode){
+			return 0;
+		}
+		std::size_t height = 0, depth = 1;
+		while(true){
+			if(depth > height){height = depth;}
+			if(rbnode->left || rbnode->right){
+				rbnode = rbnode->left ? rbnode->left : rbnode->right;
+				++depth;
+				continue;
+			}
+			// climb up to the first left child with a right sibling
+			while(true){
+				const Node *parent = rbnode->parent;
+				if(!parent){
+					return height;
+				}
+				--depth;
+				if(rbnode == parent->left && parent->right){
+					rbnode = parent->right;
+					++depth;
+					break;
+				}
+				rbnode = parent;
+			}
+		}
+	}
+
+	// Checks whether rbnode is null or black
+	static bool isblack(const Node *rbnode){
+		return !rbnode || !rbnode->color;
+	}
+
+private:
+	// The argument of an insert as the descent compares it: as it is with
+	// a transparent comparator, otherwise converted to a Key once instead
+	// of at every step
+	template<typename K>
+	decltype(auto) probe(const K &key) const{
+		if constexpr(istransparent<Compare>::value || std::is_same<K, Key>::value){
+			return (key);
+		}
+		else{
+			return Key(key);
+		}
+	}
+
+	// Descends from the root in a loop, nullptr if the key is not found
+	template<typename K>
+	Node *findnode(const K &key) const{return findbelow(rbroot, key);}
+
+	// Descends from rbnode, nullptr if the key is not below it
+	template<typename K>
+	Node *findbelow(Node *rbnode, const K &key) const{
+		std::size_t depth = 0;
+		while(rbnode){
+			++depth;
+			if(comp(key, rbnode->key)){
+				rbnode = rbnode->left;
+			}
+			else if(comp(rbnode->key, key)){
+				rbnode = rbnode->right;
+			}
+			else{
+				break;
+			}
+		}
+		RB_STAT_VALUE(searchpath, depth);
+		return rbnode;
+	}
+
+	// Finds the parent and side for a new node with the key below rbnode,
+	// after the nodes with an equal key
+	template<typename K>
+	void descend(Node *rbnode, const K &key, Node *&parent, bool &left) const{
+		while(rbnode){
+			parent = rbnode;
+			left = comp(key, rbnode->key);
+			rbnode = left ? rbnode->left : rbnode->right;
+		}
+	}
+
+	// Climbs from rbnode to the smallest subtree around it whose key range
+	// holds key and returns its root. Moving up from x to its parent p
+	// widens the range only on one side: on the right if x is p's left
+	// child (p is the first key after x's subtree), on the left otherwise.
+	// So the climb stops at the first ancestor that bounds key on the side
+	// it lies on. For an insert, the place after equal keys is what counts
+	template<typename K>
+	Node *climb(Node *rbnode, const K &key, bool insert) const{
+		bool after = insert ? !comp(key, rbnode->key) : comp(rbnode->key, key);
+		if(!insert && !after && !comp(key, rbnode->key)){
+			return rbnode;
+		}
+		while(Node *parent = rbnode->parent){
+			if(after ? rbnode == parent->left && comp(key, parent->key) :
+				rbnode == parent->right && (insert ? !comp(key, parent->key) : comp(parent->key, key))){
+				break;
+			}
+			rbnode = parent;
+		}
+		return rbnode;
+	}
+
+	static Node *minimumof(Node *rbnode){
+		while(rbnode && rbnode->left){rbnode = rbnode->left;}
+		return rbnode;
+	}
+
+	static Node *maximumof(Node *rbnode){
+		while(rbnode && rbnode->right){rbnode = rbnode->right;}
+		return rbnode;
+	}
+
+	// The first node with a key not less than key. Keeps descending left
+	// past a match, so duplicates come out in insertion order
+	template<typename K>
+	Node *lowerbound(const K &key) const{
+		Node *rbnode = rbroot, *result = nullptr;
+		while(rbnode){
+			if(comp(rbnode->key, key)){
+				rbnode = rbnode->right;
+			}
+			else{
+				result = rbnode;
+				rbnode = rbnode->left;
+			}
+		}
+		return result;
+	}
+
+	// The first node with a key greater than key
+	template<typename K>
+	Node *upperbound(const K &key) const{
+		Node *rbnode = rbroot, *result = nullptr;
+		while(rbnode){
+			if(comp(key, rbnode->key)){
+				result = rbnode;
+				rbnode = rbnode->left;
+			}
+			else{
+				rbnode = rbnode->right;
+			}
+		}
+		return result;
+	}
+
+	template<typename... Args>
+	Node *createnode(Args&&... args){
+		Node *rbnode = NodeTraits::allocate(alloc, 1);
+		try{
+			NodeTraits::construct(alloc, rbnode, std::forward<Args>(args)...);
+		}
+		catch(...){
+			NodeTraits::deallocate(alloc, rbnode, 1);
+			throw;
+		}
+		return rbnode;
+	}
+
+	void destroynode(Node *rbnode){
+		NodeTraits::destroy(alloc, rbnode);
+		NodeTraits::deallocate(alloc, rbnode, 1);
+	}
+
+	// Destroys every node bottom up, optionally deallocating it as well
+	void destroyall(bool deallocate){
+		Node *rbnode = rbroot;
+		while(rbnode){
+			if(rbnode->left){
+				rbnode = rbnode->left;
+			}
+			else if(rbnode->right){
+				rbnode = rbnode->right;
+			}
+			else{
+				Node *parent = rbnode->parent;
+				if(parent){
+					if(parent->left == rbnode){parent->left = nullptr;}
+					else{parent->right = nullptr;}
+				}
+				NodeTraits::destroy(alloc, rbnode);
+				if(deallocate){NodeTraits::deallocate(alloc, rbnode, 1);}
+				rbnode = parent;
+			}
+		}
+	}
+
+	// Steps past the element at it, and past its duplicates with unique
+	template<typename ForwardIt>
+	ForwardIt nextkey(ForwardIt it, ForwardIt last, bool unique) const{
+		ForwardIt next = std::next(it);
+		if(unique){
+			while(next != last && !comp(it->first, next->first)){++next;}
+		}
+		return next;
+	}
+
+	// Links n nodes in key order into a balanced subtree and returns its
+	// root. Recurses only log2(n) deep
+	Node *linksorted(Node **nodes, std::size_t n, int depth, int reddepth){
+		if(!n){
+			return nullptr;
+		}
+		std::size_t half = n / 2;
+		Node *rbnode = nodes[half];
+		rbnode->color = depth == reddepth;
+		rbnode->left = linksorted(nodes, half, depth + 1, reddepth);
+		rbnode->right = linksorted(nodes + half + 1, n - half - 1, depth + 1, reddepth);
+		if(rbnode->left){rbnode->left->parent = rbnode;}
+		if(rbnode->right){rbnode->right->parent = rbnode;}
+		return rbnode;
+	}
+
+	// Appends the nodes below rbnode in preorder
+	static void preorderof(Node *rbnode, std::vector<Node *> &order){
+		std::vector<Node *> stack{rbnode};
+		while(!stack.empty()){
+			rbnode = stack.back();
+			stack.pop_back();
+			order.push_back(rbnode);
+			if(rbnode->right){stack.push_back(rbnode->right);}
+			if(rbnode->left){stack.push_back(rbnode->left);}
+		}
+	}
+
+	// Appends the nodes of the top levels below rbnode in van Emde Boas
+	// order. Recurses log2 of the height deep for the halving, and as deep
+	// as the top half for collecting the subtrees below it
+	static void vanemdeboasof(Node *rbnode, std::size_t levels, std::vector<Node *> &order){
+		if(levels == 1){
+			order.push_back(rbnode);
+			return;
+		}
+		std::size_t top = levels / 2;
+		vanemdeboasof(rbnode, top, order);
+		std::vector<Node *> bottoms;
+		below(rbnode, top, bottoms);
+		for(Node *bottom : bottoms){vanemdeboasof(bottom, levels - top, order);}
+	}
+
+	// Collects the nodes exactly depth levels below rbnode, left to right
+	static void below(Node *rbnode, std::size_t depth, std::vector<Node *> &nodes){
+		if(!rbnode){
+			return;
+		}
+		if(!depth){
+			nodes.push_back(rbnode);
+			return;
+		}
+		below(rbnode->left, depth - 1, nodes);
+		below(rbnode->right, depth - 1, nodes);
+	}
+
+	// Hangs rbnode under parent and fixes occured violations
+	Node *link(Node *rbnode, Node *parent, bool left){
+		if(parent == rightmost && !left){rightmost = rbnode;}
+		if(!parent){rbroot = rbnode;}
+		else if(left){parent->left = rbnode;}
+		else{parent->right = rbnode;}
+		++count;
+		insertfixup(rbnode, rbroot);
+		return rbnode;
+	}
+
+	// Points the parent's link (or the root) at rbnode instead of old
+	static void replacechild(Node *parent, Node *old, Node *rbnode, Node *&root){
+		if(!parent){root = rbnode;}
+		else if(parent->left == old){parent->left = rbnode;}
+		else{parent->right = rbnode;}
+	}
+
+	// Rotates rbtree to left
+	static void leftrotate(Node *rbnode, Node *&root){
+		RB_STAT(rotations, 1);
+		Node *right = rbnode->right;
+		rbnode->right = right->left;
+		if(right->left){right->left->parent = rbnode;}
+		right->parent = rbnode->parent;
+		replacechild(rbnode->parent, rbnode, right, root);
+		right->left = rbnode;
+		rbnode->parent = right;
+	}
+
+	// Rotates rbtree to right
+	static void rightrotate(Node *rbnode, Node *&root){
+		RB_STAT(rotations, 1);
+		Node *left = rbnode->left;
+		rbnode->left = left->right;
+		if(left->right){left->right->parent = rbnode;}
+		left->parent = rbnode->parent;
+		replacechild(rbnode->parent, rbnode, left, root);
+		left->right = rbnode;
+		rbnode->parent = left;
+	}
+
+	// Restores the red black properties after linking a red node below
+	// root. Returns whether the black height of the tree grew
+	static bool insertfixup(Node *rbnode, Node *&root){
+		Node *parent;
+		while((parent = rbnode->parent) && parent->color){
+			RB_STAT(insertfixups, 1);
+			Node *gparent = parent->parent;
+			if(parent == gparent->left){
+				Node *uncle = gparent->right;
+				if(!isblack(uncle)){
+					uncle->color = false;
+					parent->color = false;
+					gparent->color = true;
+					RB_STAT(recolors, 3);
+					rbnode = gparent;
+					continue;
+				}
+				if(rbnode == parent->right){
+					leftrotate(parent, root);
+					rbnode = parent;
+					parent = rbnode->parent;
+				}
+				parent->color = false;
+				gparent->color = true;
+				RB_STAT(recolors, 2);
+				rightrotate(gparent, root);
+			}
+			else{
+				Node *uncle = gparent->left;
+				if(!isblack(uncle)){
+					uncle->color = false;
+					parent->color = false;
+					gparent->color = true;
+					RB_STAT(recolors, 3);
+					rbnode = gparent;
+					continue;
+				}
+				if(rbnode == parent->left){
+					rightrotate(parent, root);
+					rbnode = parent;
+					parent = rbnode->parent;
+				}
+				parent->color = false;
+				gparent->color = true;
+				RB_STAT(recolors, 2);
+				leftrotate(gparent, root);
+			}
+		}
+		bool grew = root->color;
+		RB_STAT(recolors, grew);
+		root->color = false;
+		return grew;
+	}
+
+	// Takes rbnode out of the tree without releasing it
+	void unlink(Node *rbnode){
+		if(rbnode == rightmost){rightmost = predecessor(rbnode);}
+		if(rbnode == finger){finger = nullptr;}
+		unlinknode(rbnode, rbroot);
+		--count;
+	}
+
+	// Takes rbnode out of the (sub)tree below root. Returns whether the
+	// black height of the tree shrank
+	static bool unlinknode(Node *rbnode, Node *&root){
+		Node *child, *parent;
+		bool color;
+		if(!rbnode->left || !rbnode->right){
+			child = rbnode->left ? rbnode->left : rbnode->right;
+			parent = rbnode->parent;
+			color = rbnode->color;
+			if(child){child->parent = parent;}
+			replacechild(parent, rbnode, child, root);
+		}
+		else{
+			// the in-order successor takes the place of rbnode, so the
+			// node itself (and its value) never has to be copied
+			Node *repl = rbnode->right;
+			while(repl->left){repl = repl->left;}
+			color = repl->color;
+			child = repl->right;
+			if(repl->parent == rbnode){
+				parent = repl;
+			}
+			else{
+				parent = repl->parent;
+				parent->left = child;
+				if(child){child->parent = parent;}
+				repl->right = rbnode->right;
+				rbnode->right->parent = repl;
+			}
+			repl->left = rbnode->left;
+			rbnode->left->parent = repl;
+			repl->parent = rbnode->parent;
+			repl->color = rbnode->color;
+			replacechild(rbnode->parent, rbnode, repl, root);
+		}
+		return !color && erasefixup(child, parent, root);
+	}
+
+	// Restores the red black properties after removing a black node.
+	// rbnode (possibly null) carries the extra black, parent is its parent.
+	// Returns whether the black height of the tree shrank
+	static bool erasefixup(Node *rbnode, Node *parent, Node *&root){
+		while(rbnode != root && isblack(rbnode)){
+			RB_STAT(erasefixups, 1);
+			if(rbnode == parent->left){
+				Node *sibling = parent->right;
+				if(!isblack(sibling)){
+					sibling->color = false;
+					parent->color = true;
+					RB_STAT(recolors, 2);
+					leftrotate(parent, root);
+					sibling = parent->right;
+				}
+				if(isblack(sibling->left) && isblack(sibling->right)){
+					sibling->color = true;
+					RB_STAT(recolors, 1);
+					rbnode = parent;
+					parent = rbnode->parent;
+					continue;
+				}
+				if(isblack(sibling->right)){
+					sibling->left->color = false;
+					sibling->color = true;
+					RB_STAT(recolors, 2);
+					rightrotate(sibling, root);
+					sibling = parent->right;
+				}
+				sibling->color = parent->color;
+				parent->color = false;
+				sibling->right->color = false;
+				RB_STAT(recolors, 3);
+				leftrotate(parent, root);
+				return false;
+			}
+			else{
+				Node *sibling = parent->left;
+				if(!isblack(sibling)){
+					sibling->color = false;
+					parent->color = true;
+					RB_STAT(recolors, 2);
+					rightrotate(parent, root);
+					sibling = parent->left;
+				}
+				if(isblack(sibling->left) && isblack(sibling->right)){
+					sibling->color = true;
+					RB_STAT(recolors, 1);
+					rbnode = parent;
+					parent = rbnode->parent;
+					continue;
+				}
+				if(isblack(sibling->left)){
+					sibling->right->color = false;
+					sibling->color = true;
+					RB_STAT(recolors, 2);
+					leftrotate(sibling, root);
+					sibling = parent->left;
+				}
+				sibling->color = parent->color;
+				parent->color = false;
+				sibling->left->color = false;
+				RB_STAT(recolors, 3);
+				rightrotate(parent, root);
+				return false;
+			}
+		}
+		// the extra black either turns a red node black or leaves the tree
+		// at the root, which makes every path one black node shorter
+		bool shrank = isblack(rbnode);
+		RB_STAT(recolors, !shrank);
+		if(rbnode){rbnode->color = false;}
+		return shrank;
+	}
+
+	// A detached subtree with a black (or null) root and its black height,
+	// the number of black nodes on every path from the root to a null link
+	struct Sub{
+		Node *root = nullptr;
+		int bh = 0;
+	};
+
+	// Nodes dropped by a set operation, chained through their right links
+	// and released once the operation is over
+	struct Freed{
+		void add(Node *rbnode){
+			rbnode->right = head;
+			if(!head){tail = rbnode;}
+			head = rbnode;
+			++count;
+		}
+
+		void splice(Freed &other){
+			if(!other.head){return;}
+			other.tail->right = head;
+			if(!head){tail = other.tail;}
+			head = other.head;
+			count += other.count;
+		}
+
+		Node *head = nullptr, *tail = nullptr;
+		std::size_t count = 0;
+	};
+
+	enum class SetOperation{unite, intersect, subtract};
+
+	// Subproblems whose trees both have at least this black height (at
+	// least 2^10 - 1 nodes) are worth handing to another thread
+	static constexpr int parallelblackheight = 10;
+
+	static int blackheight(const Node *rbnode){
+		int bh = 0;
+		for(; rbnode; rbnode = rbnode->left){
+			if(!rbnode->color){++bh;}
+		}
+		return bh;
+	}
+
+	// Makes a child subtree a tree of its own, a red root turns black
+	static Sub asroot(Node *rbnode, int bh){
+		if(!rbnode){
+			return Sub{};
+		}
+		rbnode->parent = nullptr;
+		if(rbnode->color){
+			rbnode->color = false;
+			++bh;
+		}
+		return Sub{rbnode, bh};
+	}
+
+	// Detaches the root of t from its two subtrees
+	static Node *expose(Sub t, Sub &l, Sub &r){
+		Node *rbnode = t.root;
+		l = asroot(rbnode->left, t.bh - 1);
+		r = asroot(rbnode->right, t.bh - 1);
+		rbnode->left = rbnode->right = nullptr;
+		return rbnode;
+	}
+
+	// Joins l, k and r, where the keys of l are at most k's key and those
+	// of r at least, into one tree. k is hung on the spine of the higher
+	// tree at the black node of the other tree's black height and the
+	// usual insert fixup repairs the colors, O(|l.bh - r.bh| + 1)
+	static Sub join(Sub l, Node *k, Sub r){
+		k->parent = nullptr;
+		if(l.bh == r.bh){
+			k->left = l.root;
+			k->right = r.root;
+			k->color = false;
+			if(l.root){l.root->parent = k;}
+			if(r.root){r.root->parent = k;}
+			return Sub{k, l.bh + 1};
+		}
+		k->color = true;
+		if(l.bh > r.bh){
+			Node *parent = nullptr, *rbnode = l.root;
+			int bh = l.bh;
+			while(!isblack(rbnode) || bh != r.bh){
+				if(isblack(rbnode)){--bh;}
+				parent = rbnode;
+				rbnode = rbnode->right;
+			}
+			k->left = rbnode;
+			if(rbnode){rbnode->parent = k;}
+			k->right = r.root;
+			if(r.root){r.root->parent = k;}
+			k->parent = parent;
+			parent->right = k;
+			Node *root = l.root;
+			bool grew = insertfixup(k, root);
+			return Sub{root, l.bh + grew};
+		}
+		Node *parent = nullptr, *rbnode = r.root;
+		int bh = r.bh;
+		while(!isblack(rbnode) || bh != l.bh){
+			if(isblack(rbnode)){--bh;}
+			parent = rbnode;
+			rbnode = rbnode->left;
+		}
+		k->right = rbnode;
+		if(rbnode){rbnode->parent = k;}
+		k->left = l.root;
+		if(l.root){l.root->parent = k;}
+		k->parent = parent;
+		parent->left = k;
+		Node *root = r.root;
+		bool grew = insertfixup(k, root);
+		return Sub{root, r.bh + grew};
+	}
+
+	// Joins two trees without a middle node by taking out the maximum of l
+	static Sub join2(Sub l, Sub r){
+		if(!l.root){return r;}
+		if(!r.root){return l;}
+		Node *last = l.root;
+		while(last->right){last = last->right;}
+		Node *root = l.root;
+		bool shrank = unlinknode(last, root);
+		return join(Sub{root, l.bh - shrank}, last, r);
+	}
+
+	// Splits t into the keys before and after key. A node with the key
+	// itself is returned separately
+	Node *splitat(Sub t, const Key &key, Sub &l, Sub &r) const{
+		if(!t.root){
+			l = r = Sub{};
+			return nullptr;
+		}
+		Sub tl, tr;
+		Node *rbnode = expose(t, tl, tr);
+		if(comp(key, rbnode->key)){
+			Node *match = splitat(tl, key, l, r);
+			r = join(r, rbnode, tr);
+			return match;
+		}
+		if(comp(rbnode->key, key)){
+			Node *match = splitat(tr, key, l, r);
+			l = join(tl, rbnode, l);
+			return match;
+		}
+		l = tl;
+		r = tr;
+		return rbnode;
+	}
+
+	// Splits t into the keys less than key and the rest
+	void splitbefore(Sub t, const Key &key, Sub &l, Sub &r) const{
+		if(!t.root){
+			l = r = Sub{};
+			return;
+		}
+		Sub tl, tr;
+		Node *rbnode = expose(t, tl, tr);
+		if(comp(rbnode->key, key)){
+			splitbefore(tr, key, l, r);
+			l = join(tl, rbnode, l);
+		}
+		else{
+			splitbefore(tl, key, l, r);
+			r = join(r, rbnode, tr);
+		}
+	}
+
+	// Hands every node of the subtree to freed, bottom up
+	static void freeall(Node *rbnode, Freed &freed){
+		while(rbnode){
+			if(rbnode->left){
+				rbnode = rbnode->left;
+			}
+			else if(rbnode->right){
+				rbnode = rbnode->right;
+			}
+			else{
+				Node *parent = rbnode->parent;
+				if(parent){
+					if(parent->left == rbnode){parent->left = nullptr;}
+					else{parent->right = nullptr;}
+				}
+				freed.add(rbnode);
+				rbnode = parent;
+			}
+		}
+	}
+
+	// The join based set operation: splits a at the root key of b, solves
+	// both halves (in parallel when they are big enough) and joins the
+	// results back around the root
+	Sub combine(Sub a, Sub b, SetOperation operation, Freed &freed, ThreadPool *pool) const{
+		if(!a.root || !b.root){
+			if(operation == SetOperation::unite){return a.root ? a : b;}
+			freeall(b.root, freed);
+			if(operation == SetOperation::subtract){return a;}
+			freeall(a.root, freed);
+			return Sub{};
+		}
+		bool fork = pool && a.bh >= parallelblackheight && b.bh >= parallelblackheight;
+		Sub bl, br, al, ar;
+		Node *pivot = expose(b, bl, br);
+		Node *match = splitat(a, pivot->key, al, ar);
+
+		Sub l, r;
+		Freed leftfreed, rightfreed;
+		auto left = [&]{l = combine(al, bl, operation, leftfreed, pool);};
+		auto right = [&]{r = combine(ar, br, operation, rightfreed, pool);};
+		if(fork){
+			pool->parallel(left, right);
+		}
+		else{
+			left();
+			right();
+		}
+		freed.splice(leftfreed);
+		freed.splice(rightfreed);
+
+		switch(operation){
+		case SetOperation::unite:
+			if(match){
+				freed.add(pivot);
+				return join(l, match, r);
+			}
+			return join(l, pivot, r);
+		case SetOperation::intersect:
+			freed.add(pivot);
+			return match ? join(l, match, r) : join2(l, r);
+		default:
+			freed.add(pivot);
+			if(match){freed.add(match);}
+			return join2(l, r);
+		}
+	}
+
+	// Visits the subtree of rbnode, whose black height is bh, forking at
+	// its root while the halves are big enough
+	template<typename Visit>
+	static void foreachbelow(Node *rbnode, int bh, Visit &visit, ThreadPool *pool){
+		if(!rbnode){
+			return;
+		}
+		if(!pool || bh < parallelblackheight){
+			for(Node *last = successor(maximumof(rbnode)), *next = minimumof(rbnode); next != last;){
+				Node *current = next;
+				next = successor(next);
+				visit(*current);
+			}
+			return;
+		}
+		Node *left = rbnode->left, *right = rbnode->right;
+		pool->parallel([&]{foreachbelow(left, bh - isblack(left), visit, pool);},
+			[&]{foreachbelow(right, bh - isblack(right), visit, pool);});
+		visit(*rbnode);
+	}
+
+	template<typename T, typename Map, typename Combine>
+	static T reducebelow(Node *rbnode, int bh, const T &identity, Map &map, Combine &combine,
+		ThreadPool *pool){
+		if(!rbnode){
+			return identity;
+		}
+		if(!pool || bh < parallelblackheight){
+			T result = identity;
+			for(Node *last = successor(maximumof(rbnode)), *next = minimumof(rbnode); next != last;
+				next = successor(next)){
+				result = combine(std::move(result), map(std::as_const(*next)));
+			}
+			return result;
+		}
+		Node *left = rbnode->left, *right = rbnode->right;
+		T l = identity, r = identity;
+		pool->parallel([&]{l = reducebelow(left, bh - isblack(left), identity, map, combine, pool);},
+			[&]{r = reducebelow(right, bh - isblack(right), identity, map, combine, pool);});
+		return combine(combine(std::move(l), map(std::as_const(*rbnode))), std::move(r));
+	}
+
+	// Runs a set operation with other and takes over all of its nodes
+	void setoperation(RbTree &other, SetOperation operation, ThreadPool *pool){
+		static_assert(!hasrelease<NodeAlloc>::value,
+			"nodes cannot move between trees that release their arenas at once");
+		assert(alloc == other.alloc);
+		std::size_t total = count + other.count;
+		Freed freed;
+		Sub result = combine(Sub{rbroot, blackheight(rbroot)},
+			Sub{other.rbroot, blackheight(other.rbroot)}, operation, freed, pool);
+		other.rbroot = other.rightmost = other.finger = nullptr;
+		other.count = 0;
+		rbroot = result.root;
+		rightmost = maximumof(rbroot);
+		finger = nullptr;
+		count = total - freed.count;
+		for(Node *rbnode = freed.head; rbnode;){
+			Node *next = rbnode->right;
+			destroynode(rbnode);
+			rbnode = next;
+		}
+	}
+
+	Node *rbroot = nullptr;
+	Node *rightmost = nullptr;
+	Node *finger = nullptr; // of emplace_near() and find_near()
+	std::size_t count = 0;
+	Compare comp;
+	NodeAlloc alloc;
+};
+
+#endif
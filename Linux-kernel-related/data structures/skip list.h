@@ -0,0 +1,312 @@
+/*
+   Lock free skip list
+
+   An ordered map that many threads can change at once without any lock,
+   for write heavy loads where even the sharded tree (rb sharded.h) keeps
+   meeting on its shard locks. It offers the same insert(), erase(),
+   find(), scan() and foreach() as the concurrent trees in this directory,
+   so they can be swapped for one another (see ordered map bench.cpp).
+
+   Every node is in the bottom list and, with probability 1/2 each, in the
+   lists above, so a search skips ahead in the sparse upper lists and
+   needs O(log n) steps. The lists are changed with compare and swap only,
+   following Herlihy and Shavit ("The Art of Multiprocessor Programming",
+   after Fraser and Harris): a node is erased by first setting the low bit
+   of its own next links, which keeps anybody from linking behind it, and
+   then unlinking it from every level. Searches by writers unlink the
+   marked nodes they pass. Lookups and scans never write.
+
+   Unlinked nodes are freed through the epoch reclamation in epoch.h. An
+   insert may still be linking the upper levels of a node while it is
+   erased, so the node is retired by whichever of the two finishes last.
+   Keys are unique and a value never changes after insertion.
+*/
+
+#ifndef SKIP_LIST_H
+#define SKIP_LIST_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <new>
+#include <random>
+
+#include "epoch.h"
+
+template<typename Key, typename Value, typename Compare = std::less<Key>>
+class LockFreeSkipList{
+public:
+	static constexpr int maxlevel = 32;
+
+	explicit LockFreeSkipList(const Compare &comp = Compare()): comp(comp){
+		for(Link &link : head){link.store(0, std::memory_order_relaxed);}
+	}
+
+	LockFreeSkipList(const LockFreeSkipList &) = delete;
+	LockFreeSkipList &operator=(const LockFreeSkipList &) = delete;
+
+	// No other thread may be using the list any more
+	~LockFreeSkipList(){
+		Epoch::synchronize();
+		Node *node = pointer(head[0].load(std::memory_order_relaxed));
+		while(node){
+			Node *next = pointer(node->next[0].load(std::memory_order_relaxed));
+			destroy(node);
+			node = next;
+		}
+	}
+
+	// Returns false if the key is already there
+	bool insert(const Key &key, const Value &value){
+		Epoch::Guard guard;
+		int height = randomheight();
+		raisetop(height);
+		Link *preds[maxlevel];
+		Node *succs[maxlevel];
+		Node *node = nullptr;
+		while(true){
+			if(search(key, preds, succs)){
+				if(node){destroy(node);}
+				return false;
+			}
+			if(!node){node = create(key, value, height);}
+			for(int level = 0; level < height; ++level){
+				node->next[level].store(link(succs[level]), std::memory_order_relaxed);
+			}
+			std::uintptr_t expected = link(succs[0]);
+			if(preds[0][0].compare_exchange_strong(expected, link(node),
+				std::memory_order_release, std::memory_order_relaxed)){
+				break;
+			}
+		}
+		linkupper(node, preds, succs);
+		// an erase that ran meanwhile may have missed the levels linked
+		// after its own pass. Linking a level and reading the mark here
+		// against marking and reading the links in erase() is a store
+		// buffer pattern: without sequentially consistent order between
+		// them both sides could miss the other
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if(marked(node->next[0].load(std::memory_order_seq_cst))){search(key, preds, succs);}
+		if(node->finished.exchange(true, std::memory_order_acq_rel)){Epoch::retire(node, destroy);}
+		return true;
+	}
+
+	// Returns false if the key was not there
+	bool erase(const Key &key){
+		Epoch::Guard guard;
+		Link *preds[maxlevel];
+		Node *succs[maxlevel];
+		if(!search(key, preds, succs)){
+			return false;
+		}
+		Node *node = succs[0];
+		for(int level = node->height - 1; level > 0; --level){
+			node->next[level].fetch_or(1, std::memory_order_acq_rel);
+		}
+		// whoever marks the bottom level has erased the node
+		std::uintptr_t next = node->next[0].load(std::memory_order_acquire);
+		do{
+			if(marked(next)){
+				return false;
+			}
+		}while(!node->next[0].compare_exchange_weak(next, next | 1, std::memory_order_seq_cst));
+		// pairs with the fence in insert() after linkupper()
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		search(key, preds, succs);
+		if(node->finished.exchange(true, std::memory_order_acq_rel)){Epoch::retire(node, destroy);}
+		return true;
+	}
+
+	// Copies the value out, the node may be freed after the call
+	bool find(const Key &key, Value &value){
+		Epoch::Guard guard;
+		const Node *node = lowerbound(key);
+		if(!node || comp(key, node->key)){
+			return false;
+		}
+		value = node->value;
+		return true;
+	}
+
+	bool contains(const Key &key){
+		Epoch::Guard guard;
+		const Node *node = lowerbound(key);
+		return node && !comp(key, node->key);
+	}
+
+	// Calls visit(key, value) in key order for the keys in [lo, hi). Sees
+	// every key that is there for the whole scan, changes made during the
+	// scan may or may not be seen
+	template<typename Visit>
+	void scan(const Key &lo, const Key &hi, Visit visit){
+		Epoch::Guard guard;
+		for(const Node *node = lowerbound(lo); node && comp(node->key, hi); node = nextnode(node)){
+			visit(node->key, node->value);
+		}
+	}
+
+	// Calls visit(key, value) for every key in order, as weakly as scan()
+	template<typename Visit>
+	void foreach(Visit visit){
+		Epoch::Guard guard;
+		const Node *node = pointer(head[0].load(std::memory_order_acquire));
+		if(node && marked(node->next[0].load(std::memory_order_acquire))){node = nextnode(node);}
+		for(; node; node = nextnode(node)){visit(node->key, node->value);}
+	}
+
+	// Counts the keys by walking the bottom list, O(n)
+	std::size_t size(){
+		std::size_t count = 0;
+		foreach([&](const Key &, const Value &){++count;});
+		return count;
+	}
+
+private:
+	// A next link: a node pointer with the low bit set once the node that
+	// owns the link is erased
+	using Link = std::atomic<std::uintptr_t>;
+
+	// Allocated with room for height links, next[] runs past the struct
+	struct Node{
+		Node(const Key &key, const Value &value, int height):
+		key(key), value(value), height(height){}
+
+		const Key key;
+		const Value value;
+		const int height;
+		std::atomic<bool> finished{false};
+		Link next[1];
+	};
+
+	static Node *pointer(std::uintptr_t link){
+		return reinterpret_cast<Node *>(link & ~std::uintptr_t(1));
+	}
+
+	static std::uintptr_t link(const Node *node){
+		return reinterpret_cast<std::uintptr_t>(node);
+	}
+
+	static bool marked(std::uintptr_t link){return link & 1;}
+
+	static Node *create(const Key &key, const Value &value, int height){
+		void *memory = ::operator new(sizeof(Node) + (height - 1) * sizeof(Link));
+		Node *node = new(memory) Node(key, value, height);
+		for(int level = 1; level < height; ++level){new(&node->next[level]) Link(0);}
+		return node;
+	}
+
+	static void destroy(void *memory){
+		static_cast<Node *>(memory)->~Node();
+		::operator delete(memory);
+	}
+
+	// 1 + the number of trailing ones of a random number: 1 with
+	// probability 1/2, 2 with 1/4 and so on
+	static int randomheight(){
+		thread_local std::mt19937 rng(std::random_device{}());
+		std::uint32_t bits = rng();
+		int height = 1;
+		while(bits & 1){
+			++height;
+			bits >>= 1;
+		}
+		return height < maxlevel ? height : maxlevel;
+	}
+
+	// Searches start at the highest level any node has ever been given
+	void raisetop(int height){
+		int current = top.load(std::memory_order_relaxed);
+		while(current < height && !top.compare_exchange_weak(current, height, std::memory_order_relaxed)){}
+	}
+
+	// Fills in, for every level, the link array of the last node before
+	// key (or the head) and the first node not before it, unlinking the
+	// marked nodes on the way. Returns whether an unmarked node with the
+	// key is in the list
+	bool search(const Key &key, Link **preds, Node **succs){
+		int levels = top.load(std::memory_order_relaxed);
+		for(int level = maxlevel - 1; level >= levels; --level){
+			preds[level] = head;
+			succs[level] = nullptr;
+		}
+	retry:
+		Link *pred = head;
+		for(int level = levels - 1; level >= 0; --level){
+			Node *curr = pointer(pred[level].load(std::memory_order_acquire));
+			while(curr){
+				std::uintptr_t next = curr->next[level].load(std::memory_order_acquire);
+				if(marked(next)){
+					std::uintptr_t expected = link(curr);
+					if(!pred[level].compare_exchange_strong(expected, next & ~std::uintptr_t(1),
+						std::memory_order_acq_rel, std::memory_order_relaxed)){
+						goto retry;
+					}
+					curr = pointer(next);
+					continue;
+				}
+				if(!comp(curr->key, key)){
+					break;
+				}
+				pred = curr->next;
+				curr = pointer(next);
+			}
+			preds[level] = pred;
+			succs[level] = curr;
+		}
+		return succs[0] && !comp(key, succs[0]->key);
+	}
+
+	// Links the levels above the bottom one, stopping early when the node
+	// is erased meanwhile
+	void linkupper(Node *node, Link **preds, Node **succs){
+		for(int level = 1; level < node->height; ++level){
+			while(true){
+				std::uintptr_t next = node->next[level].load(std::memory_order_acquire);
+				if(next != link(succs[level]) && (marked(next) ||
+					!node->next[level].compare_exchange_strong(next, link(succs[level]),
+					std::memory_order_acq_rel))){
+					return;
+				}
+				std::uintptr_t expected = link(succs[level]);
+				if(preds[level][level].compare_exchange_strong(expected, link(node),
+					std::memory_order_seq_cst, std::memory_order_relaxed)){
+					break;
+				}
+				if(!search(node->key, preds, succs) || succs[0] != node){
+					return;
+				}
+			}
+		}
+	}
+
+	// The first unmarked node with a key not less than key, without
+	// writing anything
+	const Node *lowerbound(const Key &key) const{
+		const Link *pred = head;
+		const Node *curr = nullptr;
+		for(int level = top.load(std::memory_order_relaxed) - 1; level >= 0; --level){
+			curr = pointer(pred[level].load(std::memory_order_acquire));
+			while(curr && comp(curr->key, key)){
+				pred = curr->next;
+				curr = pointer(curr->next[level].load(std::memory_order_acquire));
+			}
+		}
+		while(curr && marked(curr->next[0].load(std::memory_order_acquire))){curr = nextnode(curr);}
+		return curr;
+	}
+
+	// The next unmarked node in the bottom list
+	static const Node *nextnode(const Node *node){
+		do{
+			node = pointer(node->next[0].load(std::memory_order_acquire));
+		}while(node && marked(node->next[0].load(std::memory_order_acquire)));
+		return node;
+	}
+
+	Link head[maxlevel];
+	std::atomic<int> top{1};
+	Compare comp;
+};
+
+#endif
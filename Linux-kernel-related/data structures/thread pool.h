@@ -0,0 +1,215 @@
+/*
+   Fork-join thread pool
+
+   The recursive tree algorithms (the join based set operations, the
+   parallel traversals) split their work into two independent halves again
+   and again. parallel(a, b) offers b to the pool, runs a on the calling
+   thread and then waits for b. While waiting the thread runs other queued
+   tasks itself, so nested forks cannot deadlock even when every worker is
+   waiting on a child.
+
+   Every worker has a deque of its own, threads outside the pool share one
+   more. A thread pushes its forks to the back of its deque and takes work
+   from the back again, so it goes on depth first with the subtree it just
+   touched. An idle thread steals from the front of another deque, where
+   the oldest fork waits: the one highest up in the recursion and so the
+   biggest piece of work. One steal then keeps a thief busy for long, the
+   deques are rarely touched by two threads at once, and a thread that
+   finishes early takes over what a slower one has not started, so halves
+   of different sizes still balance.
+
+   The task of a fork lives on the forking thread's stack, nothing is
+   allocated per fork. Callers should only fork above a size cutoff, since
+   handing a task over costs a lock and possibly a wakeup.
+*/
+
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <iterator>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+class ThreadPool{
+public:
+	// threads is the number of threads working, including the caller of
+	// parallel(), so threads - 1 workers are started
+	explicit ThreadPool(unsigned threads = std::thread::hardware_concurrency()):
+	queues(threads ? threads : 1){
+		for(unsigned i = 1; i < threads; ++i){
+			workers.emplace_back([this, i]{workerloop(i);});
+		}
+	}
+
+	ThreadPool(const ThreadPool &) = delete;
+	ThreadPool &operator=(const ThreadPool &) = delete;
+
+	~ThreadPool(){
+		{
+			std::lock_guard<std::mutex> lock(sleep);
+			stop = true;
+		}
+		wakeup.notify_all();
+		for(std::thread &worker : workers){worker.join();}
+	}
+
+	// Runs left and right, possibly in parallel, and returns when both
+	// are done. An exception of either is rethrown here
+	template<typename Left, typename Right>
+	void parallel(Left &&left, Right &&right){
+		Task task;
+		using Function = typename std::remove_reference<Right>::type;
+		task.function = [](void *context){(*static_cast<Function *>(context))();};
+		task.context = const_cast<void *>(static_cast<const void *>(&right));
+		unsigned own = self();
+		push(own, &task);
+
+		std::exception_ptr error;
+		try{
+			left();
+		}
+		catch(...){
+			error = std::current_exception();
+		}
+
+		// takes the task back if nobody stole it, otherwise helps with
+		// other tasks until it is done
+		if(!takeback(own, &task)){
+			while(!task.done.load(std::memory_order_acquire)){
+				if(!runone(own)){std::this_thread::yield();}
+			}
+		}
+		else{
+			task.run();
+		}
+		if(error){std::rethrow_exception(error);}
+		if(task.error){std::rethrow_exception(task.error);}
+	}
+
+	unsigned threads() const{return unsigned(workers.size()) + 1;}
+
+private:
+	struct Task{
+		void run(){
+			try{
+				function(context);
+			}
+			catch(...){
+				error = std::current_exception();
+			}
+			done.store(true, std::memory_order_release);
+		}
+
+		void (*function)(void *);
+		void *context;
+		std::exception_ptr error;
+		std::atomic<bool> done{false};
+	};
+
+	struct alignas(64) Queue{
+		std::mutex mutex;
+		std::deque<Task *> tasks;
+	};
+
+	// The pool and deque of the calling thread, if it is a worker
+	struct Worker{
+		const ThreadPool *pool;
+		unsigned index;
+	};
+
+	static Worker &current(){
+		thread_local Worker worker{nullptr, 0};
+		return worker;
+	}
+
+	// The deque of the calling thread, 0 for threads outside the pool
+	unsigned self() const{
+		const Worker &worker = current();
+		return worker.pool == this ? worker.index : 0;
+	}
+
+	void push(unsigned own, Task *task){
+		{
+			std::lock_guard<std::mutex> lock(queues[own].mutex);
+			queues[own].tasks.push_back(task);
+		}
+		// pairs with the sleeping count of workerloop(): either the worker
+		// sees the task before it waits or the notify finds it waiting
+		pending.fetch_add(1, std::memory_order_seq_cst);
+		if(sleeping.load(std::memory_order_seq_cst)){
+			std::lock_guard<std::mutex> lock(sleep);
+			wakeup.notify_one();
+		}
+	}
+
+	bool takeback(unsigned own, Task *task){
+		std::lock_guard<std::mutex> lock(queues[own].mutex);
+		std::deque<Task *> &tasks = queues[own].tasks;
+		for(auto it = tasks.rbegin(); it != tasks.rend(); ++it){
+			if(*it == task){
+				tasks.erase(std::next(it).base());
+				pending.fetch_sub(1, std::memory_order_relaxed);
+				return true;
+			}
+		}
+		return false;
+	}
+
+	// Runs the newest task of the own deque or steals the oldest of
+	// another one, false if there is nothing to do
+	bool runone(unsigned own){
+		Task *task = nullptr;
+		{
+			std::lock_guard<std::mutex> lock(queues[own].mutex);
+			if(!queues[own].tasks.empty()){
+				task = queues[own].tasks.back();
+				queues[own].tasks.pop_back();
+			}
+		}
+		for(std::size_t i = 1; !task && i < queues.size(); ++i){
+			Queue &victim = queues[(own + i) % queues.size()];
+			std::lock_guard<std::mutex> lock(victim.mutex);
+			if(!victim.tasks.empty()){
+				task = victim.tasks.front();
+				victim.tasks.pop_front();
+			}
+		}
+		if(!task){
+			return false;
+		}
+		pending.fetch_sub(1, std::memory_order_relaxed);
+		task->run();
+		return true;
+	}
+
+	void workerloop(unsigned index){
+		current() = Worker{this, index};
+		while(true){
+			if(runone(index)){
+				continue;
+			}
+			std::unique_lock<std::mutex> lock(sleep);
+			sleeping.fetch_add(1, std::memory_order_seq_cst);
+			wakeup.wait(lock, [this]{return stop || pending.load(std::memory_order_seq_cst);});
+			sleeping.fetch_sub(1, std::memory_order_relaxed);
+			if(stop){return;}
+		}
+	}
+
+	std::vector<Queue> queues;
+	std::atomic<std::size_t> pending{0}; // tasks in all deques
+	std::atomic<unsigned> sleeping{0};
+	std::mutex sleep;
+	std::condition_variable wakeup;
+	std::vector<std::thread> workers;
+	bool stop = false;
+};
+
+#endif
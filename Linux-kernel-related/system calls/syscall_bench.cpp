@@ -0,0 +1,267 @@
+/*
+    System call benchmark
+
+    syscall_ex.cpp enters the kernel in three ways: extended inline assembly, an
+    assembly wrapper function and the syscall() library function. Here we measure
+    what each of them costs. The interesting part is not the few instructions
+    around the syscall instruction but the kernel entry and exit itself, which
+    the mitigations against Meltdown, Spectre and friends made a lot more
+    expensive (page table switches on entry and exit, flushing and fencing of
+    branch predictors and buffers). So this prints the mitigations the kernel
+    has enabled next to the numbers.
+
+    Every call is timed on its own with the time stamp counter:
+
+        lfence; rdtsc      start, after all earlier instructions completed
+        system call
+        rdtscp; lfence     stop, after the system call completed
+
+    and the cost of the timing alone, measured the same way around nothing, is
+    reported as the "empty" path to be subtracted by eye. The time stamp counter
+    ticks at a constant rate (the nominal frequency of the processor) no matter
+    what clock the core runs at, so the "cycles" are reference cycles; the rate
+    is estimated against clock_gettime() and printed. From the samples we get
+    the median, the tail (p99, p99.9) and a histogram with power of two buckets,
+    the tail being where interrupts and preemption show up. A second loop times
+    the calls in a batch with clock_gettime() only, which gives the throughput
+    without the fences.
+
+    The thread is pinned to one core with sched_setaffinity() so it doesn't
+    migrate in the middle of a measurement (each core has its own time stamp
+    counter, and the caches start cold on the new core).
+
+    The system call number is configurable. By default the benchmark calls the
+    add_syscall (335) from syscall_ex.cpp if the kernel has it and getppid
+    otherwise, one of the cheapest system calls there is: it just reads a field
+    of the current task. A stock kernel answers 335 with -ENOSYS, which is a
+    complete entry and exit too, so "./a.out 335" measures the bare entry cost
+    on any kernel. Some sandboxes kill a process making a system call they
+    don't know with SIGSYS or SIGILL instead; the default probe survives that.
+
+    Note that the inline assembly in syscall_ex.cpp doesn't tell the compiler
+    that the syscall instruction overwrites rcx (return address) and r11
+    (flags); the version below lists them as clobbered, along with memory since
+    the kernel may write to it.
+
+    arguments: system call number (default 335 or getppid), calls, cpu
+
+    g++ -O2 syscall_bench.cpp && ./a.out 110 1000000 0
+*/
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <dirent.h>
+#include <sched.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <x86intrin.h>
+
+#if !defined(__x86_64__)
+#error "the system call paths are x86_64 assembly"
+#endif
+
+using namespace std;
+
+// assembly wrapper function, like add_syscall in syscall_ex.cpp but with the
+// system call number as the first parameter, so the others move up a register
+__asm__(
+    ".global raw_syscall3\n"
+    ".text\n"
+    "raw_syscall3:\n"
+    "    mov %rdi, %rax\n"
+    "    mov %rsi, %rdi\n"
+    "    mov %rdx, %rsi\n"
+    "    mov %rcx, %rdx\n"
+    "    syscall\n"
+    "    ret\n");
+
+extern "C" long raw_syscall3(long, long, long, long);
+
+// the parameters of add_syscall, getppid ignores them
+int oper1 = 2, oper2 = 3, sum;
+
+// extended inline assembly
+inline long inlinesyscall(long number){
+    long ret;
+    __asm__ volatile("syscall"
+                     : "=a" (ret)
+                     : "a" (number), "D" (oper1), "S" (oper2), "d" (&sum)
+                     : "rcx", "r11", "memory");
+    return ret;
+}
+
+inline long wrappersyscall(long number){
+    return raw_syscall3(number, oper1, oper2, reinterpret_cast<long>(&sum));
+}
+
+inline long librarysyscall(long number){
+    return syscall(number, oper1, oper2, &sum);
+}
+
+inline long nosyscall(long number){
+    __asm__ volatile("" : : "r" (number) : "memory");
+    return 0;
+}
+
+inline uint64_t start(){
+    _mm_lfence();
+    uint64_t t = __rdtsc();
+    _mm_lfence();
+    return t;
+}
+
+inline uint64_t stop(){
+    unsigned int cpu;
+    uint64_t t = __rdtscp(&cpu);
+    _mm_lfence();
+    return t;
+}
+
+double now(){
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// times every call of one path and prints the percentiles and the histogram
+template<typename Call>
+void measure(const char *name, Call call, long number, size_t calls, double ghz){
+    vector<uint32_t> cycles(calls);
+    for(size_t i = 0; i < calls / 10; ++i){
+        call(number); // warm up the caches and branch predictors
+    }
+    for(size_t i = 0; i < calls; ++i){
+        uint64_t t0 = start();
+        call(number);
+        cycles[i] = static_cast<uint32_t>(stop() - t0);
+    }
+
+    double t = now();
+    for(size_t i = 0; i < calls; ++i){
+        call(number);
+    }
+    double batch = (now() - t) / calls * 1e9;
+
+    sort(cycles.begin(), cycles.end());
+    auto percentile = [&](double p){return cycles[min(calls - 1, static_cast<size_t>(p * calls))];};
+    cout << left << setw(10) << name << right
+         << setw(8) << cycles[0]
+         << setw(8) << percentile(0.5)
+         << setw(8) << percentile(0.99)
+         << setw(8) << percentile(0.999)
+         << setw(10) << cycles[calls - 1]
+         << setw(10) << fixed << setprecision(1) << percentile(0.5) / ghz
+         << setw(10) << batch << endl;
+
+    // histogram, bucket b > 0 holds the samples from 2^(b-1) to 2^b - 1 cycles
+    size_t buckets[33] = {};
+    for(uint32_t c : cycles){
+        ++buckets[c ? 32 - __builtin_clz(c) : 0];
+    }
+    for(int b = 0; b < 33; ++b){
+        if(buckets[b]){
+            cout << "    " << setw(10) << (b ? 1ul << (b - 1) : 0ul) << "+ cycles"
+                 << setw(10) << buckets[b] << "  "
+                 << string(max<size_t>(1, 50 * buckets[b] / calls), '#') << endl;
+        }
+    }
+}
+
+sigjmp_buf probejump;
+
+void probefailed(int){
+    siglongjmp(probejump, 1);
+}
+
+// whether the kernel has system call number, without dying if a sandbox
+// kills unknown system calls
+bool installed(long number){
+    struct sigaction action = {}, oldsys, oldill;
+    action.sa_handler = probefailed;
+    sigaction(SIGSYS, &action, &oldsys);
+    sigaction(SIGILL, &action, &oldill);
+    bool found = !sigsetjmp(probejump, 1) && inlinesyscall(number) != -ENOSYS;
+    sigaction(SIGSYS, &oldsys, nullptr);
+    sigaction(SIGILL, &oldill, nullptr);
+    return found;
+}
+
+// the mitigation status the kernel reports for each vulnerability
+void mitigations(){
+    const string dir = "/sys/devices/system/cpu/vulnerabilities/";
+    if(DIR *d = opendir(dir.c_str())){
+        vector<string> names;
+        while(dirent *entry = readdir(d)){
+            if(entry->d_name[0] != '.'){
+                names.push_back(entry->d_name);
+            }
+        }
+        closedir(d);
+        sort(names.begin(), names.end());
+        for(const string &name : names){
+            ifstream file(dir + name);
+            string status;
+            getline(file, status);
+            cout << "    " << left << setw(28) << name << status << right << endl;
+        }
+    }
+    else{
+        cout << "    " << dir << " not available" << endl;
+    }
+    ifstream cmdline("/proc/cmdline");
+    string line;
+    getline(cmdline, line);
+    cout << "    kernel command line: " << line << endl;
+}
+
+int main(int argc, char **argv){
+    long number = argc > 1 ? strtol(argv[1], nullptr, 0) : 335;
+    size_t calls = argc > 2 ? strtoul(argv[2], nullptr, 0) : 1000000;
+    int cpu = argc > 3 ? atoi(argv[3]) : 0;
+    if(!calls){
+        calls = 1;
+    }
+    if(argc <= 1 && !installed(number)){
+        number = SYS_getppid; // add_syscall isn't installed
+    }
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if(sched_setaffinity(0, sizeof(set), &set)){
+        cout << "can't pin to cpu " << cpu << ", running unpinned" << endl;
+    }
+
+    // time stamp counter rate, reference cycles per nanosecond
+    double t = now();
+    uint64_t c = __rdtsc();
+    while(now() - t < 0.2){}
+    double ghz = (__rdtsc() - c) / ((now() - t) * 1e9);
+
+    cout << "system call " << number << (number == SYS_getppid ? " (getppid)" : "")
+         << ", returns " << inlinesyscall(number) << ", " << calls << " calls on cpu " << sched_getcpu()
+         << ", time stamp counter " << fixed << setprecision(2) << ghz << " GHz" << endl;
+    cout << "mitigations:" << endl;
+    mitigations();
+    cout << endl;
+
+    cout << left << setw(10) << "path" << right << setw(8) << "min" << setw(8) << "median"
+         << setw(8) << "p99" << setw(8) << "p99.9" << setw(10) << "max"
+         << setw(10) << "median ns" << setw(10) << "batch ns" << endl;
+    measure("empty", nosyscall, number, calls, ghz);
+    measure("inline", inlinesyscall, number, calls, ghz);
+    measure("wrapper", wrappersyscall, number, calls, ghz);
+    measure("syscall()", librarysyscall, number, calls, ghz);
+    return 0;
+}
@@ -0,0 +1,355 @@
+/*
+    System call emulation
+
+    syscall_ex.cpp needs a kernel with add_syscall (335) compiled in, which
+    means patching the system call table, building and rebooting. Here the same
+    system call is emulated in user space on a stock kernel: the kernel is asked
+    to turn system call 335 into a SIGSYS signal instead of running it, and the
+    signal handler does what add_syscall does and puts the return value into
+    rax, where the program finds it as if the kernel had returned it. The three
+    ways of calling it from syscall_ex.cpp (extended inline assembly, assembly
+    wrapper and syscall()) stay exactly as they are.
+
+    There are two ways to get the signal:
+
+    1.  Syscall User Dispatch (Linux 5.11 and later)
+
+        prctl(PR_SET_SYSCALL_USER_DISPATCH, PR_SYS_DISPATCH_ON, start, length,
+        &selector) makes every system call made from outside the address range
+        [start, start + length) raise SIGSYS while the selector byte is set to
+        SYSCALL_DISPATCH_FILTER_BLOCK. It was made for emulating Windows system
+        calls in Wine. The selector is plain memory, so switching the dispatch
+        on and off costs a store, but when it is on it catches every system
+        call, not just 335: the handler makes the others itself with the
+        selector set to allow, so the rest of the program (cout included)
+        keeps working, at the price of a signal per system call. The handler
+        has to return through rt_sigreturn, which is a system call as well;
+        that's why it's installed with a restorer of our own, the only code in
+        the allowed range, instead of the one from the C library.
+
+    2.  seccomp (Linux 3.5 and later)
+
+        A seccomp filter program that returns SECCOMP_RET_TRAP for 335 and
+        SECCOMP_RET_ALLOW for everything else. Only 335 traps and the filter
+        adds a few nanoseconds to every other system call, but a filter can
+        never be removed again, neither by the process nor its children.
+
+    The emulation prefers Syscall User Dispatch and falls back to seccomp if the
+    kernel doesn't have it (prctl fails with EINVAL).
+
+    Emulating add_syscall
+
+    The parameters are in the registers the handler finds in the ucontext:
+    rdi, rsi and rdx. Like in the kernel the sum is checked for overflow first
+    (-1). copy_to_user() returns non zero if the pointer isn't writable by the
+    calling process (-2); the handler finds that out without crashing with
+    process_vm_writev() on its own process, which fails with EFAULT where
+    copy_to_user() fails. The return values are the raw ones in rax, so the
+    syscall() library function turns -1 and -2 into a return value of -1 with
+    errno set to 1 (EPERM) and 2 (ENOENT), just like it does for the real
+    system call; output() below turns them back.
+
+    Costs
+
+    Every emulated call goes through the kernel twice (the trap with the signal
+    delivery, and rt_sigreturn), so it's going to be an order of magnitude
+    slower than a native system call. The second half of the program measures
+    it: native getppid() against the emulated 335 called in all three ways, and
+    for Syscall User Dispatch also what any other system call costs while the
+    dispatch is on.
+
+    arguments: backend (dispatch, seccomp or auto), calls
+
+    g++ -O2 syscall_emulation.cpp && ./a.out auto 200000
+*/
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <iomanip>
+#include <iostream>
+#include <string>
+
+#include <linux/audit.h>
+#include <linux/filter.h>
+#include <linux/seccomp.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+#if !defined(__x86_64__)
+#error "the emulation reads and writes x86_64 registers"
+#endif
+
+#ifndef PR_SET_SYSCALL_USER_DISPATCH
+#define PR_SET_SYSCALL_USER_DISPATCH 59
+#define PR_SYS_DISPATCH_OFF 0
+#define PR_SYS_DISPATCH_ON 1
+#endif
+#ifndef SYSCALL_DISPATCH_FILTER_ALLOW
+#define SYSCALL_DISPATCH_FILTER_ALLOW 0
+#define SYSCALL_DISPATCH_FILTER_BLOCK 1
+#endif
+#ifndef SYS_USER_DISPATCH
+#define SYS_USER_DISPATCH 2
+#endif
+
+using namespace std;
+
+const long ADD_SYSCALL = 335;
+
+// assembly wrapper function from syscall_ex.cpp, and the signal restorer for
+// Syscall User Dispatch, which is all the allowed range contains
+__asm__(
+    ".global add_syscall\n"
+    ".text\n"
+    "add_syscall:\n"
+    "    mov $335, %rax\n"
+    "    syscall\n"
+    "    ret\n"
+    ".global dispatch_restorer\n"
+    ".global dispatch_restorer_end\n"
+    "dispatch_restorer:\n"
+    "    mov $15, %rax\n" // rt_sigreturn
+    "    syscall\n"
+    "    ud2\n" // never reached, the range must hold the address after syscall
+    "dispatch_restorer_end:\n");
+
+extern "C" long add_syscall(int, int, int*);
+extern "C" char dispatch_restorer[], dispatch_restorer_end[];
+
+enum Backend{none, dispatch, seccomp};
+
+Backend backend = none;
+
+// Syscall User Dispatch traps while this is SYSCALL_DISPATCH_FILTER_BLOCK
+volatile char selector = SYSCALL_DISPATCH_FILTER_ALLOW;
+
+// add_syscall from syscall_ex.cpp. The int parameters are the lower halves of
+// the registers, and the arithmetic wraps around like in the kernel
+long emulate_add_syscall(int a, int b, int *c){
+    if(a > static_cast<int>(2147483647LL - b)){
+        return -1;
+    }
+    int sum = static_cast<int>(static_cast<long long>(a) + b);
+    iovec local = {&sum, sizeof(sum)}, remote = {c, sizeof(sum)};
+    if(syscall(SYS_process_vm_writev, getpid(), &local, 1, &remote, 1, 0) != sizeof(sum)){
+        return -2;
+    }
+    return 0;
+}
+
+// SIGSYS handler for both backends
+void trap(int, siginfo_t *info, void *context){
+    int interrupted = errno; // of the code the signal interrupted
+    greg_t *regs = static_cast<ucontext_t*>(context)->uc_mcontext.gregs;
+    if(info->si_code == SYS_USER_DISPATCH){
+        selector = SYSCALL_DISPATCH_FILTER_ALLOW;
+    }
+    long number = info->si_syscall, ret;
+    if(number == ADD_SYSCALL){
+        ret = emulate_add_syscall(static_cast<int>(regs[REG_RDI]), static_cast<int>(regs[REG_RSI]),
+                                  reinterpret_cast<int*>(regs[REG_RDX]));
+    }
+    else{
+        // any other system call that Syscall User Dispatch caught, made here
+        // instead. The raw return value, not the one syscall() makes of it
+        ret = syscall(number, regs[REG_RDI], regs[REG_RSI], regs[REG_RDX],
+                      regs[REG_R10], regs[REG_R8], regs[REG_R9]);
+        if(ret == -1){
+            ret = -errno;
+        }
+    }
+    regs[REG_RAX] = ret;
+    errno = interrupted;
+    if(info->si_code == SYS_USER_DISPATCH){
+        selector = SYSCALL_DISPATCH_FILTER_BLOCK;
+    }
+}
+
+// the kernel's struct sigaction on x86_64, which glibc's sigaction() fills in
+// with a restorer of its own
+struct kernel_sigaction{
+    void (*handler)(int, siginfo_t*, void*);
+    unsigned long flags;
+    void (*restorer)();
+    unsigned long mask;
+};
+
+const unsigned long SA_RESTORER_FLAG = 0x04000000;
+
+bool startdispatch(){
+    kernel_sigaction action = {trap, SA_SIGINFO | SA_RESTORER_FLAG,
+                               reinterpret_cast<void(*)()>(dispatch_restorer), 0};
+    if(syscall(SYS_rt_sigaction, SIGSYS, &action, nullptr, sizeof(action.mask))){
+        return false;
+    }
+    if(prctl(PR_SET_SYSCALL_USER_DISPATCH, PR_SYS_DISPATCH_ON,
+             reinterpret_cast<unsigned long>(dispatch_restorer),
+             dispatch_restorer_end - dispatch_restorer, &selector)){
+        return false;
+    }
+    selector = SYSCALL_DISPATCH_FILTER_BLOCK;
+    return true;
+}
+
+void stopdispatch(){
+    selector = SYSCALL_DISPATCH_FILTER_ALLOW;
+    prctl(PR_SET_SYSCALL_USER_DISPATCH, PR_SYS_DISPATCH_OFF, 0, 0, 0);
+}
+
+bool startseccomp(){
+    struct sigaction action = {};
+    action.sa_sigaction = trap;
+    action.sa_flags = SA_SIGINFO;
+    if(sigaction(SIGSYS, &action, nullptr)){
+        return false;
+    }
+    sock_filter filter[] = {
+        // a different architecture has different system call numbers
+        BPF_STMT(BPF_LD | BPF_W | BPF_ABS, offsetof(seccomp_data, arch)),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, AUDIT_ARCH_X86_64, 0, 3),
+        BPF_STMT(BPF_LD | BPF_W | BPF_ABS, offsetof(seccomp_data, nr)),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ADD_SYSCALL, 0, 1),
+        BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_TRAP),
+        BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_ALLOW),
+    };
+    sock_fprog program = {sizeof(filter) / sizeof(filter[0]), filter};
+    // required to install a filter without CAP_SYS_ADMIN
+    return !prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0) &&
+           !prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER, &program);
+}
+
+// prints the output
+void output(const char *way, int &oper1, int &oper2, int &sum, long int &amma){
+    cout << "    " << left << setw(10) << way << right;
+    switch(amma){
+        case 0:
+            cout << oper1 << " + " << oper2 << " = " << sum << endl;
+            break;
+        case -1:
+            cout << oper1 << " + " << oper2 << " = " << " overflow" << endl;
+            break;
+        case -2:
+            cout << "bad destination address" << endl;
+            break;
+        default:
+            cout << "returned " << amma << endl;
+    }
+}
+
+// the three ways from syscall_ex.cpp
+void example(int oper1, int oper2, int *destination){
+    int &sum = *destination;
+    long int amma;
+
+    __asm__ volatile("mov $335, %%rax;"
+                     "syscall;"
+                     : "=a" (amma)
+                     : "D" (oper1), "S" (oper2), "d" (destination)
+                     : "rcx", "r11", "memory");
+    output("inline", oper1, oper2, sum, amma);
+
+    amma = add_syscall(oper1, oper2, destination);
+    output("wrapper", oper1, oper2, sum, amma);
+
+    amma = syscall(335, oper1, oper2, destination);
+    if(amma == -1){
+        amma = -errno; // EPERM or ENOENT, the raw -1 or -2
+    }
+    output("syscall()", oper1, oper2, sum, amma);
+}
+
+inline long inlinesyscall(long number, int a, int b, int *c){
+    long ret;
+    __asm__ volatile("syscall"
+                     : "=a" (ret)
+                     : "a" (number), "D" (a), "S" (b), "d" (c)
+                     : "rcx", "r11", "memory");
+    return ret;
+}
+
+double now(){
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts); // the vDSO, no system call to trap
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// nanoseconds per call
+template<typename Call>
+double measure(size_t calls, Call call){
+    for(size_t i = 0; i < calls / 10; ++i){
+        call();
+    }
+    double t = now();
+    for(size_t i = 0; i < calls; ++i){
+        call();
+    }
+    return (now() - t) / calls * 1e9;
+}
+
+void report(const char *name, double ns, double native){
+    cout << "    " << left << setw(36) << name << right << fixed << setprecision(1)
+         << setw(10) << ns << " ns/call" << setw(10) << ns / native << " x native" << endl;
+}
+
+int main(int argc, char **argv){
+    string requested = argc > 1 ? argv[1] : "auto";
+    size_t calls = argc > 2 ? strtoul(argv[2], nullptr, 0) : 200000;
+    if(!calls){
+        calls = 1;
+    }
+    if(requested != "auto" && requested != "dispatch" && requested != "seccomp"){
+        cout << "backend is dispatch, seccomp or auto" << endl;
+        return 1;
+    }
+
+    int sum = 0;
+    // a native system call, before anything traps
+    double native = measure(calls, [&]{inlinesyscall(SYS_getppid, 0, 0, &sum);});
+
+    if(requested != "seccomp"){
+        if(startdispatch()){
+            backend = dispatch;
+        }
+        else if(requested == "dispatch"){
+            cout << "Syscall User Dispatch not available: " << strerror(errno) << endl;
+            return 1;
+        }
+    }
+    if(backend == none){
+        if(!startseccomp()){
+            cout << "seccomp not available: " << strerror(errno) << endl;
+            return 1;
+        }
+        backend = seccomp;
+    }
+    cout << "emulating add_syscall with " << (backend == dispatch ? "Syscall User Dispatch" : "seccomp") << endl;
+
+    // a read only page for the bad destination address
+    int *readonly = static_cast<int*>(mmap(nullptr, 4096, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    example(2, 3, &sum);
+    example(2147483647, 3, &sum);
+    example(2, 3, readonly);
+    cout << endl;
+
+    cout << calls << " calls each" << endl;
+    report("native getppid", native, native);
+    report("emulated 335, inline", measure(calls, [&]{inlinesyscall(ADD_SYSCALL, 2, 3, &sum);}), native);
+    report("emulated 335, wrapper", measure(calls, [&]{add_syscall(2, 3, &sum);}), native);
+    report("emulated 335, syscall()", measure(calls, [&]{syscall(ADD_SYSCALL, 2, 3, &sum);}), native);
+    report(backend == dispatch ? "getppid, dispatch on (forwarded)" : "getppid, filter installed",
+           measure(calls, [&]{inlinesyscall(SYS_getppid, 0, 0, &sum);}), native);
+    if(backend == dispatch){
+        stopdispatch();
+        report("getppid, dispatch off", measure(calls, [&]{inlinesyscall(SYS_getppid, 0, 0, &sum);}), native);
+    }
+    munmap(readonly, 4096);
+    return 0;
+}
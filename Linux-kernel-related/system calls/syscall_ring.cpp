@@ -0,0 +1,369 @@
+/*
+    Batched system calls with a ring
+
+    add_syscall from syscall_ex.cpp adds two integers and copies the sum to user
+    space, a few nanoseconds of work, and every call of it pays for a complete
+    entry into the kernel and back, a few hundred nanoseconds (see
+    syscall_bench.cpp). io_uring gets around that for I/O by not making a system
+    call per request: the program writes requests into a ring of submission
+    queue entries (SQEs) in memory it shares with the kernel and makes one
+    system call, io_uring_enter(), for all of them; the kernel writes a
+    completion queue entry (CQE) with the result of each request into a second
+    ring. With a kernel thread polling the submission ring (IORING_SETUP_SQPOLL)
+    not even that system call is needed while the thread is awake.
+
+    Here is the same for add_syscall. A submission entry holds the two integers
+    and the address the sum goes to, a completion entry the return value of
+    add_syscall for that entry: 0, -1 for overflow or -2 for a bad address.
+    Both rings are single producer, single consumer: the head is moved by
+    whoever takes entries out, the tail by whoever puts them in, and each side
+    publishes its index with a release store after writing the entries, which
+    the other side loads with acquire before reading them.
+
+    In the kernel the enter call would look like this (not built here):
+                                                                             */
+#if 0
+            SYSCALL_DEFINE3(add_ring_enter, struct add_ring __user *, ring,
+                            unsigned int, to_submit, unsigned int, flags){
+                unsigned int head = READ_ONCE(ring->sq_head);
+                unsigned int tail = smp_load_acquire(&ring->sq_tail);
+                ...
+                for(i = 0; i < n; ++i){
+                    copy_from_user(&sqe, &ring->sqes[(head + i) & mask], sizeof(sqe));
+                    res = add(sqe.a, sqe.b, sqe.result); // add_syscall's body
+                    cqe = (struct add_cqe){sqe.user_data, res};
+                    copy_to_user(&ring->cqes[(cqtail + i) & mask], &cqe, sizeof(cqe));
+                }
+                smp_store_release(&ring->sq_head, head + n);
+                smp_store_release(&ring->cq_tail, cqtail + n);
+                return n;
+            }
+#endif
+                                                                             /*
+    There is no such system call in a stock kernel, so two backends in user
+    space stand in for it, both running the same add_ring_process():
+
+    1.  inline: add_ring_enter() processes the entries in the calling thread,
+        like the system call would.
+
+    2.  worker: a thread polls the submission ring like the SQPOLL kernel
+        thread. When it has found nothing to do for a while it sets
+        ADD_RING_NEED_WAKEUP and goes to sleep, and add_ring_enter() wakes it
+        up; otherwise submitting is just moving the tail.
+
+    To keep the semantics of copy_to_user() (a bad address is an error code,
+    not a crash) add_ring_process() writes the sums with process_vm_writev() to
+    its own process. It takes up to 1024 addresses at a time and stops at the
+    first one it can't write, so it's one real kernel entry for up to 1024
+    additions, which is what an add_ring_enter() would cost too. The
+    comparison is against one process_vm_writev() per addition, which is
+    add_syscall's cost: a kernel entry, an overflow check and a copy_to_user().
+
+    arguments: additions per batch size, backend (inline, worker or both)
+
+    g++ -O2 -pthread syscall_ring.cpp && ./a.out 1048576 both
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <ctime>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+using namespace std;
+
+const unsigned ADD_RING_ENTRIES = 4096; // a power of 2
+const unsigned ADD_RING_CQ_ENTRIES = 2 * ADD_RING_ENTRIES; // room for completions not reaped yet
+const unsigned ADD_RING_NEED_WAKEUP = 1;
+const unsigned IOV_BATCH = 1024; // UIO_MAXIOV, the most process_vm_writev() takes
+
+// submission queue entry, add_syscall's parameters
+struct add_sqe{
+    int a, b;
+    int *result;
+    uint64_t user_data; // handed back in the completion
+};
+
+// completion queue entry, add_syscall's return value
+struct add_cqe{
+    uint64_t user_data;
+    int res;
+};
+
+// the shared rings, the indices are free running and masked on access
+struct add_ring{
+    alignas(64) atomic<unsigned> sq_head{0}; // moved by the consumer
+    alignas(64) atomic<unsigned> sq_tail{0}; // moved by the program
+    alignas(64) atomic<unsigned> cq_head{0}; // moved by the program
+    alignas(64) atomic<unsigned> cq_tail{0}; // moved by the consumer
+    alignas(64) atomic<unsigned> flags{0};
+    add_sqe sqes[ADD_RING_ENTRIES];
+    add_cqe cqes[ADD_RING_CQ_ENTRIES];
+};
+
+// the next free submission entry, nullptr if the ring is full
+add_sqe *add_ring_get_sqe(add_ring *ring){
+    unsigned tail = ring->sq_tail.load(memory_order_relaxed);
+    if(tail - ring->sq_head.load(memory_order_acquire) == ADD_RING_ENTRIES){
+        return nullptr;
+    }
+    return &ring->sqes[tail & (ADD_RING_ENTRIES - 1)];
+}
+
+// publishes the entry add_ring_get_sqe() returned
+void add_ring_advance_sq(add_ring *ring){
+    ring->sq_tail.store(ring->sq_tail.load(memory_order_relaxed) + 1, memory_order_release);
+}
+
+// the oldest completion, nullptr if there is none
+add_cqe *add_ring_peek_cqe(add_ring *ring){
+    unsigned head = ring->cq_head.load(memory_order_relaxed);
+    if(head == ring->cq_tail.load(memory_order_acquire)){
+        return nullptr;
+    }
+    return &ring->cqes[head & (ADD_RING_CQ_ENTRIES - 1)];
+}
+
+void add_ring_cqe_seen(add_ring *ring){
+    ring->cq_head.store(ring->cq_head.load(memory_order_relaxed) + 1, memory_order_release);
+}
+
+// the consumer side, what the add_ring_enter system call would do: takes up to
+// max submitted entries (as many as the completion ring has room for), runs
+// add_syscall on each and posts their completions. Returns how many it took
+unsigned add_ring_process(add_ring *ring, unsigned max){
+    unsigned head = ring->sq_head.load(memory_order_relaxed);
+    unsigned cqtail = ring->cq_tail.load(memory_order_relaxed);
+    unsigned n = min({ring->sq_tail.load(memory_order_acquire) - head, max,
+                      ADD_RING_CQ_ENTRIES - (cqtail - ring->cq_head.load(memory_order_acquire))});
+    int sums[IOV_BATCH], res[IOV_BATCH];
+    unsigned which[IOV_BATCH];
+    iovec local[IOV_BATCH], remote[IOV_BATCH];
+    for(unsigned done = 0; done < n; ){
+        unsigned chunk = min(n - done, IOV_BATCH), count = 0;
+        for(unsigned i = 0; i < chunk; ++i){
+            const add_sqe &sqe = ring->sqes[(head + done + i) & (ADD_RING_ENTRIES - 1)];
+            if(sqe.a > static_cast<int>(2147483647LL - sqe.b)){
+                res[i] = -1;
+                continue;
+            }
+            res[i] = 0;
+            sums[count] = static_cast<int>(static_cast<long long>(sqe.a) + sqe.b);
+            local[count] = {&sums[count], sizeof(int)};
+            remote[count] = {sqe.result, sizeof(int)};
+            which[count++] = i;
+        }
+        // copy_to_user() for the whole chunk, restarted after each bad address
+        for(unsigned k = 0; k < count; ){
+            long written = syscall(SYS_process_vm_writev, getpid(), local + k, count - k, remote + k, count - k, 0);
+            k += written > 0 ? written / sizeof(int) : 0;
+            if(k < count){
+                res[which[k++]] = -2;
+            }
+        }
+        for(unsigned i = 0; i < chunk; ++i){
+            const add_sqe &sqe = ring->sqes[(head + done + i) & (ADD_RING_ENTRIES - 1)];
+            ring->cqes[(cqtail + done + i) & (ADD_RING_CQ_ENTRIES - 1)] = {sqe.user_data, res[i]};
+        }
+        done += chunk;
+        ring->sq_head.store(head + done, memory_order_release);
+        ring->cq_tail.store(cqtail + done, memory_order_release);
+    }
+    return n;
+}
+
+// the submission polling thread of the worker backend
+class AddRingWorker{
+public:
+    explicit AddRingWorker(add_ring *ring): ring(ring), thread([this]{run();}){}
+
+    ~AddRingWorker(){
+        {
+            lock_guard<mutex> lock(sleep);
+            stopping = true;
+        }
+        wakeup.notify_one();
+        thread.join();
+    }
+
+    void wake(){
+        lock_guard<mutex> lock(sleep);
+        ring->flags.fetch_and(~ADD_RING_NEED_WAKEUP, memory_order_relaxed);
+        wakeup.notify_one();
+    }
+
+private:
+    void run(){
+        const int idle = 1000; // empty polls before going to sleep
+        for(int empty = 0; ; ){
+            if(add_ring_process(ring, ADD_RING_ENTRIES)){
+                empty = 0;
+                continue;
+            }
+            if(++empty < idle){
+                this_thread::yield();
+                continue;
+            }
+            unique_lock<mutex> lock(sleep);
+            ring->flags.fetch_or(ADD_RING_NEED_WAKEUP, memory_order_seq_cst);
+            // an entry submitted before the flag was visible would be missed
+            if(ring->sq_tail.load(memory_order_seq_cst) != ring->sq_head.load(memory_order_relaxed)){
+                ring->flags.fetch_and(~ADD_RING_NEED_WAKEUP, memory_order_relaxed);
+                continue;
+            }
+            wakeup.wait(lock, [this]{
+                return stopping || !(ring->flags.load(memory_order_relaxed) & ADD_RING_NEED_WAKEUP);
+            });
+            if(stopping){
+                return;
+            }
+            empty = 0;
+        }
+    }
+
+    add_ring *ring;
+    mutex sleep;
+    condition_variable wakeup;
+    bool stopping = false;
+    std::thread thread;
+};
+
+// submits what's in the ring and waits until at least min_complete
+// completions are there. With a worker the entries are its to take already,
+// it only needs waking up if it's asleep
+void add_ring_enter(add_ring *ring, AddRingWorker *worker, unsigned min_complete){
+    if(!worker){
+        add_ring_process(ring, ADD_RING_ENTRIES);
+        return;
+    }
+    atomic_thread_fence(memory_order_seq_cst); // pairs with the worker's check after setting the flag
+    if(ring->flags.load(memory_order_relaxed) & ADD_RING_NEED_WAKEUP){
+        worker->wake();
+    }
+    while(ring->cq_tail.load(memory_order_acquire) - ring->cq_head.load(memory_order_relaxed) < min_complete){
+        this_thread::yield();
+    }
+}
+
+// add_syscall with one kernel entry per addition, for comparison
+int add_one(int a, int b, int *result){
+    if(a > static_cast<int>(2147483647LL - b)){
+        return -1;
+    }
+    int sum = static_cast<int>(static_cast<long long>(a) + b);
+    iovec local = {&sum, sizeof(sum)}, remote = {result, sizeof(sum)};
+    return syscall(SYS_process_vm_writev, getpid(), &local, 1, &remote, 1, 0) == sizeof(sum) ? 0 : -2;
+}
+
+double now(){
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+void report(const string &name, size_t adds, double seconds){
+    cout << "    " << left << setw(28) << name << right << fixed << setprecision(1)
+         << setw(10) << seconds / adds * 1e9 << " ns/add" << setw(10) << adds / seconds * 1e-6 << " M adds/s" << endl;
+}
+
+// the example from syscall_ex.cpp through the ring
+void example(add_ring *ring, AddRingWorker *worker, int *readonly){
+    static int sums[3];
+    struct{int a, b; int *result;} requests[] = {{2, 3, &sums[0]}, {2147483647, 3, &sums[1]}, {2, 3, readonly}};
+    for(uint64_t i = 0; i < 3; ++i){
+        *add_ring_get_sqe(ring) = {requests[i].a, requests[i].b, requests[i].result, i};
+        add_ring_advance_sq(ring);
+    }
+    add_ring_enter(ring, worker, 3);
+    while(add_cqe *cqe = add_ring_peek_cqe(ring)){
+        auto &request = requests[cqe->user_data];
+        cout << "    " << request.a << " + " << request.b << ": ";
+        switch(cqe->res){
+            case 0:
+                cout << *request.result << endl;
+                break;
+            case -1:
+                cout << "overflow" << endl;
+                break;
+            case -2:
+                cout << "bad destination address" << endl;
+        }
+        add_ring_cqe_seen(ring);
+    }
+}
+
+// batches of batch additions through the ring until adds are done
+void measure(add_ring *ring, AddRingWorker *worker, const char *backend, size_t adds, unsigned batch){
+    vector<int> results(batch);
+    size_t done = 0, wrong = 0;
+    double t = now();
+    for(; done < adds; done += batch){
+        for(unsigned i = 0; i < batch; ++i){
+            *add_ring_get_sqe(ring) = {static_cast<int>(done), static_cast<int>(i), &results[i], i};
+            add_ring_advance_sq(ring);
+        }
+        add_ring_enter(ring, worker, batch);
+        for(unsigned i = 0; i < batch; ++i){
+            add_cqe *cqe = add_ring_peek_cqe(ring);
+            wrong += cqe->res || results[cqe->user_data] != static_cast<int>(done + cqe->user_data);
+            add_ring_cqe_seen(ring);
+        }
+    }
+    report(string(backend) + ", batch " + to_string(batch), done, now() - t);
+    if(wrong){
+        cout << "    " << wrong << " wrong sums" << endl;
+    }
+}
+
+int main(int argc, char **argv){
+    size_t adds = argc > 1 ? strtoul(argv[1], nullptr, 0) : 1 << 20;
+    string backend = argc > 2 ? argv[2] : "both";
+    if(adds < ADD_RING_ENTRIES){
+        adds = ADD_RING_ENTRIES;
+    }
+
+    add_ring *ring = new add_ring;
+    int *readonly = static_cast<int*>(mmap(nullptr, 4096, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    cout << "example, inline" << endl;
+    example(ring, nullptr, readonly);
+    {
+        AddRingWorker worker(ring);
+        cout << "example, worker" << endl;
+        example(ring, &worker, readonly);
+    }
+    cout << endl;
+
+    cout << adds << " additions" << endl;
+    int sum;
+    double t = now();
+    for(size_t i = 0; i < adds; ++i){
+        add_one(static_cast<int>(i), 1, &sum);
+    }
+    report("one kernel entry per add", adds, now() - t);
+    if(backend != "worker"){
+        for(unsigned batch = 1; batch <= ADD_RING_ENTRIES; batch *= 2){
+            measure(ring, nullptr, "inline", adds, batch);
+        }
+    }
+    if(backend != "inline"){
+        AddRingWorker worker(ring);
+        for(unsigned batch = 1; batch <= ADD_RING_ENTRIES; batch *= 2){
+            measure(ring, &worker, "worker", adds, batch);
+        }
+    }
+    munmap(readonly, 4096);
+    delete ring;
+    return 0;
+}